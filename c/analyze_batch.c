@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "analyzer_session.h"
+#include "fftw_wisdom.h"
+#include "profiler.h"
+
+// Analyzes many files with one Analyzer_Session, so threads, plans and the
+// OpenCL setup are paid once instead of per file. Short files run in
+// parallel, one per worker; long ones are split over several workers. Each
+// file is printed as soon as it is done, so the order can differ from the
+// input order.
+//
+// Usage: analyze_batch [--backend fftw|kiss|opencl] [--threads <n>] [--cpu]
+//                      [--channel <n|mix>] [--precision <double|single>]
+//                      [--window <name>] [--wisdom-dir <dir> | --no-wisdom]
+//                      [--list <file>] [--profile] [--trace <file>]
+//                      <blocksize> <shift> <threshold> [<file|directory> ...]
+//
+// Directories contribute their *.wav files in name order; --list reads one
+// path per line ("-" for stdin). Each file prints its name followed by the
+// bins above the threshold, in the format of the single-file programs. The
+// last line reports the throughput in files/s and MB/s of sample data.
+
+#ifndef FFT_KERNEL_PATH
+#define FFT_KERNEL_PATH "../fft_kernel.cl"
+#endif
+
+typedef struct {
+  char** paths;
+  int count;
+  int capacity;
+} File_List;
+
+void add_file(File_List* list, const char* path) {
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity ? 2 * list->capacity : 64;
+    list->paths = realloc(list->paths, list->capacity * sizeof(char*));
+  }
+  list->paths[list->count++] = strdup(path);
+}
+
+int compare_paths(const void* a, const void* b) {
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+int has_wav_suffix(const char* name) {
+  size_t length = strlen(name);
+  return length > 4 && strcasecmp(name + length - 4, ".wav") == 0;
+}
+
+int add_directory(File_List* list, const char* dir) {
+  DIR* handle = opendir(dir);
+  if (!handle) {
+    perror("Error opening directory");
+    return 0;
+  }
+  int first = list->count;
+  struct dirent* entry;
+  while ((entry = readdir(handle))) {
+    if (has_wav_suffix(entry->d_name)) {
+      char path[4096];
+      snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+      add_file(list, path);
+    }
+  }
+  closedir(handle);
+  qsort(list->paths + first, list->count - first, sizeof(char*), compare_paths);
+  return 1;
+}
+
+int add_list(File_List* list, const char* filename) {
+  FILE* file = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+  if (!file) {
+    perror("Error opening file list");
+    return 0;
+  }
+  char line[4096];
+  while (fgets(line, sizeof(line), file)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0]) {
+      add_file(list, line);
+    }
+  }
+  if (file != stdin) {
+    fclose(file);
+  }
+  return 1;
+}
+
+int add_path(File_List* list, const char* path) {
+  struct stat info;
+  if (stat(path, &info) == 0 && S_ISDIR(info.st_mode)) {
+    return add_directory(list, path);
+  }
+  add_file(list, path);
+  return 1;
+}
+
+typedef struct {
+  int threshold;
+  long files;
+  long bytes;
+} Batch_Totals;
+
+// Called once per finished file, never concurrently.
+void print_result(const Session_Result* result, void* user) {
+  Batch_Totals* totals = user;
+  int threshold = totals->threshold;
+  totals->files++;
+  totals->bytes += result->bytes;
+  int blocksize = 2 * result->bins_size;
+  printf("%s\n", result->filename);
+  for (int i = 0; i < result->bins_size; i++) {
+    if (result->bins[i] > threshold) {
+      printf("%dHz %f\n", (int)((long)i * result->sample_rate / blocksize), result->bins[i]);
+    }
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+int parse_backend(const char* name, Session_Backend* backend) {
+  const char* names[] = {"fftw", "kiss", "opencl"};
+  for (int i = 0; i < 3; i++) {
+    if (strcmp(name, names[i]) == 0) {
+      *backend = (Session_Backend)i;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  static struct option options[] = {
+    {"backend", required_argument, NULL, 'b'},
+    {"threads", required_argument, NULL, 't'},
+    {"cpu", no_argument, NULL, 'g'},
+    {"channel", required_argument, NULL, 'c'},
+    {"precision", required_argument, NULL, 'P'},
+    {"window", required_argument, NULL, 'W'},
+    {"wisdom-dir", required_argument, NULL, 'w'},
+    {"no-wisdom", no_argument, NULL, 'n'},
+    {"list", required_argument, NULL, 'l'},
+    {"profile", no_argument, NULL, 'o'},
+    {"trace", required_argument, NULL, 'T'},
+    {NULL, 0, NULL, 0}
+  };
+
+  Session_Config config = {
+    .backend = SESSION_FFTW,
+    .channel = 0,
+    .precision = PRECISION_DOUBLE,
+    .threads = 0,
+    .wisdom_dir = fftw_wisdom_default_dir(),
+    .kernel_path = FFT_KERNEL_PATH,
+    .device_type = CL_DEVICE_TYPE_GPU
+  };
+  File_List files = {NULL, 0, 0};
+  int profile = 0;
+  const char* trace = NULL;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+    switch (opt) {
+    case 'b':
+      if (!parse_backend(optarg, &config.backend)) {
+        fprintf(stderr, "Unknown backend: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 't':
+      config.threads = atoi(optarg);
+      break;
+    case 'g':
+      config.device_type = CL_DEVICE_TYPE_CPU;
+      break;
+    case 'c':
+      config.channel = strcmp(optarg, "mix") == 0 ? WAV_DOWNMIX : atoi(optarg);
+      break;
+    case 'P':
+      if (!parse_precision(optarg, &config.precision)) {
+        fprintf(stderr, "Unknown precision: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'W':
+      if (!parse_window(optarg, &config.window)) {
+        fprintf(stderr, "Unknown window: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'w':
+      config.wisdom_dir = optarg;
+      break;
+    case 'n':
+      config.wisdom_dir = NULL;
+      break;
+    case 'l':
+      if (!add_list(&files, optarg)) {
+        return 1;
+      }
+      break;
+    case 'o':
+      profile = 1;
+      break;
+    case 'T':
+      profile = 1;
+      trace = optarg;
+      break;
+    default:
+      return 1;
+    }
+  }
+
+  if (argc - optind < 3) {
+    fprintf(stderr, "Usage: %s [--backend fftw|kiss|opencl] [--threads <n>] [--cpu] [--channel <n|mix>] "
+                    "[--precision <double|single>] [--window <name>] [--wisdom-dir <dir> | --no-wisdom] [--list <file>] "
+                    "[--profile] [--trace <file>] <blocksize> <shift> <threshold> [<file|directory> ...]\n", argv[0]);
+    return 1;
+  }
+
+  char** args = argv + optind;
+  config.blocksize = atoi(args[0]) < 2 ? 2 : atoi(args[0]);
+  config.shift = atoi(args[1]);
+  config.shift = config.shift < 1 ? 1 : config.shift > config.blocksize ? config.blocksize : config.shift;
+  Batch_Totals totals = {atoi(args[2]), 0, 0};
+  for (int i = optind + 3; i < argc; i++) {
+    if (!add_path(&files, argv[i])) {
+      return 1;
+    }
+  }
+
+  // Started before the session, so setup and the OpenCL queue are covered.
+  if (profile) {
+    profiler_start(trace != NULL);
+  }
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+
+  Analyzer_Session* session = create_analyzer_session(&config);
+  if (!session) {
+    return 1;
+  }
+  int failed = analyzer_session_run(session, files.paths, files.count, print_result, &totals);
+  destroy_analyzer_session(session);
+
+  gettimeofday(&end, NULL);
+  double elapsed_time = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+  double megabytes = totals.bytes / 1e6;
+  printf("Analyzed %ld files (%d failed), %.1f MB in %f seconds: %.1f files/s, %.1f MB/s\n",
+         totals.files, failed, megabytes, elapsed_time, totals.files / elapsed_time, megabytes / elapsed_time);
+  if (profile) {
+    profiler_report(stderr);
+    if (trace) {
+      profiler_write_trace(trace);
+    }
+    profiler_stop();
+  }
+
+  for (int i = 0; i < files.count; i++) {
+    free(files.paths[i]);
+  }
+  free(files.paths);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "analyzer_session.h"
+#include "bins_reduce.h"
+#include "fftw_wisdom.h"
+#include "profiler.h"
+
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+// Windows per scheduled batch for KISS, which transforms one window at a
+// time; FFTW batches match the engine's plan.
+#define KISS_WINDOW_BATCH 64
+
+// analyzer_session_run gives a file one more worker per this many batches,
+// so short files stay on one worker and run in parallel with each other.
+#define BATCHES_PER_TASK 32
+
+// Files opened ahead per worker: they are prefetched while earlier files
+// are being analyzed.
+#define FILES_IN_FLIGHT_PER_WORKER 2
+
+// One file being analyzed. Its windows are split over `tasks` pool tasks;
+// task i owns deque i of the scheduler and reducer i, whichever worker runs
+// it. Every batch is one reduction leaf (see bins_reduce.h), so the bins do
+// not depend on the number of tasks or on stealing. The task that finishes
+// last completes the file.
+typedef struct File_Job File_Job;
+
+typedef struct {
+  File_Job* job;
+  int slot;
+} Job_Task;
+
+struct File_Job {
+  Analyzer_Session* session;
+  WAV_Reader* reader;
+  Session_Result* result;
+  Batch_Scheduler* scheduler;
+  int tasks;
+  int tasks_left;            // under session->lock
+  Job_Task* task_args;
+  Bins_Reducer** reducers;   // one per task
+  Session_Callback done;     // NULL: the caller collects the result
+  void* user;
+};
+
+static void create_worker(Analyzer_Session* session, Session_Worker* worker) {
+  const Session_Config* config = &session->config;
+  int n = config->blocksize;
+  if (config->backend == SESSION_FFTW) {
+    // The cached plan is shared; only the buffers are per worker.
+    worker->engine = create_fftw_batch(n, config->shift, FFTW_WISDOM_FLAGS, config->precision, session->window);
+  } else {
+    worker->block = malloc(sizeof(double) * n);
+    worker->fft_in = malloc(sizeof(kiss_fft_cpx) * n);
+    worker->fft_out = malloc(sizeof(kiss_fft_cpx) * n);
+    worker->scratch = malloc(sizeof(kiss_fft_cpx) * kiss_plan_scratch_size(session->kiss_plan));
+  }
+}
+
+static void destroy_worker(Session_Worker* worker) {
+  if (worker->engine) {
+    destroy_fftw_batch(worker->engine);
+  }
+  free(worker->block);
+  free(worker->fft_in);
+  free(worker->fft_out);
+  free(worker->scratch);
+}
+
+Analyzer_Session* create_analyzer_session(const Session_Config* config) {
+  Analyzer_Session* session = calloc(1, sizeof(Analyzer_Session));
+  session->config = *config;
+  session->bins_size = config->blocksize / 2;
+  pthread_mutex_init(&session->lock, NULL);
+  pthread_mutex_init(&session->output, NULL);
+  pthread_cond_init(&session->finished, NULL);
+  session->window = create_window(&config->window, config->blocksize);
+
+  if (config->backend == SESSION_OPENCL) {
+    session->pipeline = create_cl_pipeline(config->kernel_path, config->device_type,
+                                           config->blocksize, config->shift, session->window, config->precision);
+    if (!session->pipeline) {
+      destroy_analyzer_session(session);
+      return NULL;
+    }
+    return session;
+  }
+
+  session->pool = create_thread_pool(config->threads);
+  session->workers = calloc(session->pool->threads, sizeof(Session_Worker));
+  if (config->backend == SESSION_FFTW) {
+    fftw_wisdom_import(config->wisdom_dir, config->blocksize);
+  } else {
+    long long start = profile_begin();
+    session->kiss_plan = get_kiss_plan(config->blocksize);
+    profile_end(PHASE_PLAN, start);
+  }
+  for (int i = 0; i < session->pool->threads; i++) {
+    create_worker(session, &session->workers[i]);
+  }
+  if (config->backend == SESSION_FFTW) {
+    fftw_wisdom_export(config->wisdom_dir, config->blocksize);
+    session->batch = session->workers[0].engine->batch;
+  } else {
+    session->batch = KISS_WINDOW_BATCH;
+  }
+  return session;
+}
+
+void destroy_analyzer_session(Analyzer_Session* session) {
+  if (session->pipeline) {
+    destroy_cl_pipeline(session->pipeline);
+  }
+  if (session->pool) {
+    int threads = session->pool->threads;
+    destroy_thread_pool(session->pool);
+    for (int i = 0; i < threads; i++) {
+      destroy_worker(&session->workers[i]);
+    }
+    free(session->workers);
+    if (session->config.backend == SESSION_FFTW) {
+      fftw_batch_cleanup();
+    } else {
+      kiss_plan_cleanup();
+    }
+  }
+  pthread_cond_destroy(&session->finished);
+  pthread_mutex_destroy(&session->output);
+  pthread_mutex_destroy(&session->lock);
+  free(session->window);
+  free(session);
+}
+
+static File_Job* open_job(Analyzer_Session* session, const char* filename, Session_Callback done, void* user) {
+  WAV_Reader* reader = open_wav_reader(filename, session->config.channel);
+  if (!reader) {
+    return NULL;
+  }
+
+  File_Job* job = calloc(1, sizeof(File_Job));
+  job->session = session;
+  job->reader = reader;
+  job->done = done;
+  job->user = user;
+
+  Session_Result* result = malloc(sizeof(Session_Result));
+  result->filename = strdup(filename);
+  result->sample_rate = reader->sample_rate;
+  result->bins_size = session->bins_size;
+  result->bins = calloc(session->bins_size, sizeof(double));
+  result->bytes = reader->samples * reader->block_align;
+  result->windows = 0;
+  if (reader->samples >= session->config.blocksize) {
+    result->windows = (reader->samples - session->config.blocksize) / session->config.shift + 1;
+  }
+  job->result = result;
+  return job;
+}
+
+// Reduces the bins of all tasks, hands the result on and frees the job.
+// For analyzer_session_analyze the job and result are left to the caller.
+static void finish_job(File_Job* job) {
+  Analyzer_Session* session = job->session;
+  Session_Result* result = job->result;
+  long long start = profile_begin();
+  if (job->tasks > 0) {
+    for (int t = 1; t < job->tasks; t++) {
+      bins_reducer_merge(job->reducers[0], job->reducers[t]);
+      destroy_bins_reducer(job->reducers[t]);
+    }
+    bins_reducer_result(job->reducers[0], result->bins);
+    destroy_bins_reducer(job->reducers[0]);
+  }
+  for (int i = 0; i < result->bins_size; i++) {
+    result->bins[i] /= result->windows;
+    result->bins[i] = 20 * log10(result->bins[i]);
+  }
+  profile_end(PHASE_REDUCE, start);
+
+  close_wav_reader(job->reader);
+  job->reader = NULL;
+  if (job->scheduler) {
+    destroy_batch_scheduler(job->scheduler);
+  }
+  free(job->task_args);
+  free(job->reducers);
+  if (!job->done) {
+    return;
+  }
+
+  pthread_mutex_lock(&session->output);
+  job->done(result, job->user);
+  pthread_mutex_unlock(&session->output);
+  destroy_session_result(result);
+  free(job);
+
+  pthread_mutex_lock(&session->lock);
+  session->in_flight--;
+  pthread_cond_signal(&session->finished);
+  pthread_mutex_unlock(&session->lock);
+}
+
+// Pool task: transforms batches of the job until none is left, each into a
+// leaf of the task's reducer.
+static void process_batches(void* arg, int index) {
+  Job_Task* task = arg;
+  File_Job* job = task->job;
+  Analyzer_Session* session = job->session;
+  Session_Worker* worker = &session->workers[index];
+  const WAV_Reader* reader = job->reader;
+  int n = session->config.blocksize;
+  int shift = session->config.shift;
+  long total = job->result->windows;
+  Bins_Reducer* reducer = job->reducers[task->slot];
+
+  long batch;
+  while ((batch = batch_scheduler_next(job->scheduler, task->slot)) >= 0) {
+    long first = batch * session->batch;
+    long windows = MIN(session->batch, total - first);
+    double* bins = bins_reducer_leaf(reducer);
+    if (worker->engine) {
+      fftw_batch_accumulate(worker->engine, reader, first, windows, bins);
+      bins_reducer_add(reducer, batch, bins);
+      continue;
+    }
+    for (long window = first; window < first + windows; window++) {
+      wav_reader_read(reader, window * shift, n, worker->block);
+      long long start = profile_begin();
+      const double* coefficients = session->window;
+      if (coefficients) {
+        for (int i = 0; i < n; i++) {
+          worker->fft_in[i].r = worker->block[i] * coefficients[i];
+          worker->fft_in[i].i = 0;
+        }
+      } else {
+        for (int i = 0; i < n; i++) {
+          worker->fft_in[i].r = worker->block[i];
+          worker->fft_in[i].i = 0;
+        }
+      }
+      profile_end(PHASE_WINDOW, start);
+      start = profile_begin();
+      kiss_plan_execute(session->kiss_plan, worker->fft_in, worker->fft_out, worker->scratch);
+      profile_end(PHASE_FFT, start);
+      start = profile_begin();
+      accumulate_bins_float((const float*)worker->fft_out, 1, n, session->bins_size, ACCUMULATE_MAGNITUDE, bins);
+      profile_end(PHASE_ACCUMULATE, start);
+    }
+    bins_reducer_add(reducer, batch, bins);
+  }
+
+  pthread_mutex_lock(&session->lock);
+  int last = --job->tasks_left == 0;
+  pthread_mutex_unlock(&session->lock);
+  if (last) {
+    finish_job(job);
+  }
+}
+
+// Splits the job's windows over `tasks` pool tasks (at most one per batch).
+static void submit_job(File_Job* job, int tasks) {
+  Analyzer_Session* session = job->session;
+  long batches = (job->result->windows + session->batch - 1) / session->batch;
+  job->tasks = (int)MAX(MIN(tasks, batches), 0);
+  if (job->tasks == 0) {
+    finish_job(job);
+    return;
+  }
+
+  job->tasks_left = job->tasks;
+  job->scheduler = create_batch_scheduler(batches, job->tasks);
+  job->reducers = malloc(job->tasks * sizeof(Bins_Reducer*));
+  job->task_args = malloc(job->tasks * sizeof(Job_Task));
+  for (int t = 0; t < job->tasks; t++) {
+    job->reducers[t] = create_bins_reducer(session->bins_size);
+  }
+  for (int t = 0; t < job->tasks; t++) {
+    job->task_args[t].job = job;
+    job->task_args[t].slot = t;
+    thread_pool_submit(session->pool, process_batches, &job->task_args[t]);
+  }
+}
+
+// OpenCL: the device parallelises inside the file; the host just feeds it.
+static void run_opencl(File_Job* job) {
+  if (job->result->windows > 0) {
+    cl_pipeline_accumulate(job->session->pipeline, job->reader, job->result->bins);
+  }
+  finish_job(job);
+}
+
+Session_Result* analyzer_session_analyze(Analyzer_Session* session, const char* filename) {
+  File_Job* job = open_job(session, filename, NULL, NULL);
+  if (!job) {
+    return NULL;
+  }
+  if (session->pipeline) {
+    run_opencl(job);
+  } else {
+    submit_job(job, session->pool->threads);
+    long long start = profile_begin();
+    thread_pool_wait(session->pool);
+    profile_end(PHASE_WAIT, start);
+  }
+  Session_Result* result = job->result;
+  free(job);
+  return result;
+}
+
+void destroy_session_result(Session_Result* result) {
+  free(result->filename);
+  free(result->bins);
+  free(result);
+}
+
+// Opens the next readable file of the list, counting the ones that fail.
+static File_Job* open_next(Analyzer_Session* session, char** filenames, int count, int* index,
+                           Session_Callback done, void* user, int* failed) {
+  while (*index < count) {
+    File_Job* job = open_job(session, filenames[(*index)++], done, user);
+    if (job) {
+      return job;
+    }
+    (*failed)++;
+  }
+  return NULL;
+}
+
+int analyzer_session_run(Analyzer_Session* session, char** filenames, int count,
+                         Session_Callback done, void* user) {
+  int failed = 0;
+  int index = 0;
+
+  if (session->pipeline) {
+    // One file on the device at a time; the next one is opened and
+    // prefetched before the current one is transformed.
+    File_Job* next = open_next(session, filenames, count, &index, done, user, &failed);
+    while (next) {
+      File_Job* job = next;
+      next = open_next(session, filenames, count, &index, done, user, &failed);
+      if (next) {
+        wav_reader_prefetch(next->reader);
+      }
+      session->in_flight++;
+      run_opencl(job);
+    }
+    return failed;
+  }
+
+  int threads = session->pool->threads;
+  int limit = FILES_IN_FLIGHT_PER_WORKER * threads;
+  File_Job* job;
+  while ((job = open_next(session, filenames, count, &index, done, user, &failed))) {
+    wav_reader_prefetch(job->reader);
+
+    long long start = profile_begin();
+    pthread_mutex_lock(&session->lock);
+    while (session->in_flight >= limit) {
+      pthread_cond_wait(&session->finished, &session->lock);
+    }
+    session->in_flight++;
+    pthread_mutex_unlock(&session->lock);
+    profile_end(PHASE_WAIT, start);
+
+    long batches = (job->result->windows + session->batch - 1) / session->batch;
+    submit_job(job, (int)MIN(threads, (batches + BATCHES_PER_TASK - 1) / BATCHES_PER_TASK));
+  }
+  long long start = profile_begin();
+  thread_pool_wait(session->pool);
+  profile_end(PHASE_WAIT, start);
+  return failed;
+}
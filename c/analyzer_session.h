@@ -0,0 +1,100 @@
+#ifndef ANALYZER_SESSION_H
+#define ANALYZER_SESSION_H
+
+#include "thread_pool.h"
+#include "batch_scheduler.h"
+#include "fftw_batch.h"
+#include "kiss_plan.h"
+#include "cl_pipeline.h"
+#include "precision.h"
+#include "window_function.h"
+
+// Long-lived analysis state for running the same FFT_Analyzer parameters over
+// many files in one process. Everything the single-file programs set up
+// inside get_amplitude_mean is made once per session instead:
+// - the worker threads (a Thread_Pool),
+// - the FFT plans and per-worker engines/buffers (FFTW wisdom is imported
+//   once and exported at the end),
+// - for OpenCL the context, program build, queue and device buffers.
+// Each file then only costs opening the mapping and the transforms.
+//
+// analyzer_session_run keeps several files in flight on the CPU backends: a
+// short file is one task on one worker, so many of them run side by side,
+// while a long file is split into window batches over several workers. The
+// files after the ones being analyzed are opened and prefetched ahead.
+
+typedef enum {
+  SESSION_FFTW,
+  SESSION_KISS,
+  SESSION_OPENCL
+} Session_Backend;
+
+// The FFT_Analyzer parameters shared by all files of a session.
+typedef struct {
+  Session_Backend backend;
+  int blocksize;
+  int shift;
+  int channel;               // channel index, or WAV_DOWNMIX
+  Precision precision;       // FFTW and OpenCL; KISS is always single
+  Window_Spec window;        // zero-initialised: rectangular
+  int threads;               // CPU backends; <= 0 for one per core
+  const char* wisdom_dir;    // FFTW only, NULL to plan from scratch
+  const char* kernel_path;   // OpenCL only
+  cl_device_type device_type; // OpenCL only: preferred device
+} Session_Config;
+
+// Per-worker state of the CPU backends, reused for every file.
+typedef struct {
+  FFTW_Batch* engine;        // SESSION_FFTW
+  double* block;             // SESSION_KISS
+  kiss_fft_cpx* fft_in;
+  kiss_fft_cpx* fft_out;
+  kiss_fft_cpx* scratch;
+} Session_Worker;
+
+typedef struct {
+  Session_Config config;
+  int bins_size;
+  int batch;                 // windows per scheduled batch (CPU backends)
+  Thread_Pool* pool;
+  Session_Worker* workers;   // one per pool thread
+  const Kiss_Plan* kiss_plan;
+  double* window;            // from config.window, NULL for rectangular
+  CL_Pipeline* pipeline;     // SESSION_OPENCL
+
+  pthread_mutex_t lock;
+  pthread_cond_t finished;   // a file of analyzer_session_run completed
+  int in_flight;             // files opened and not completed yet
+  pthread_mutex_t output;    // serialises the result callback
+} Analyzer_Session;
+
+typedef struct {
+  char* filename;
+  int sample_rate;
+  long windows;
+  int bins_size;
+  double* bins;              // 20*log10 of the mean |X| per bin
+  long bytes;                // size of the sample data
+} Session_Result;
+
+// Returns NULL if the backend cannot be set up (e.g. no OpenCL device).
+Analyzer_Session* create_analyzer_session(const Session_Config* config);
+
+// Also frees the process-wide plan cache of the backend (fftw_batch_cleanup,
+// kiss_plan_cleanup), so sessions of the same CPU backend must not overlap.
+void destroy_analyzer_session(Analyzer_Session* session);
+
+// Analyzes one file with all workers. Returns NULL if the file cannot be
+// read.
+Session_Result* analyzer_session_analyze(Analyzer_Session* session, const char* filename);
+void destroy_session_result(Session_Result* result);
+
+// Analyzes `count` files and passes each result to `done` as soon as its
+// file is complete, so the order may differ from `filenames`. `done` runs on
+// a worker thread, but never concurrently with itself, and must not keep the
+// result. Returns the number of files that failed.
+typedef void (*Session_Callback)(const Session_Result* result, void* user);
+int analyzer_session_run(Analyzer_Session* session, char** filenames, int count,
+                         Session_Callback done, void* user);
+
+#endif
@@ -2,111 +2,518 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/time.h>
+#include <getopt.h>
 #include "fftw3.h"
+#include "checkpoint.h"
+#include "fftw_batch.h"
+#include "fftw_wisdom.h"
+#include "precision.h"
+#include "profiler.h"
+#include "window_function.h"
+#include "wav_stream.h"
 
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
+// --stream: about 1M samples per chunk, four chunks in flight.
+#define STREAM_CHUNK_SAMPLES (1L << 20)
+#define STREAM_SLOTS 4
+
+// --spectrogram-format u8 maps this dB range onto 0..255 unless
+// --spectrogram-range says otherwise.
+#define DEFAULT_DB_MIN -20.0
+#define DEFAULT_DB_MAX 100.0
+
+// --checkpoint: seconds between two snapshots unless --checkpoint-interval
+// says otherwise.
+#define DEFAULT_CHECKPOINT_INTERVAL 30.0
+
 typedef struct {
   char* filename;
   int blocksize;
   int shift;
   int threshold;
+  int sample_rate; // taken from the WAV header by get_amplitude_mean
+  int stream;
+  int channel;     // channel index, or WAV_DOWNMIX
+  int power;       // average |X|^2 instead of |X|
+  const char* wisdom_dir; // FFTW wisdom cache, NULL to plan from scratch
+  Precision precision;
+  Window_Spec window;
+  const char* spectrogram; // also write every frame's magnitudes here, NULL for none
+  Spectrogram_Format spectrogram_format;
+  double spectrogram_db_min; // range of the uint8 dB format
+  double spectrogram_db_max;
+  Stats_Request stats;     // extra per-bin statistics, none if stats.stats is 0
+  Spectrum_Stats* result_stats; // filled in by get_amplitude_mean
+  const char* checkpoint;  // snapshot file for --resume, NULL for none
+  double checkpoint_interval; // seconds
+  int resume;              // continue from the checkpoint if there is one
 } FFT_Analyzer;
 
+// Set by SIGINT/SIGTERM while checkpointing: the analysis stops after the
+// current chunk and saves its progress.
+static volatile sig_atomic_t interrupted = 0;
+
+static void request_stop(int signal) {
+  (void)signal;
+  interrupted = 1;
+}
+
+static double seconds_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Progress of a checkpointed run. The bins are only snapshotted between two
+// chunks of about STREAM_CHUNK_SAMPLES samples and at most every
+// checkpoint_interval seconds, so the cost is one small write and fsync per
+// interval whatever the shift.
+typedef struct {
+  const char* path;
+  double interval;
+  double last;            // time of the last snapshot
+  long data_offset;       // of the reader, for the byte offset
+  long window_bytes;      // shift * block_align
+  Checkpoint snapshot;    // bins point to the accumulating bins
+} Checkpointer;
+
+static void save_progress(Checkpointer* checkpointer, long windows, int force) {
+  if (!checkpointer) {
+    return;
+  }
+  double now = seconds_now();
+  if (!force && now - checkpointer->last < checkpointer->interval) {
+    return;
+  }
+  checkpointer->snapshot.windows = windows;
+  checkpointer->snapshot.byte_offset = checkpointer->data_offset + (long long)windows * checkpointer->window_bytes;
+  // A failed snapshot leaves the previous one; the analysis itself goes on.
+  write_checkpoint(checkpointer->path, &checkpointer->snapshot);
+  checkpointer->last = now;
+}
+
 FFT_Analyzer* create_fft_analyzer(const char* filename, int blocksize, int shift, int threshold) {
   FFT_Analyzer* analyzer = malloc(sizeof(FFT_Analyzer));
   analyzer->filename = strdup(filename);
-  analyzer->blocksize = MAX(MIN(512, blocksize), 64);
+  analyzer->blocksize = MAX(blocksize, 2);
   analyzer->shift = MAX(MIN(analyzer->blocksize, shift), 1);
   analyzer->threshold = threshold;
+  analyzer->stream = 0;
+  analyzer->channel = 0;
+  analyzer->power = 0;
+  analyzer->wisdom_dir = fftw_wisdom_default_dir();
+  analyzer->precision = PRECISION_DOUBLE;
+  analyzer->window.type = WINDOW_RECTANGULAR;
+  analyzer->spectrogram = NULL;
+  analyzer->spectrogram_format = SPECTROGRAM_F32;
+  analyzer->spectrogram_db_min = DEFAULT_DB_MIN;
+  analyzer->spectrogram_db_max = DEFAULT_DB_MAX;
+  memset(&analyzer->stats, 0, sizeof(Stats_Request));
+  analyzer->result_stats = NULL;
+  analyzer->checkpoint = NULL;
+  analyzer->checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+  analyzer->resume = 0;
   return analyzer;
 }
 
 void destroy_fft_analyzer(FFT_Analyzer* analyzer) {
+  if (analyzer->result_stats) {
+    destroy_spectrum_stats(analyzer->result_stats);
+  }
   free(analyzer->filename);
   free(analyzer);
 }
 
-double* get_amplitude_mean(FFT_Analyzer* analyzer) {
-  FILE* file = fopen(analyzer->filename, "rb");
-  if (!file) {
-    perror("Error opening file");
-    return NULL;
+// Windows per chunk: about STREAM_CHUNK_SAMPLES samples, a multiple of the
+// engine's batch so that chunking does not change the batches.
+static long chunk_windows(const FFT_Analyzer* analyzer, const FFTW_Batch* engine) {
+  return MAX(STREAM_CHUNK_SAMPLES / analyzer->shift / engine->batch, 1) * engine->batch;
+}
+
+// Transforms the windows `first` .. `count` - 1 of the mapped file, in
+// chunks if there are checkpoints to write in between. Returns the number of
+// windows accumulated in total, which is less than `count` if interrupted.
+long accumulate_mapped(FFT_Analyzer* analyzer, FFTW_Batch* engine, const WAV_Reader* reader, long first, long count, double* bins, Checkpointer* checkpointer) {
+  long step = checkpointer ? chunk_windows(analyzer, engine) : MAX(count - first, 1);
+  long done = first;
+  while (done < count && !interrupted) {
+    long windows = MIN(step, count - done);
+    fftw_batch_accumulate(engine, reader, done, windows, bins);
+    done += windows;
+    save_progress(checkpointer, done, 0);
   }
+  return done;
+}
 
-  fseek(file, 0, SEEK_END);
-  long file_size = ftell(file);
-  fseek(file, 0, SEEK_SET);
+// Streams the file through a ring of chunks: a reader thread preads the next
+// chunks while this thread transforms the current one, so memory stays at
+// STREAM_SLOTS chunks however long the input is. Starts with window `first`.
+// Returns the number of windows accumulated in total, or -1 on a read error.
+long accumulate_stream(FFT_Analyzer* analyzer, FFTW_Batch* engine, const WAV_Reader* reader, long first, double* bins, Checkpointer* checkpointer) {
+  WAV_Stream* stream = open_wav_stream(reader, analyzer->blocksize, analyzer->shift, first, chunk_windows(analyzer, engine), STREAM_SLOTS);
 
-  int samples = file_size / 4;
-  short* data = malloc(file_size);
-  fread(data, 2, samples * 2, file);
-  fclose(file);
+  long count = first;
+  WAV_Chunk* chunk;
+  while (!interrupted && (chunk = wav_stream_next(stream))) {
+    fftw_batch_accumulate_samples(engine, chunk->data, chunk->windows, bins);
+    count += chunk->windows;
+    wav_stream_release(stream, chunk);
+    save_progress(checkpointer, count, 0);
+  }
+
+  if (stream->failed) {
+    count = -1;
+  }
+  close_wav_stream(stream);
+  return count;
+}
 
-  double* normalized_data_left = malloc(samples * sizeof(double));
-  for (int i = 0; i < samples; i++) {
-    normalized_data_left[i] = data[i*2] / 32768.0;
+double* get_amplitude_mean(FFT_Analyzer* analyzer) {
+  WAV_Reader* reader = open_wav_reader(analyzer->filename, analyzer->channel);
+  if (!reader) {
+    return NULL;
   }
-  free(data);
+  analyzer->sample_rate = reader->sample_rate;
+  long samples = reader->samples;
 
   int bins_size = analyzer->blocksize / 2;
   double* bins = calloc(bins_size, sizeof(double));
 
-  fftw_complex* fft_out = fftw_malloc(sizeof(fftw_complex) * (analyzer->blocksize/2 + 1));
-  double* fft_in = fftw_malloc(sizeof(double) * analyzer->blocksize);
-  fftw_plan plan = fftw_plan_dft_r2c_1d(analyzer->blocksize, fft_in, fft_out, FFTW_PATIENT);
+  Checkpointer progress;
+  Checkpointer* checkpointer = NULL;
+  long first = 0;
+  if (analyzer->checkpoint) {
+    checkpointer = &progress;
+    progress.path = analyzer->checkpoint;
+    progress.interval = analyzer->checkpoint_interval;
+    progress.last = seconds_now();
+    progress.data_offset = reader->data_offset;
+    progress.window_bytes = (long)analyzer->shift * reader->block_align;
+    Checkpoint_Key key = {
+      .blocksize = analyzer->blocksize,
+      .shift = analyzer->shift,
+      .channel = analyzer->channel,
+      .precision = analyzer->precision,
+      .window = analyzer->window.type,
+      .kaiser_beta = analyzer->window.type == WINDOW_KAISER ? analyzer->window.kaiser_beta : 0,
+      .power = analyzer->power,
+      .bins_size = bins_size
+    };
+    progress.snapshot.key = key;
+    progress.snapshot.bins = bins;
+    int found = 0;
+    if (checkpoint_key_for_file(analyzer->filename, &progress.snapshot.key) == 0) {
+      found = analyzer->resume ? read_checkpoint(analyzer->checkpoint, &progress.snapshot) : 0;
+    } else {
+      found = -1;
+    }
+    if (found > 0 && progress.snapshot.byte_offset != progress.data_offset + (long long)progress.snapshot.windows * progress.window_bytes) {
+      fprintf(stderr, "Checkpoint %s does not match the layout of %s\n", analyzer->checkpoint, analyzer->filename);
+      found = -1;
+    }
+    if (found < 0) {
+      close_wav_reader(reader);
+      free(bins);
+      return NULL;
+    }
+    if (found) {
+      first = progress.snapshot.windows;
+      fprintf(stderr, "Resuming at window %ld (byte %lld)\n", first, progress.snapshot.byte_offset);
+    } else if (analyzer->resume) {
+      fprintf(stderr, "No checkpoint in %s, starting from the beginning\n", analyzer->checkpoint);
+    }
+  }
 
-  int offset = 0;
-  int count = 0;
-  while (offset + analyzer->blocksize <= samples) {
-    memcpy(fft_in, normalized_data_left + offset, analyzer->blocksize * sizeof(double));
-    fftw_execute(plan);
+  // FFTW_PATIENT planning takes longer than analysing a short file; reuse
+  // the plans found by earlier runs (or fftw_warmup) and save new ones.
+  fftw_wisdom_import(analyzer->wisdom_dir, analyzer->blocksize);
+  double* window = create_window(&analyzer->window, analyzer->blocksize);
+  FFTW_Batch* engine = create_fftw_batch(analyzer->blocksize, analyzer->shift, FFTW_WISDOM_FLAGS, analyzer->precision, window);
+  Spectrum_Stats* stats = NULL;
+  if (analyzer->stats.stats) {
+    stats = create_spectrum_stats(&analyzer->stats, analyzer->blocksize, window);
+    engine->stats = stats;
+  }
+  free(window);
+  fftw_wisdom_export(analyzer->wisdom_dir, analyzer->blocksize);
+  engine->mode = analyzer->power ? ACCUMULATE_POWER : ACCUMULATE_MAGNITUDE;
 
-    for (int i = 0; i < bins_size; i++) {
-      double real = fft_out[i][0];
-      double imag = fft_out[i][1];
-      bins[i] += sqrt(real*real + imag*imag);
+  Spectrogram_Writer* spectrogram = NULL;
+  if (analyzer->spectrogram) {
+    Spectrogram_Header header = {
+      .format = analyzer->spectrogram_format,
+      .blocksize = analyzer->blocksize,
+      .shift = analyzer->shift,
+      .sample_rate = reader->sample_rate,
+      .window = analyzer->window.type,
+      .kaiser_beta = analyzer->window.kaiser_beta,
+      .db_min = analyzer->spectrogram_db_min,
+      .db_max = analyzer->spectrogram_db_max
+    };
+    spectrogram = create_spectrogram_writer(analyzer->spectrogram, &header);
+    if (!spectrogram) {
+      destroy_fftw_batch(engine);
+      fftw_batch_cleanup();
+      close_wav_reader(reader);
+      if (stats) {
+        destroy_spectrum_stats(stats);
+      }
+      free(bins);
+      return NULL;
     }
+    engine->spectrogram = spectrogram;
+  }
 
-    offset += analyzer->shift;
-    count++;
+  long total = fftw_batch_window_count(engine, samples);
+  long count;
+  if (analyzer->stream) {
+    count = accumulate_stream(analyzer, engine, reader, first, bins, checkpointer);
+  } else {
+    count = accumulate_mapped(analyzer, engine, reader, first, total, bins, checkpointer);
+  }
+  if (count >= 0) {
+    // The last snapshot covers the whole file (or all windows before an
+    // interruption), so --resume after the end only prints the result.
+    save_progress(checkpointer, count, 1);
+  }
+  if (interrupted && count >= 0 && count < total) {
+    fprintf(stderr, "Interrupted after %ld of %ld windows, progress saved to %s\n", count, total, analyzer->checkpoint);
+    count = -1;
+  } else if (count == total) {
+    // A signal after the last chunk changes nothing: the result is complete
+    // and so is the snapshot.
+    interrupted = 0;
   }
+  if (spectrogram && close_spectrogram_writer(spectrogram) != 0) {
+    count = -1;
+  }
+
+  destroy_fftw_batch(engine);
+  fftw_batch_cleanup();
+  close_wav_reader(reader);
 
-  fftw_destroy_plan(plan);
-  fftw_free(fft_in);
-  fftw_free(fft_out);
-  free(normalized_data_left);
+  if (count < 0) {
+    if (stats) {
+      destroy_spectrum_stats(stats);
+    }
+    free(bins);
+    return NULL;
+  }
+  analyzer->result_stats = stats;
 
   for (int i = 0; i < bins_size; i++) {
     bins[i] /= count;
-    bins[i] = 20 * log10(bins[i]);
+    bins[i] = (analyzer->power ? 10 : 20) * log10(bins[i]);
   }
 
   return bins;
 }
 
 int main(int argc, char* argv[]) {
-  if (argc != 5) {
-    fprintf(stderr, "Usage: %s <filename> <blocksize> <shift> <threshold>\n", argv[0]);
+  static struct option options[] = {
+    {"stream", no_argument, NULL, 's'},
+    {"channel", required_argument, NULL, 'c'},
+    {"power", no_argument, NULL, 'p'},
+    {"wisdom-dir", required_argument, NULL, 'w'},
+    {"no-wisdom", no_argument, NULL, 'n'},
+    {"precision", required_argument, NULL, 'P'},
+    {"check-precision", no_argument, NULL, 'C'},
+    {"window", required_argument, NULL, 'W'},
+    {"spectrogram", required_argument, NULL, 'S'},
+    {"spectrogram-format", required_argument, NULL, 'F'},
+    {"spectrogram-range", required_argument, NULL, 'R'},
+    {"stats", required_argument, NULL, 'T'},
+    {"profile", no_argument, NULL, 'o'},
+    {"trace", required_argument, NULL, 't'},
+    {"checkpoint", required_argument, NULL, 'k'},
+    {"checkpoint-interval", required_argument, NULL, 'i'},
+    {"resume", no_argument, NULL, 'r'},
+    {NULL, 0, NULL, 0}
+  };
+
+  int stream = 0;
+  int channel = 0;
+  int power = 0;
+  const char* wisdom_dir = fftw_wisdom_default_dir();
+  Precision precision = PRECISION_DOUBLE;
+  int check_precision = 0;
+  Window_Spec window = {WINDOW_RECTANGULAR, DEFAULT_KAISER_BETA};
+  const char* spectrogram = NULL;
+  Spectrogram_Format spectrogram_format = SPECTROGRAM_F32;
+  double db_min = DEFAULT_DB_MIN;
+  double db_max = DEFAULT_DB_MAX;
+  Stats_Request stats = {0};
+  int profile = 0;
+  const char* trace = NULL;
+  const char* checkpoint = NULL;
+  double checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+  int resume = 0;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+    switch (opt) {
+    case 's':
+      stream = 1;
+      break;
+    case 'c':
+      channel = strcmp(optarg, "mix") == 0 ? WAV_DOWNMIX : atoi(optarg);
+      break;
+    case 'p':
+      power = 1;
+      break;
+    case 'w':
+      wisdom_dir = optarg;
+      break;
+    case 'n':
+      wisdom_dir = NULL;
+      break;
+    case 'P':
+      if (!parse_precision(optarg, &precision)) {
+        fprintf(stderr, "Unknown precision: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'C':
+      check_precision = 1;
+      break;
+    case 'W':
+      if (!parse_window(optarg, &window)) {
+        fprintf(stderr, "Unknown window: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'S':
+      spectrogram = optarg;
+      break;
+    case 'F':
+      if (!parse_spectrogram_format(optarg, &spectrogram_format)) {
+        fprintf(stderr, "Unknown spectrogram format: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'R':
+      if (sscanf(optarg, "%lf:%lf", &db_min, &db_max) != 2 || !(db_max > db_min)) {
+        fprintf(stderr, "Invalid dB range: %s (expected <min>:<max>)\n", optarg);
+        return 1;
+      }
+      break;
+    case 'T':
+      if (!parse_stats_request(optarg, &stats)) {
+        fprintf(stderr, "Invalid statistics: %s (expected e.g. max,min,var,median,p90,psd)\n", optarg);
+        return 1;
+      }
+      break;
+    case 'o':
+      profile = 1;
+      break;
+    case 't':
+      profile = 1;
+      trace = optarg;
+      break;
+    case 'k':
+      checkpoint = optarg;
+      break;
+    case 'i':
+      checkpoint_interval = atof(optarg);
+      if (!(checkpoint_interval >= 0)) {
+        fprintf(stderr, "Invalid checkpoint interval: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'r':
+      resume = 1;
+      break;
+    default:
+      return 1;
+    }
+  }
+
+  if (argc - optind != 4) {
+    fprintf(stderr, "Usage: %s [--stream] [--channel <n|mix>] [--power] [--wisdom-dir <dir> | --no-wisdom] [--precision <double|single>] [--check-precision] [--window <name>] [--spectrogram <file> [--spectrogram-format f32|f16|u8] [--spectrogram-range <min>:<max>]] [--stats <list>] [--profile] [--trace <file>] [--checkpoint <file> [--checkpoint-interval <s>] [--resume]] <filename> <blocksize> <shift> <threshold>\n", argv[0]);
+    return 1;
+  }
+  if (resume && !checkpoint) {
+    fprintf(stderr, "--resume needs --checkpoint <file>\n");
+    return 1;
+  }
+  // Only the bins are checkpointed, not the spectrogram written so far or
+  // the state of the statistics.
+  if (resume && (spectrogram || stats.stats)) {
+    fprintf(stderr, "--resume cannot be combined with --spectrogram or --stats\n");
     return 1;
   }
 
-  FFT_Analyzer* analyzer = create_fft_analyzer(argv[1], atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+  char** args = argv + optind;
+  FFT_Analyzer* analyzer = create_fft_analyzer(args[0], atoi(args[1]), atoi(args[2]), atoi(args[3]));
+  analyzer->stream = stream;
+  analyzer->channel = channel;
+  analyzer->power = power;
+  analyzer->wisdom_dir = wisdom_dir;
+  analyzer->precision = precision;
+  analyzer->window = window;
+  analyzer->spectrogram = spectrogram;
+  analyzer->spectrogram_format = spectrogram_format;
+  analyzer->spectrogram_db_min = db_min;
+  analyzer->spectrogram_db_max = db_max;
+  analyzer->stats = stats;
+  analyzer->checkpoint = checkpoint;
+  analyzer->checkpoint_interval = checkpoint_interval;
+  analyzer->resume = resume;
 
+  if (checkpoint) {
+    struct sigaction action = {0};
+    action.sa_handler = request_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+  }
+
+  if (profile) {
+    profiler_start(trace != NULL);
+  }
   struct timeval start, end;
   gettimeofday(&start, NULL);
   double* result = get_amplitude_mean(analyzer);
   gettimeofday(&end, NULL);
+  if (profile) {
+    profiler_report(stderr);
+    if (trace) {
+      profiler_write_trace(trace);
+    }
+    profiler_stop();
+  }
+
+  // Untimed second pass in double for the accuracy report.
+  double* reference = NULL;
+  if (check_precision && result && precision != PRECISION_DOUBLE) {
+    analyzer->precision = PRECISION_DOUBLE;
+    analyzer->spectrogram = NULL;
+    analyzer->checkpoint = NULL;
+    Spectrum_Stats* result_stats = analyzer->result_stats;
+    analyzer->stats.stats = 0;
+    reference = get_amplitude_mean(analyzer);
+    analyzer->result_stats = result_stats;
+    analyzer->precision = precision;
+  }
 
   if (result) {
-    for (int i = 0; i < analyzer->blocksize/2; i++) {
-      if(result[i] > analyzer->threshold) {
-	printf("%dHz %f\n", i*(44100/(analyzer->blocksize/2)), result[i]);
+    if (analyzer->result_stats) {
+      print_spectrum_stats(analyzer->result_stats, analyzer->sample_rate, analyzer->threshold);
+    } else {
+      for (int i = 0; i < analyzer->blocksize/2; i++) {
+        if(result[i] > analyzer->threshold) {
+	  printf("%dHz %f\n", (int)((long)i * analyzer->sample_rate / analyzer->blocksize), result[i]);
+        }
       }
+      printf("\n");
+    }
+    if (reference) {
+      report_precision_deviation(reference, result, analyzer->blocksize / 2, analyzer->sample_rate, analyzer->blocksize);
+      free(reference);
     }
-    printf("\n");
     free(result);
   }
 
@@ -118,5 +525,5 @@ int main(int argc, char* argv[]) {
   printf("Execution time: %f seconds\n", elapsed_time);
 
   destroy_fft_analyzer(analyzer);
-  return 0;
+  return interrupted ? 1 : 0;
 }
@@ -3,8 +3,13 @@
 #include <string.h>
 #include <math.h>
 #include <sys/time.h>
+#include <getopt.h>
 #include "kissfft/kiss_fft.h"
 #include "kissfft/kiss_fftnd.h"
+#include "kiss_plan.h"
+#include "wav_reader.h"
+#include "bins_accumulate.h"
+#include "window_function.h"
 
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
@@ -14,14 +19,17 @@ typedef struct {
   int blocksize;
   int shift;
   int threshold;
+  int sample_rate; // taken from the WAV header by get_amplitude_mean
+  Window_Spec window;
 } FFT_Analyzer;
 
 FFT_Analyzer* create_fft_analyzer(const char* filename, int blocksize, int shift, int threshold) {
   FFT_Analyzer* analyzer = malloc(sizeof(FFT_Analyzer));
   analyzer->filename = strdup(filename);
-  analyzer->blocksize = MAX(MIN(512, blocksize), 64);
+  analyzer->blocksize = MAX(blocksize, 2);
   analyzer->shift = MAX(MIN(analyzer->blocksize, shift), 1);
   analyzer->threshold = threshold;
+  analyzer->window.type = WINDOW_RECTANGULAR;
   return analyzer;
 }
 
@@ -31,58 +39,54 @@ void destroy_fft_analyzer(FFT_Analyzer* analyzer) {
 }
 
 double* get_amplitude_mean(FFT_Analyzer* analyzer) {
-  FILE* file = fopen(analyzer->filename, "rb");
-  if (!file) {
-    perror("Error opening file");
+  WAV_Reader* reader = open_wav_reader(analyzer->filename, 0);
+  if (!reader) {
     return NULL;
   }
-
-  fseek(file, 0, SEEK_END);
-  long file_size = ftell(file);
-  fseek(file, 0, SEEK_SET);
-
-  int samples = file_size / 4;
-  short* data = malloc(file_size);
-  fread(data, 2, samples * 2, file);
-  fclose(file);
-
-  double* normalized_data_left = malloc(samples * sizeof(double));
-  for (int i = 0; i < samples; i++) {
-    normalized_data_left[i] = data[i*2] / 32768.0;
-  }
-  free(data);
+  analyzer->sample_rate = reader->sample_rate;
+  long samples = reader->samples;
 
   int bins_size = analyzer->blocksize / 2;
   double* bins = calloc(bins_size, sizeof(double));
 
-  kiss_fft_cfg fft_cfg = kiss_fft_alloc(analyzer->blocksize, 0, NULL, NULL);
+  const Kiss_Plan* plan = get_kiss_plan(analyzer->blocksize);
   kiss_fft_cpx* fft_in = malloc(sizeof(kiss_fft_cpx) * analyzer->blocksize);
+  double* block = malloc(sizeof(double) * analyzer->blocksize);
   kiss_fft_cpx* fft_out = malloc(sizeof(kiss_fft_cpx) * analyzer->blocksize);
+  kiss_fft_cpx* scratch = malloc(sizeof(kiss_fft_cpx) * kiss_plan_scratch_size(plan));
+  double* window = create_window(&analyzer->window, analyzer->blocksize);
 
-  int offset = 0;
-  int count = 0;
+  long offset = 0;
+  long count = 0;
   while (offset + analyzer->blocksize <= samples) {
-    for (int i = 0; i < analyzer->blocksize; i++) {
-      fft_in[i].r = normalized_data_left[offset + i];
-      fft_in[i].i = 0;
+    wav_reader_read(reader, offset, analyzer->blocksize, block);
+    // Window (if any) and conversion to kiss_fft_scalar in one pass.
+    if (window) {
+      for (int i = 0; i < analyzer->blocksize; i++) {
+        fft_in[i].r = block[i] * window[i];
+        fft_in[i].i = 0;
+      }
+    } else {
+      for (int i = 0; i < analyzer->blocksize; i++) {
+        fft_in[i].r = block[i];
+        fft_in[i].i = 0;
+      }
     }
 
-    kiss_fft(fft_cfg, fft_in, fft_out);
+    kiss_plan_execute(plan, fft_in, fft_out, scratch);
 
-    for (int i = 0; i < bins_size; i++) {
-      double real = fft_out[i].r;
-      double imag = fft_out[i].i;
-      bins[i] += sqrt(real*real + imag*imag);
-    }
+    accumulate_bins_float((const float*)fft_out, 1, analyzer->blocksize, bins_size, ACCUMULATE_MAGNITUDE, bins);
 
     offset += analyzer->shift;
     count++;
   }
 
   free(fft_in);
+  free(block);
   free(fft_out);
-  free(fft_cfg);
-  free(normalized_data_left);
+  free(scratch);
+  free(window);
+  close_wav_reader(reader);
 
   for (int i = 0; i < bins_size; i++) {
     bins[i] /= count;
@@ -93,12 +97,34 @@ double* get_amplitude_mean(FFT_Analyzer* analyzer) {
 }
 
 int main(int argc, char* argv[]) {
-  if (argc != 5) {
-    fprintf(stderr, "Usage: %s <filename> <blocksize> <shift> <threshold>\n", argv[0]);
+  static struct option options[] = {
+    {"window", required_argument, NULL, 'W'},
+    {NULL, 0, NULL, 0}
+  };
+
+  Window_Spec window = {WINDOW_RECTANGULAR, DEFAULT_KAISER_BETA};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+    switch (opt) {
+    case 'W':
+      if (!parse_window(optarg, &window)) {
+        fprintf(stderr, "Unknown window: %s\n", optarg);
+        return 1;
+      }
+      break;
+    default:
+      return 1;
+    }
+  }
+
+  if (argc - optind != 4) {
+    fprintf(stderr, "Usage: %s [--window <name>] <filename> <blocksize> <shift> <threshold>\n", argv[0]);
     return 1;
   }
 
-  FFT_Analyzer* analyzer = create_fft_analyzer(argv[1], atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+  char** args = argv + optind;
+  FFT_Analyzer* analyzer = create_fft_analyzer(args[0], atoi(args[1]), atoi(args[2]), atoi(args[3]));
+  analyzer->window = window;
 
   struct timeval start, end;
   gettimeofday(&start, NULL);
@@ -108,7 +134,7 @@ int main(int argc, char* argv[]) {
   if (result) {
     for (int i = 0; i < analyzer->blocksize/2; i++) {
       if(result[i] > analyzer->threshold) {
-	printf("%dHz %f\n", i*(44100/(analyzer->blocksize/2)), result[i]);
+	printf("%dHz %f\n", (int)((long)i * analyzer->sample_rate / analyzer->blocksize), result[i]);
       }
     }
     printf("\n");
@@ -4,7 +4,12 @@
 #include <math.h>
 #include <sys/time.h>
 #include <pthread.h>
+#include <getopt.h>
 #include "fftw3.h"
+#include "wav_reader.h"
+#include "bins_accumulate.h"
+#include "bins_reduce.h"
+#include "window_function.h"
 #include <unistd.h>
 
 
@@ -12,6 +17,10 @@
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
+// Windows per reduction leaf (see bins_reduce.h). Fixed, so the sum does not
+// depend on the number of cores.
+#define LEAF_WINDOWS 64
+
 int get_num_cores() {
   return sysconf(_SC_NPROCESSORS_ONLN);
 }
@@ -21,18 +30,24 @@ typedef struct {
   int blocksize;
   int shift;
   int threshold;
-  int start_index;
-  int end_index;
-  double* bins;
-  int num_bins;
+  int sample_rate; // taken from the WAV header by get_amplitude_mean
+  long windows;
+  long first_leaf;
+  long last_leaf;
+  Bins_Reducer* reducer;              // per thread
+  const WAV_Reader* reader;           // mapped once, shared read-only by all threads
+  fftw_plan plan;                     // shared, only used through fftw_execute_dft_r2c
+  Window_Spec window_spec;
+  const double* window;               // shared coefficients, NULL for rectangular
 } FFT_Analyzer;
 
 FFT_Analyzer* create_fft_analyzer(const char* filename, int blocksize, int shift, int threshold) {
   FFT_Analyzer* analyzer = malloc(sizeof(FFT_Analyzer));
   analyzer->filename = strdup(filename);
-  analyzer->blocksize = MAX(MIN(512, blocksize), 64);
+  analyzer->blocksize = MAX(blocksize, 2);
   analyzer->shift = MAX(MIN(analyzer->blocksize, shift), 1);
   analyzer->threshold = threshold;
+  analyzer->window_spec.type = WINDOW_RECTANGULAR;
   return analyzer;
 }
 
@@ -41,119 +56,132 @@ void destroy_fft_analyzer(FFT_Analyzer* analyzer) {
   free(analyzer);
 }
 
+// Handles the leaves [first_leaf, last_leaf), each summed into its own
+// vector. The last window of a leaf reads up to blocksize - 1 samples into
+// the next one, so no window is lost at a leaf boundary.
 void* process_chunk(void* arg) {
   FFT_Analyzer* analyzer = (FFT_Analyzer*) arg;
-  FILE* file = fopen(analyzer->filename, "rb");
-  if (!file) {
-    perror("Error opening file");
-    pthread_exit(NULL);
-  }
-
-  fseek(file, 0, SEEK_END);
-  long file_size = ftell(file);
-  fseek(file, 0, SEEK_SET);
-
-  int samples = file_size / 4;
-  short* data = malloc(file_size);
-  fread(data, 2, samples * 2, file);
-  fclose(file);
-
-  double* normalized_data_left = malloc(samples * sizeof(double));
-  for (int i = 0; i < samples; i++) {
-    normalized_data_left[i] = data[i * 2] / 32768.0;
-  }
-  free(data);
-
   int bins_size = analyzer->blocksize / 2;
-  double* bins = calloc(bins_size, sizeof(double));
 
   fftw_complex* fft_out = fftw_malloc(sizeof(fftw_complex) * (analyzer->blocksize / 2 + 1));
   double* fft_in = fftw_malloc(sizeof(double) * analyzer->blocksize);
-  fftw_plan plan = fftw_plan_dft_r2c_1d(analyzer->blocksize, fft_in, fft_out, FFTW_ESTIMATE);
 
-  for (int offset = analyzer->start_index; offset < analyzer->end_index - analyzer->blocksize + 1; offset += analyzer->shift) {
-    memcpy(fft_in, normalized_data_left + offset, analyzer->blocksize * sizeof(double));
-    fftw_execute(plan);
+  for (long leaf = analyzer->first_leaf; leaf < analyzer->last_leaf; leaf++) {
+    double* sums = bins_reducer_leaf(analyzer->reducer);
+    long last = MIN((leaf + 1) * LEAF_WINDOWS, analyzer->windows);
+    for (long index = leaf * LEAF_WINDOWS; index < last; index++) {
+      wav_reader_read(analyzer->reader, index * analyzer->shift, analyzer->blocksize, fft_in);
+      if (analyzer->window) {
+        // The block is still in L1 right after the conversion.
+        for (int i = 0; i < analyzer->blocksize; i++) {
+          fft_in[i] *= analyzer->window[i];
+        }
+      }
+      fftw_execute_dft_r2c(analyzer->plan, fft_in, fft_out);
 
-    for (int i = 0; i < bins_size; i++) {
-      double real = fft_out[i][0];
-      double imag = fft_out[i][1];
-      bins[i] += sqrt(real * real + imag * imag);
+      accumulate_bins((const double*)fft_out, 1, bins_size + 1, bins_size, ACCUMULATE_MAGNITUDE, sums);
     }
+    bins_reducer_add(analyzer->reducer, leaf, sums);
   }
 
-  fftw_destroy_plan(plan);
   fftw_free(fft_in);
   fftw_free(fft_out);
-  free(normalized_data_left);
-
-  for (int i = 0; i < bins_size; i++) {
-    analyzer->bins[i] += bins[i];
-  }
-  free(bins);
 
   pthread_exit(NULL);
 }
 
 double* get_amplitude_mean(FFT_Analyzer* analyzer) {
   int num_cores = get_num_cores();
-  fftw_init_threads();
-  fftw_plan_with_nthreads(num_cores); // Set the number of threads you want to use
   printf("Using %d cores\n", num_cores);
-  int samples;
-  FILE* file = fopen(analyzer->filename, "rb");
-  if (!file) {
-    perror("Error opening file");
+
+  WAV_Reader* reader = open_wav_reader(analyzer->filename, 0);
+  if (!reader) {
     return NULL;
   }
+  analyzer->sample_rate = reader->sample_rate;
+  long samples = reader->samples;
 
-  fseek(file, 0, SEEK_END);
-  long file_size = ftell(file);
-  fseek(file, 0, SEEK_SET);
-
-  samples = file_size / 4;
-  fclose(file);
+  // The planner is not thread safe, so plan once here. Every thread brings
+  // its own fftw_malloc'ed (equally aligned) buffers to fftw_execute_dft_r2c.
+  fftw_complex* plan_out = fftw_malloc(sizeof(fftw_complex) * (analyzer->blocksize / 2 + 1));
+  double* plan_in = fftw_malloc(sizeof(double) * analyzer->blocksize);
+  fftw_plan plan = fftw_plan_dft_r2c_1d(analyzer->blocksize, plan_in, plan_out, FFTW_ESTIMATE);
 
   double* bins = calloc(analyzer->blocksize / 2, sizeof(double));
+  double* window = create_window(&analyzer->window_spec, analyzer->blocksize);
+
+  long count = samples >= analyzer->blocksize ? (samples - analyzer->blocksize) / analyzer->shift + 1 : 0;
+  long leaves = (count + LEAF_WINDOWS - 1) / LEAF_WINDOWS;
 
   pthread_t threads[num_cores];
   FFT_Analyzer thread_analyzers[num_cores];
-  int chunk_size = samples / num_cores;
-
   for (int i = 0; i < num_cores; i++) {
     thread_analyzers[i] = *analyzer;
-    thread_analyzers[i].start_index = i * chunk_size;
-    thread_analyzers[i].end_index = (i == num_cores - 1) ? samples : (i + 1) * chunk_size;
-    thread_analyzers[i].bins = calloc(analyzer->blocksize / 2, sizeof(double));
-    
+    thread_analyzers[i].windows = count;
+    thread_analyzers[i].first_leaf = leaves * i / num_cores;
+    thread_analyzers[i].last_leaf = leaves * (i + 1) / num_cores;
+    thread_analyzers[i].reducer = create_bins_reducer(analyzer->blocksize / 2);
+    thread_analyzers[i].reader = reader;
+    thread_analyzers[i].plan = plan;
+    thread_analyzers[i].window = window;
+
     pthread_create(&threads[i], NULL, process_chunk, (void*)&thread_analyzers[i]);
   }
 
+  Bins_Reducer* reducer = thread_analyzers[0].reducer;
   for (int i = 0; i < num_cores; i++) {
     pthread_join(threads[i], NULL);
-    for (int j = 0; j < analyzer->blocksize / 2; j++) {
-      bins[j] += thread_analyzers[i].bins[j];
+    if (i > 0) {
+      bins_reducer_merge(reducer, thread_analyzers[i].reducer);
+      destroy_bins_reducer(thread_analyzers[i].reducer);
     }
-    free(thread_analyzers[i].bins);
   }
+  bins_reducer_result(reducer, bins);
+  destroy_bins_reducer(reducer);
+
+  fftw_destroy_plan(plan);
+  free(window);
+  fftw_free(plan_in);
+  fftw_free(plan_out);
+  close_wav_reader(reader);
 
   for (int i = 0; i < analyzer->blocksize / 2; i++) {
-    bins[i] /= (samples / analyzer->shift);
+    bins[i] /= count;
     bins[i] = 20 * log10(bins[i]);
   }
 
-  fftw_cleanup_threads();
-
   return bins;
 }
 
 int main(int argc, char* argv[]) {
-  if (argc != 5) {
-    fprintf(stderr, "Usage: %s <filename> <blocksize> <shift> <threshold>\n", argv[0]);
+  static struct option options[] = {
+    {"window", required_argument, NULL, 'W'},
+    {NULL, 0, NULL, 0}
+  };
+
+  Window_Spec window = {WINDOW_RECTANGULAR, DEFAULT_KAISER_BETA};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+    switch (opt) {
+    case 'W':
+      if (!parse_window(optarg, &window)) {
+        fprintf(stderr, "Unknown window: %s\n", optarg);
+        return 1;
+      }
+      break;
+    default:
+      return 1;
+    }
+  }
+
+  if (argc - optind != 4) {
+    fprintf(stderr, "Usage: %s [--window <name>] <filename> <blocksize> <shift> <threshold>\n", argv[0]);
     return 1;
   }
 
-  FFT_Analyzer* analyzer = create_fft_analyzer(argv[1], atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+  char** args = argv + optind;
+  FFT_Analyzer* analyzer = create_fft_analyzer(args[0], atoi(args[1]), atoi(args[2]), atoi(args[3]));
+  analyzer->window_spec = window;
 
   struct timeval start, end;
   gettimeofday(&start, NULL);
@@ -163,7 +191,7 @@ int main(int argc, char* argv[]) {
   if (result) {
     for (int i = 0; i < analyzer->blocksize/2; i++) {
       if(result[i] > analyzer->threshold) {
-	printf("%dHz %f\n", i*(44100/(analyzer->blocksize/2)), result[i]);
+	printf("%dHz %f\n", (int)((long)i * analyzer->sample_rate / analyzer->blocksize), result[i]);
       }
     }
     printf("\n");
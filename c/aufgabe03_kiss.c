@@ -3,8 +3,15 @@
 #include <string.h>
 #include <math.h>
 #include <sys/time.h>
+#include <getopt.h>
 #include "kissfft/kiss_fft.h"
 #include "kissfft/kiss_fftnd.h"
+#include "kiss_plan.h"
+#include "wav_reader.h"
+#include "bins_accumulate.h"
+#include "bins_reduce.h"
+#include "batch_scheduler.h"
+#include "window_function.h"
 #include <pthread.h>
 #include <unistd.h>
 
@@ -13,6 +20,11 @@
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
+// Windows per scheduled batch: enough to amortise the deque lock, small
+// enough that stealing still evens out a slow core near the end. Every
+// batch is also one reduction leaf (see bins_reduce.h).
+#define WINDOW_BATCH 64
+
 int get_num_cores() {
   return sysconf(_SC_NPROCESSORS_ONLN);
 }
@@ -23,132 +35,160 @@ typedef struct {
   int blocksize;
   int shift;
   int threshold;
-  double* bins; // Shared bins array for threads
-  double* normalized_data_left; // Normalized data
-  int samples; // Total number of samples
+  int sample_rate; // taken from the WAV header by get_amplitude_mean
+  WAV_Reader* reader; // Mapped input, converted per window
+  long windows;
+  double* window;     // coefficients, NULL for rectangular
 } FFT_Analyzer;
 
 typedef struct {
   FFT_Analyzer* analyzer;
-  int start;
-  int end;
-  pthread_mutex_t* lock;
+  Batch_Scheduler* scheduler;
+  int worker;
+  Bins_Reducer* reducer; // the batches this worker transformed
 } ThreadData;
 
-void* process_chunk(void* arg) {
+void* process_batches(void* arg) {
   ThreadData* data = (ThreadData*)arg;
   FFT_Analyzer* analyzer = data->analyzer;
-  int start = data->start;
-  int end = data->end;
   int blocksize = analyzer->blocksize;
   int shift = analyzer->shift;
   int bins_size = blocksize / 2;
-  double* bins = calloc(bins_size, sizeof(double));
-  double* normalized_data_left = analyzer->normalized_data_left;
+  const WAV_Reader* reader = analyzer->reader;
 
-  kiss_fft_cfg fft_cfg = kiss_fft_alloc(blocksize, 0, NULL, NULL);
+  const Kiss_Plan* plan = get_kiss_plan(blocksize);
   kiss_fft_cpx* fft_in = malloc(sizeof(kiss_fft_cpx) * blocksize);
+  double* block = malloc(sizeof(double) * blocksize);
   kiss_fft_cpx* fft_out = malloc(sizeof(kiss_fft_cpx) * blocksize);
+  kiss_fft_cpx* scratch = malloc(sizeof(kiss_fft_cpx) * kiss_plan_scratch_size(plan));
+  const double* window = analyzer->window;
+
+  // Windows are indexed over the whole file, so a batch boundary never
+  // splits or drops a window.
+  long batch;
+  while ((batch = batch_scheduler_next(data->scheduler, data->worker)) >= 0) {
+    long first = batch * WINDOW_BATCH;
+    long last = MIN(first + WINDOW_BATCH, analyzer->windows);
+    double* bins = bins_reducer_leaf(data->reducer);
+    for (long index = first; index < last; index++) {
+      wav_reader_read(reader, index * shift, blocksize, block);
+      // Window (if any) and conversion to kiss_fft_scalar in one pass.
+      if (window) {
+        for (int i = 0; i < blocksize; i++) {
+          fft_in[i].r = block[i] * window[i];
+          fft_in[i].i = 0;
+        }
+      } else {
+        for (int i = 0; i < blocksize; i++) {
+          fft_in[i].r = block[i];
+          fft_in[i].i = 0;
+        }
+      }
 
-  for (int offset = start; offset + blocksize <= end; offset += shift) {
-    for (int i = 0; i < blocksize; i++) {
-      fft_in[i].r = normalized_data_left[offset + i];
-      fft_in[i].i = 0;
-    }
-
-    kiss_fft(fft_cfg, fft_in, fft_out);
+      kiss_plan_execute(plan, fft_in, fft_out, scratch);
 
-    for (int i = 0; i < bins_size; i++) {
-      double real = fft_out[i].r;
-      double imag = fft_out[i].i;
-      bins[i] += sqrt(real*real + imag*imag);
+      accumulate_bins_float((const float*)fft_out, 1, blocksize, bins_size, ACCUMULATE_MAGNITUDE, bins);
     }
+    bins_reducer_add(data->reducer, batch, bins);
   }
 
   free(fft_in);
+  free(block);
   free(fft_out);
-  free(fft_cfg);
-
-  pthread_mutex_lock(data->lock);
-  for (int i = 0; i < bins_size; i++) {
-    analyzer->bins[i] += bins[i];
-  }
-  pthread_mutex_unlock(data->lock);
-
-  free(bins);
+  free(scratch);
   return NULL;
 }
 
 double* get_amplitude_mean(FFT_Analyzer* analyzer) {
-  FILE* file = fopen(analyzer->filename, "rb");
-  if (!file) {
-    perror("Error opening file");
+  analyzer->reader = open_wav_reader(analyzer->filename, 0);
+  if (!analyzer->reader) {
     return NULL;
   }
+  analyzer->sample_rate = analyzer->reader->sample_rate;
+  long samples = analyzer->reader->samples;
 
-  fseek(file, 0, SEEK_END);
-  long file_size = ftell(file);
-  fseek(file, 0, SEEK_SET);
-
-  int samples = file_size / 4;
-  short* data = malloc(file_size);
-  fread(data, 2, samples * 2, file);
-  fclose(file);
-
-  analyzer->samples = samples;
-  analyzer->normalized_data_left = malloc(samples * sizeof(double));
-  for (int i = 0; i < samples; i++) {
-    analyzer->normalized_data_left[i] = data[i * 2] / 32768.0;
+  analyzer->windows = 0;
+  if (samples >= analyzer->blocksize) {
+    analyzer->windows = (samples - analyzer->blocksize) / analyzer->shift + 1;
   }
-  free(data);
+  long batches = (analyzer->windows + WINDOW_BATCH - 1) / WINDOW_BATCH;
 
   int bins_size = analyzer->blocksize / 2;
-  double* bins = calloc(bins_size, sizeof(double));
-  analyzer->bins = bins;
-  
   int num_cores = get_num_cores();
   printf("Using %d cores\n", num_cores);
   pthread_t threads[num_cores];
   ThreadData thread_data[num_cores];
-  pthread_mutex_t lock;
-  pthread_mutex_init(&lock, NULL);
+  Batch_Scheduler* scheduler = create_batch_scheduler(batches, num_cores);
 
-  int chunk_size = (samples + num_cores - 1) / num_cores;
   for (int i = 0; i < num_cores; i++) {
     thread_data[i].analyzer = analyzer;
-    thread_data[i].start = i * chunk_size;
-    thread_data[i].end = MIN((i + 1) * chunk_size, samples);
-    thread_data[i].lock = &lock;
-    pthread_create(&threads[i], NULL, process_chunk, &thread_data[i]);
+    thread_data[i].scheduler = scheduler;
+    thread_data[i].worker = i;
+    thread_data[i].reducer = create_bins_reducer(bins_size);
+  }
+  for (int i = 0; i < num_cores; i++) {
+    pthread_create(&threads[i], NULL, process_batches, &thread_data[i]);
   }
 
   for (int i = 0; i < num_cores; i++) {
     pthread_join(threads[i], NULL);
   }
 
+  // Stolen batches leave gaps in every worker's range; the reducer sorts
+  // that out, so the sum is the same however the batches were spread.
+  Bins_Reducer* reducer = thread_data[0].reducer;
+  for (int i = 1; i < num_cores; i++) {
+    bins_reducer_merge(reducer, thread_data[i].reducer);
+    destroy_bins_reducer(thread_data[i].reducer);
+  }
+  double* bins = malloc(bins_size * sizeof(double));
+  bins_reducer_result(reducer, bins);
+  destroy_bins_reducer(reducer);
   for (int i = 0; i < bins_size; i++) {
-    bins[i] /= (samples / analyzer->shift);
+    bins[i] /= analyzer->windows;
     bins[i] = 20 * log10(bins[i]);
   }
 
-  free(analyzer->normalized_data_left);
-  pthread_mutex_destroy(&lock);
+  close_wav_reader(analyzer->reader);
+  destroy_batch_scheduler(scheduler);
 
   return bins;
 }
 
 int main(int argc, char* argv[]) {
-  if (argc != 5) {
-    fprintf(stderr, "Usage: %s <filename> <blocksize> <shift> <threshold>\n", argv[0]);
+  static struct option options[] = {
+    {"window", required_argument, NULL, 'W'},
+    {NULL, 0, NULL, 0}
+  };
+
+  Window_Spec window = {WINDOW_RECTANGULAR, DEFAULT_KAISER_BETA};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+    switch (opt) {
+    case 'W':
+      if (!parse_window(optarg, &window)) {
+        fprintf(stderr, "Unknown window: %s\n", optarg);
+        return 1;
+      }
+      break;
+    default:
+      return 1;
+    }
+  }
+
+  if (argc - optind != 4) {
+    fprintf(stderr, "Usage: %s [--window <name>] <filename> <blocksize> <shift> <threshold>\n", argv[0]);
     return 1;
   }
 
+  char** args = argv + optind;
   FFT_Analyzer analyzer = {
-    .filename = strdup(argv[1]),
-    .blocksize = MAX(MIN(512, atoi(argv[2])), 64),
-    .shift = MAX(MIN(atoi(argv[2]), atoi(argv[3])), 1),
-    .threshold = atoi(argv[4])
+    .filename = strdup(args[0]),
+    .blocksize = MAX(atoi(args[1]), 2),
+    .shift = MAX(MIN(atoi(args[1]), atoi(args[2])), 1),
+    .threshold = atoi(args[3])
   };
+  analyzer.window = create_window(&window, analyzer.blocksize);
 
   struct timeval start, end;
   gettimeofday(&start, NULL);
@@ -158,7 +198,7 @@ int main(int argc, char* argv[]) {
   if (result) {
     for (int i = 0; i < analyzer.blocksize/2; i++) {
       if(result[i] > analyzer.threshold) {
-	printf("%dHz %f\n", i*(44100/(analyzer.blocksize/2)), result[i]);
+	printf("%dHz %f\n", (int)((long)i * analyzer.sample_rate / analyzer.blocksize), result[i]);
       }
     }
     printf("\n");
@@ -172,5 +212,6 @@ int main(int argc, char* argv[]) {
   printf("Execution time: %f seconds\n", elapsed_time);
 
   free(analyzer.filename);
+  free(analyzer.window);
   return 0;
 }
@@ -3,17 +3,27 @@
 #include <string.h>
 #include <math.h>
 #include <sys/time.h>
+#include <getopt.h>
 #include "fftw3.h"
-#include <unistd.h>
+#include "fftw_batch.h"
+#include "bins_reduce.h"
+#include "window_function.h"
+#include <omp.h>
 
 
+// FFTW's own threading (fftw_plan_with_nthreads) only splits a single
+// transform, which does not pay off for typical window sizes:
 // https://www.fftw.org/fftw3_doc/How-Many-Threads-to-Use_003f.html
+// Instead the window sequence is split across OpenMP threads, each running
+// its own batched engine on the shared cached plan. The threads take whole
+// reduction leaves of one engine batch each (see bins_reduce.h), so the
+// result is the same for any OMP_NUM_THREADS.
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
 
 int get_num_cores() {
-  return sysconf(_SC_NPROCESSORS_ONLN);
+  return omp_get_max_threads(); // honours OMP_NUM_THREADS
 }
 
 
@@ -23,14 +33,19 @@ typedef struct {
   int blocksize;
   int shift;
   int threshold;
+  int sample_rate; // taken from the WAV header by get_amplitude_mean
+  Precision precision;
+  Window_Spec window;
 } FFT_Analyzer;
 
 FFT_Analyzer* create_fft_analyzer(const char* filename, int blocksize, int shift, int threshold) {
   FFT_Analyzer* analyzer = malloc(sizeof(FFT_Analyzer));
   analyzer->filename = strdup(filename);
-  analyzer->blocksize = MAX(MIN(512, blocksize), 64);
+  analyzer->blocksize = MAX(blocksize, 2);
   analyzer->shift = MAX(MIN(analyzer->blocksize, shift), 1);
   analyzer->threshold = threshold;
+  analyzer->precision = PRECISION_DOUBLE;
+  analyzer->window.type = WINDOW_RECTANGULAR;
   return analyzer;
 }
 
@@ -40,78 +55,105 @@ void destroy_fft_analyzer(FFT_Analyzer* analyzer) {
 }
 
 double* get_amplitude_mean(FFT_Analyzer* analyzer) {
-  // Initialize FFTW threading
   int num_cores = get_num_cores();
-  fftw_init_threads();
-  fftw_plan_with_nthreads(num_cores); // Set the number of threads you want to use
+  printf("Using %d cores\n", num_cores);
 
-  FILE* file = fopen(analyzer->filename, "rb");
-  if (!file) {
-    perror("Error opening file");
+  WAV_Reader* reader = open_wav_reader(analyzer->filename, 0);
+  if (!reader) {
     return NULL;
   }
-
-  fseek(file, 0, SEEK_END);
-  long file_size = ftell(file);
-  fseek(file, 0, SEEK_SET);
-
-  int samples = file_size / 4;
-  short* data = malloc(file_size);
-  fread(data, 2, samples * 2, file);
-  fclose(file);
-
-  double* normalized_data_left = malloc(samples * sizeof(double));
-  for (int i = 0; i < samples; i++) {
-    normalized_data_left[i] = data[i*2] / 32768.0;
-  }
-  free(data);
+  analyzer->sample_rate = reader->sample_rate;
+  long samples = reader->samples;
 
   int bins_size = analyzer->blocksize / 2;
   double* bins = calloc(bins_size, sizeof(double));
+  Bins_Reducer* reducers[num_cores];
+  for (int t = 0; t < num_cores; t++) {
+    reducers[t] = create_bins_reducer(bins_size);
+  }
 
-  fftw_complex* fft_out = fftw_malloc(sizeof(fftw_complex) * (analyzer->blocksize/2 + 1));
-  double* fft_in = fftw_malloc(sizeof(double) * analyzer->blocksize);
-  fftw_plan plan = fftw_plan_dft_r2c_1d(analyzer->blocksize, fft_in, fft_out, FFTW_ESTIMATE);
-
-  int offset = 0;
-  int count = 0;
-  while (offset + analyzer->blocksize <= samples) {
-    memcpy(fft_in, normalized_data_left + offset, analyzer->blocksize * sizeof(double));
-    fftw_execute(plan);
+  long count = 0;
+  if (samples >= analyzer->blocksize) {
+    count = (samples - analyzer->blocksize) / analyzer->shift + 1;
+  }
 
-    for (int i = 0; i < bins_size; i++) {
-      double real = fft_out[i][0];
-      double imag = fft_out[i][1];
-      bins[i] += sqrt(real*real + imag*imag);
+  double* window = create_window(&analyzer->window, analyzer->blocksize);
+  #pragma omp parallel num_threads(num_cores)
+  {
+    int thread = omp_get_thread_num();
+    int threads = omp_get_num_threads();
+
+    // The batch only depends on blocksize and precision, so every thread
+    // cuts the same leaves.
+    FFTW_Batch* engine = create_fftw_batch(analyzer->blocksize, analyzer->shift, FFTW_ESTIMATE, analyzer->precision, window);
+    long leaf_windows = engine->batch;
+    long leaves = (count + leaf_windows - 1) / leaf_windows;
+    for (long leaf = leaves * thread / threads; leaf < leaves * (thread + 1) / threads; leaf++) {
+      double* sums = bins_reducer_leaf(reducers[thread]);
+      long first = leaf * leaf_windows;
+      fftw_batch_accumulate(engine, reader, first, MIN(leaf_windows, count - first), sums);
+      bins_reducer_add(reducers[thread], leaf, sums);
     }
+    destroy_fftw_batch(engine);
+  }
+  fftw_batch_cleanup();
+  free(window);
 
-    offset += analyzer->shift;
-    count++;
+  for (int t = 1; t < num_cores; t++) {
+    bins_reducer_merge(reducers[0], reducers[t]);
+    destroy_bins_reducer(reducers[t]);
   }
+  bins_reducer_result(reducers[0], bins);
+  destroy_bins_reducer(reducers[0]);
 
-  fftw_destroy_plan(plan);
-  fftw_free(fft_in);
-  fftw_free(fft_out);
-  free(normalized_data_left);
+  close_wav_reader(reader);
 
   for (int i = 0; i < bins_size; i++) {
     bins[i] /= count;
     bins[i] = 20 * log10(bins[i]);
   }
 
-  // Clean up FFTW threading
-  fftw_cleanup_threads();
-
   return bins;
 }
 
 int main(int argc, char* argv[]) {
-  if (argc != 5) {
-    fprintf(stderr, "Usage: %s <filename> <blocksize> <shift> <threshold>\n", argv[0]);
+  static struct option options[] = {
+    {"precision", required_argument, NULL, 'P'},
+    {"window", required_argument, NULL, 'W'},
+    {NULL, 0, NULL, 0}
+  };
+
+  Precision precision = PRECISION_DOUBLE;
+  Window_Spec window = {WINDOW_RECTANGULAR, DEFAULT_KAISER_BETA};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+    switch (opt) {
+    case 'P':
+      if (!parse_precision(optarg, &precision)) {
+        fprintf(stderr, "Unknown precision: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'W':
+      if (!parse_window(optarg, &window)) {
+        fprintf(stderr, "Unknown window: %s\n", optarg);
+        return 1;
+      }
+      break;
+    default:
+      return 1;
+    }
+  }
+
+  if (argc - optind != 4) {
+    fprintf(stderr, "Usage: %s [--precision <double|single>] [--window <name>] <filename> <blocksize> <shift> <threshold>\n", argv[0]);
     return 1;
   }
 
-  FFT_Analyzer* analyzer = create_fft_analyzer(argv[1], atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+  char** args = argv + optind;
+  FFT_Analyzer* analyzer = create_fft_analyzer(args[0], atoi(args[1]), atoi(args[2]), atoi(args[3]));
+  analyzer->precision = precision;
+  analyzer->window = window;
 
   struct timeval start, end;
   gettimeofday(&start, NULL);
@@ -121,7 +163,7 @@ int main(int argc, char* argv[]) {
   if (result) {
     for (int i = 0; i < analyzer->blocksize/2; i++) {
       if(result[i] > analyzer->threshold) {
-	printf("%dHz %f\n", i*(44100/(analyzer->blocksize/2)), result[i]);
+	printf("%dHz %f\n", (int)((long)i * analyzer->sample_rate / analyzer->blocksize), result[i]);
       }
     }
     printf("\n");
@@ -3,28 +3,41 @@
 #include <string.h>
 #include <math.h>
 #include <sys/time.h>
-#define CL_TARGET_OPENCL_VERSION 300
-#include "CL/cl.h"
+#include <getopt.h>
+#include "cl_pipeline.h"
+#include "wav_reader.h"
+#include "precision.h"
+#include "window_function.h"
 
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
-#define CHECK_CL_ERROR(err, msg) if (err != CL_SUCCESS) { fprintf(stderr, "%s failed: %d\n", msg, err); exit(EXIT_FAILURE); }
-#define PI 3.14159265358979323846
+// Set by CMake to the kernel in the source tree, so the binary runs from any
+// directory.
+#ifndef FFT_KERNEL_PATH
+#define FFT_KERNEL_PATH "../fft_kernel.cl"
+#endif
 
 typedef struct {
   char* filename;
   int blocksize;
   int shift;
   int threshold;
+  int sample_rate; // taken from the WAV header by get_amplitude_mean
+  cl_device_type device_type; // preferred device; any other is the fallback
+  Window_Spec window; // Hann by default; rectangular for bin-by-bin checks against aufgabe01
+  Precision precision;
 } FFT_Analyzer;
 
 FFT_Analyzer* create_fft_analyzer(const char* filename, int blocksize, int shift, int threshold) {
   FFT_Analyzer* analyzer = (FFT_Analyzer*)malloc(sizeof(FFT_Analyzer));
   analyzer->filename = strdup(filename);
-  analyzer->blocksize = MAX(MIN(512, blocksize), 64);
+  analyzer->blocksize = MAX(blocksize, 2);
   analyzer->shift = MAX(MIN(analyzer->blocksize, shift), 1);
   analyzer->threshold = threshold;
+  analyzer->device_type = CL_DEVICE_TYPE_GPU;
+  analyzer->window.type = WINDOW_HANN;
+  analyzer->precision = PRECISION_DOUBLE;
   return analyzer;
 }
 
@@ -33,230 +46,91 @@ void destroy_fft_analyzer(FFT_Analyzer* analyzer) {
   free(analyzer);
 }
 
-char* read_kernel_source(const char* filename) {
-  FILE* file = fopen(filename, "r");
-  if (!file) {
-    perror("Error opening kernel file");
-    return NULL;
-  }
-
-  fseek(file, 0, SEEK_END);
-  long size = ftell(file);
-  fseek(file, 0, SEEK_SET);
-
-  char* source = (char*)malloc(size + 1);
-  fread(source, 1, size, file);
-  source[size] = '\0';
-
-  fclose(file);
-  return source;
-}
-
-void apply_hann_window(double* data, int size) {
-  for (int i = 0; i < size; i++) {
-    data[i] *= 0.5 * (1 - cos(2 * PI * i / (size - 1)));
-  }
-}
-
 double* get_amplitude_mean(FFT_Analyzer* analyzer) {
-  FILE* file = fopen(analyzer->filename, "rb");
-  if (!file) {
-    perror("Error opening file");
+  WAV_Reader* reader = open_wav_reader(analyzer->filename, 0);
+  if (!reader) {
     return NULL;
   }
-
-  fseek(file, 0, SEEK_END);
-  long file_size = ftell(file);
-  fseek(file, 0, SEEK_SET);
-  int samples = file_size / 4;
-  short* data = (short*)malloc(file_size);
-  fread(data, 2, samples * 2, file);
-  fclose(file);
-
-  double* normalized_data_left = (double*)malloc(samples * sizeof(double));
-  for (int i = 0; i < samples; i++) {
-    normalized_data_left[i] = data[i*2] / 32768.0;
-  }
-  free(data);
-
-  int bins_size = analyzer->blocksize / 2 + 1;
-  double* bins = (double*)calloc(bins_size, sizeof(double));
-
-  // OpenCL setup
-  cl_platform_id platform;
-  cl_device_id device;
-  cl_context context;
-  cl_command_queue queue;
-  cl_program program;
-  cl_kernel fft_kernel, magnitude_kernel, db_kernel;
-  cl_int err;
-
-  // Initialize OpenCL
-  err = clGetPlatformIDs(1, &platform, NULL);
-  CHECK_CL_ERROR(err, "clGetPlatformIDs");
-
-  err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL);
-  CHECK_CL_ERROR(err, "clGetDeviceIDs");
-
-  context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
-  CHECK_CL_ERROR(err, "clCreateContext");
-
-  cl_queue_properties properties[] = {CL_QUEUE_PROPERTIES, 0, 0};
-  queue = clCreateCommandQueueWithProperties(context, device, properties, &err);
-  CHECK_CL_ERROR(err, "clCreateCommandQueueWithProperties");
-
-  // Load and compile the kernel
-  const char* source = read_kernel_source("../fft_kernel.cl");
-  if (!source) {
-    fprintf(stderr, "Error reading kernel source\n");
-    exit(EXIT_FAILURE);
-  }
-
-  program = clCreateProgramWithSource(context, 1, &source, NULL, &err);
-  CHECK_CL_ERROR(err, "clCreateProgramWithSource");
-  free((void*)source);
-
-  err = clBuildProgram(program, 1, &device, NULL, NULL, NULL);
-  if (err != CL_SUCCESS) {
-    size_t log_size;
-    clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-    char* log = (char*)malloc(log_size + 1);
-    clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
-    log[log_size] = '\0';
-    fprintf(stderr, "clBuildProgram failed:\n%s\n", log);
-    free(log);
-    exit(EXIT_FAILURE);
+  analyzer->sample_rate = reader->sample_rate;
+
+  double* window = create_window(&analyzer->window, analyzer->blocksize);
+  CL_Pipeline* pipeline = create_cl_pipeline(FFT_KERNEL_PATH, analyzer->device_type,
+                                             analyzer->blocksize, analyzer->shift, window, analyzer->precision);
+  free(window);
+  if (!pipeline) {
+    close_wav_reader(reader);
+    return NULL;
   }
+  printf("Using device: %s (%s precision)\n", pipeline->device_name, precision_name(analyzer->precision));
 
-  // Create kernels
-  fft_kernel = clCreateKernel(program, "fft", &err);
-  CHECK_CL_ERROR(err, "clCreateKernel fft");
-
-  magnitude_kernel = clCreateKernel(program, "compute_magnitude_squared", &err);
-  CHECK_CL_ERROR(err, "clCreateKernel compute_magnitude_squared");
-
-  db_kernel = clCreateKernel(program, "compute_db", &err);
-  CHECK_CL_ERROR(err, "clCreateKernel compute_db");
-
-  // Create buffers
-  cl_mem d_input = clCreateBuffer(context, CL_MEM_READ_WRITE, analyzer->blocksize * sizeof(cl_double2), NULL, &err);
-  CHECK_CL_ERROR(err, "clCreateBuffer d_input");
-
-  cl_mem d_magnitude = clCreateBuffer(context, CL_MEM_WRITE_ONLY, bins_size * sizeof(cl_double), NULL, &err);
-  CHECK_CL_ERROR(err, "clCreateBuffer d_magnitude");
-
-  cl_mem d_output = clCreateBuffer(context, CL_MEM_WRITE_ONLY, bins_size * sizeof(cl_double), NULL, &err);
-  CHECK_CL_ERROR(err, "clCreateBuffer d_output");
+  int bins_size = analyzer->blocksize / 2;
+  double* bins = calloc(bins_size, sizeof(double));
+  long count = cl_pipeline_accumulate(pipeline, reader, bins);
 
-  int offset = 0;
-  int count = 0;
-  size_t global_size;
+  destroy_cl_pipeline(pipeline);
+  close_wav_reader(reader);
 
-  while (offset + analyzer->blocksize <= samples) {
-    // Apply Hann window
-    double* windowed_data = (double*)malloc(analyzer->blocksize * sizeof(double));
-    for (int i = 0; i < analyzer->blocksize; i++) {
-      windowed_data[i] = normalized_data_left[offset + i];
-    }
-    apply_hann_window(windowed_data, analyzer->blocksize);
-
-    // Copy input data to device
-    cl_double2* input_data = (cl_double2*)malloc(analyzer->blocksize * sizeof(cl_double2));
-    for (int i = 0; i < analyzer->blocksize; i++) {
-      input_data[i].x = windowed_data[i];
-      input_data[i].y = 0.0;
-    }
-    free(windowed_data);
-
-    err = clEnqueueWriteBuffer(queue, d_input, CL_TRUE, 0, analyzer->blocksize * sizeof(cl_double2), input_data, 0, NULL, NULL);
-    CHECK_CL_ERROR(err, "clEnqueueWriteBuffer d_input");
-    free(input_data);
-
-    // Perform FFT
-    for (int step = 1; step < analyzer->blocksize; step *= 2) {
-      err = clSetKernelArg(fft_kernel, 0, sizeof(cl_mem), &d_input);
-      CHECK_CL_ERROR(err, "clSetKernelArg fft_kernel 0");
-      err = clSetKernelArg(fft_kernel, 1, sizeof(int), &analyzer->blocksize);
-      CHECK_CL_ERROR(err, "clSetKernelArg fft_kernel 1");
-      err = clSetKernelArg(fft_kernel, 2, sizeof(int), &step);
-      CHECK_CL_ERROR(err, "clSetKernelArg fft_kernel 2");
-
-      global_size = analyzer->blocksize / 2;
-      err = clEnqueueNDRangeKernel(queue, fft_kernel, 1, NULL, &global_size, NULL, 0, NULL, NULL);
-      CHECK_CL_ERROR(err, "clEnqueueNDRangeKernel fft_kernel");
-    }
-
-    // Compute magnitude squared
-    err = clSetKernelArg(magnitude_kernel, 0, sizeof(cl_mem), &d_input);
-    CHECK_CL_ERROR(err, "clSetKernelArg magnitude_kernel 0");
-    err = clSetKernelArg(magnitude_kernel, 1, sizeof(cl_mem), &d_magnitude);
-    CHECK_CL_ERROR(err, "clSetKernelArg magnitude_kernel 1");
-    err = clSetKernelArg(magnitude_kernel, 2, sizeof(int), &bins_size);
-    CHECK_CL_ERROR(err, "clSetKernelArg magnitude_kernel 2");
-
-    global_size = bins_size;
-    err = clEnqueueNDRangeKernel(queue, magnitude_kernel, 1, NULL, &global_size, NULL, 0, NULL, NULL);
-    CHECK_CL_ERROR(err, "clEnqueueNDRangeKernel magnitude_kernel");
-
-    // Accumulate results
-    double* magnitude = (double*)malloc(bins_size * sizeof(double));
-    err = clEnqueueReadBuffer(queue, d_magnitude, CL_TRUE, 0, bins_size * sizeof(double), magnitude, 0, NULL, NULL);
-    CHECK_CL_ERROR(err, "clEnqueueReadBuffer d_magnitude");
-
-    for (int i = 0; i < bins_size; i++) {
-      bins[i] += magnitude[i];
-    }
-    free(magnitude);
-
-    offset += analyzer->shift;
-    count++;
-  }
-
-  // Compute average and convert to dB
   for (int i = 0; i < bins_size; i++) {
     bins[i] /= count;
+    bins[i] = 20 * log10(bins[i]);
   }
 
-  err = clEnqueueWriteBuffer(queue, d_output, CL_TRUE, 0, bins_size * sizeof(double), bins, 0, NULL, NULL);
-  CHECK_CL_ERROR(err, "clEnqueueWriteBuffer d_output");
-
-  err = clSetKernelArg(db_kernel, 0, sizeof(cl_mem), &d_output);
-  CHECK_CL_ERROR(err, "clSetKernelArg db_kernel 0");
-  err = clSetKernelArg(db_kernel, 1, sizeof(cl_mem), &d_output);
-  CHECK_CL_ERROR(err, "clSetKernelArg db_kernel 1");
-  err = clSetKernelArg(db_kernel, 2, sizeof(int), &bins_size);
-  CHECK_CL_ERROR(err, "clSetKernelArg db_kernel 2");
-
-  global_size = bins_size;
-  err = clEnqueueNDRangeKernel(queue, db_kernel, 1, NULL, &global_size, NULL, 0, NULL, NULL);
-  CHECK_CL_ERROR(err, "clEnqueueNDRangeKernel db_kernel");
-
-  err = clEnqueueReadBuffer(queue, d_output, CL_TRUE, 0, bins_size * sizeof(double), bins, 0, NULL, NULL);
-  CHECK_CL_ERROR(err, "clEnqueueReadBuffer d_output");
-
-  // Clean up
-  clReleaseMemObject(d_input);
-  clReleaseMemObject(d_output);
-  clReleaseMemObject(d_magnitude);
-  clReleaseKernel(fft_kernel);
-  clReleaseKernel(magnitude_kernel);
-  clReleaseKernel(db_kernel);
-  clReleaseProgram(program);
-  clReleaseCommandQueue(queue);
-  clReleaseContext(context);
-
-  free(normalized_data_left);
-
   return bins;
 }
 
 int main(int argc, char* argv[]) {
-  if (argc != 5) {
-    fprintf(stderr, "Usage: %s <filename> <blocksize> <shift> <threshold>\n", argv[0]);
+  static struct option options[] = {
+    {"cpu", no_argument, NULL, 'c'},
+    {"window", required_argument, NULL, 'W'},
+    {"no-window", no_argument, NULL, 'r'},
+    {"precision", required_argument, NULL, 'P'},
+    {"check-precision", no_argument, NULL, 'C'},
+    {NULL, 0, NULL, 0}
+  };
+
+  cl_device_type device_type = CL_DEVICE_TYPE_GPU;
+  Window_Spec window = {WINDOW_HANN, DEFAULT_KAISER_BETA};
+  Precision precision = PRECISION_DOUBLE;
+  int check_precision = 0;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+    switch (opt) {
+    case 'c':
+      device_type = CL_DEVICE_TYPE_CPU;
+      break;
+    case 'W':
+      if (!parse_window(optarg, &window)) {
+        fprintf(stderr, "Unknown window: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'r':
+      window.type = WINDOW_RECTANGULAR;
+      break;
+    case 'P':
+      if (!parse_precision(optarg, &precision)) {
+        fprintf(stderr, "Unknown precision: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'C':
+      check_precision = 1;
+      break;
+    default:
+      return 1;
+    }
+  }
+
+  if (argc - optind != 4) {
+    fprintf(stderr, "Usage: %s [--cpu] [--window <name> | --no-window] [--precision <double|single>] [--check-precision] <filename> <blocksize> <shift> <threshold>\n", argv[0]);
     return 1;
   }
 
-  FFT_Analyzer* analyzer = create_fft_analyzer(argv[1], atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+  char** args = argv + optind;
+  FFT_Analyzer* analyzer = create_fft_analyzer(args[0], atoi(args[1]), atoi(args[2]), atoi(args[3]));
+  analyzer->device_type = device_type;
+  analyzer->window = window;
+  analyzer->precision = precision;
 
   struct timeval start, end;
   gettimeofday(&start, NULL);
@@ -265,13 +139,26 @@ int main(int argc, char* argv[]) {
 
   gettimeofday(&end, NULL);
 
+  // Untimed second pass in double for the accuracy report; needs fp64 on the
+  // device.
+  double* reference = NULL;
+  if (check_precision && result && precision != PRECISION_DOUBLE) {
+    analyzer->precision = PRECISION_DOUBLE;
+    reference = get_amplitude_mean(analyzer);
+    analyzer->precision = precision;
+  }
+
   if (result) {
     for (int i = 0; i < analyzer->blocksize/2; i++) {
       if(result[i] > analyzer->threshold) {
-	printf("%dHz %f\n", i*(44100/(analyzer->blocksize/2)), result[i]);
+	printf("%dHz %f\n", (int)((long)i * analyzer->sample_rate / analyzer->blocksize), result[i]);
       }
     }
     printf("\n");
+    if (reference) {
+      report_precision_deviation(reference, result, analyzer->blocksize / 2, analyzer->sample_rate, analyzer->blocksize);
+      free(reference);
+    }
     free(result);
   }
 
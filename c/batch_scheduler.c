@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include "batch_scheduler.h"
+
+Batch_Scheduler* create_batch_scheduler(long batches, int workers) {
+  Batch_Scheduler* scheduler = malloc(sizeof(Batch_Scheduler));
+  scheduler->batches = batches;
+  scheduler->workers = workers;
+  scheduler->deques = malloc(workers * sizeof(Batch_Deque));
+  for (int w = 0; w < workers; w++) {
+    Batch_Deque* deque = &scheduler->deques[w];
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->front = batches * w / workers;
+    deque->back = batches * (w + 1) / workers;
+    deque->stolen = 0;
+  }
+  return scheduler;
+}
+
+void destroy_batch_scheduler(Batch_Scheduler* scheduler) {
+  for (int w = 0; w < scheduler->workers; w++) {
+    pthread_mutex_destroy(&scheduler->deques[w].lock);
+  }
+  free(scheduler->deques);
+  free(scheduler);
+}
+
+// Moves the back half (rounded up) of the victim's range into the empty
+// deque of `worker`. Returns 0 if the victim had nothing left.
+static int steal(Batch_Scheduler* scheduler, int worker, int victim) {
+  Batch_Deque* from = &scheduler->deques[victim];
+  pthread_mutex_lock(&from->lock);
+  long remaining = from->back - from->front;
+  if (remaining <= 0) {
+    pthread_mutex_unlock(&from->lock);
+    return 0;
+  }
+  long back = from->back;
+  from->back -= (remaining + 1) / 2;
+  long front = from->back;
+  pthread_mutex_unlock(&from->lock);
+
+  Batch_Deque* to = &scheduler->deques[worker];
+  pthread_mutex_lock(&to->lock);
+  to->front = front;
+  to->back = back;
+  to->stolen += back - front;
+  pthread_mutex_unlock(&to->lock);
+  return 1;
+}
+
+long batch_scheduler_next(Batch_Scheduler* scheduler, int worker) {
+  Batch_Deque* own = &scheduler->deques[worker];
+  for (;;) {
+    pthread_mutex_lock(&own->lock);
+    if (own->front < own->back) {
+      long batch = own->front++;
+      pthread_mutex_unlock(&own->lock);
+      return batch;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    // Batches stolen by a third worker that has not installed them yet are
+    // invisible here; they are still processed, just not shared again.
+    int found = 0;
+    for (int i = 1; i < scheduler->workers && !found; i++) {
+      found = steal(scheduler, worker, (worker + i) % scheduler->workers);
+    }
+    if (!found) {
+      return -1;
+    }
+  }
+}
+
+long batch_scheduler_stolen(const Batch_Scheduler* scheduler) {
+  long stolen = 0;
+  for (int w = 0; w < scheduler->workers; w++) {
+    stolen += scheduler->deques[w].stolen;
+  }
+  return stolen;
+}
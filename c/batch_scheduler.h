@@ -0,0 +1,37 @@
+#ifndef BATCH_SCHEDULER_H
+#define BATCH_SCHEDULER_H
+
+#include <pthread.h>
+
+// Work-stealing distribution of `batches` equally sized tasks (e.g. runs of
+// consecutive windows) over `workers` threads. Every worker starts with a
+// contiguous range of batch indices in its own deque and takes them front to
+// back, which keeps its reads sequential. A worker whose deque runs dry
+// steals the back half of another worker's remaining range, so a preempted
+// or slow thread only holds up the batches it is actually working on.
+//
+// A deque is just the range [front, back) under its own lock; batches are
+// large enough that the lock is never contended in practice.
+typedef struct {
+  pthread_mutex_t lock;
+  long front;          // next batch the owner takes
+  long back;           // one past the last batch of the range
+  long stolen;         // batches this worker took from others
+} Batch_Deque;
+
+typedef struct {
+  long batches;
+  int workers;
+  Batch_Deque* deques;
+} Batch_Scheduler;
+
+Batch_Scheduler* create_batch_scheduler(long batches, int workers);
+void destroy_batch_scheduler(Batch_Scheduler* scheduler);
+
+// Next batch index for `worker`, or -1 once no batch is left anywhere.
+long batch_scheduler_next(Batch_Scheduler* scheduler, int worker);
+
+// Total number of batches that were stolen. Call after all workers finished.
+long batch_scheduler_stolen(const Batch_Scheduler* scheduler);
+
+#endif
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bins_accumulate.h"
+
+// Microbenchmark for the per-window bin update: times every ISA the CPU
+// supports for each blocksize on FFTW-shaped (double) and KISS-shaped
+// (float) spectra and checks that all variants produce identical bins.
+//
+// Usage: bench_accumulate [total_bins]   (default 1<<22 bin updates per run)
+
+#define REPEATS 3
+
+double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Best-of-REPEATS wall time for accumulating `frames` spectra.
+double time_double(const double* spectra, long frames, int stride, int bins_size, Accumulate_Mode mode, double* bins) {
+  double best = 1e30;
+  for (int r = 0; r < REPEATS; r++) {
+    memset(bins, 0, bins_size * sizeof(double));
+    double start = now_seconds();
+    accumulate_bins(spectra, frames, stride, bins_size, mode, bins);
+    double elapsed = now_seconds() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+  return best;
+}
+
+double time_float(const float* spectra, long frames, int stride, int bins_size, Accumulate_Mode mode, double* bins) {
+  double best = 1e30;
+  for (int r = 0; r < REPEATS; r++) {
+    memset(bins, 0, bins_size * sizeof(double));
+    double start = now_seconds();
+    accumulate_bins_float(spectra, frames, stride, bins_size, mode, bins);
+    double elapsed = now_seconds() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+  return best;
+}
+
+int main(int argc, char* argv[]) {
+  long total_bins = argc > 1 ? atol(argv[1]) : (1L << 22);
+  Accumulate_ISA best = accumulate_best_isa();
+  printf("Best ISA: %s\n", accumulate_isa_name(best));
+  printf("%-8s %-6s %-9s %-7s %10s %9s %s\n", "layout", "mode", "blocksize", "isa", "ns/bin", "speedup", "identical");
+
+  int failed = 0;
+  for (int blocksize = 64; blocksize <= 65536; blocksize *= 4) {
+    int bins_size = blocksize / 2;
+    int stride = bins_size + 1;
+    // The kernel runs right after the FFT, on output that is still in cache:
+    // keep ~256 KB of distinct spectra and cycle through them until
+    // total_bins updates are done.
+    long frames = total_bins / bins_size;
+    long distinct = (256L << 10) / (stride * 2 * sizeof(double));
+    distinct = distinct < 1 ? 1 : distinct < frames ? distinct : frames;
+
+    double* spectra = malloc(distinct * stride * 2 * sizeof(double));
+    float* spectra_float = malloc(distinct * stride * 2 * sizeof(float));
+    for (long i = 0; i < distinct * stride * 2; i++) {
+      spectra[i] = rand() / (double)RAND_MAX * 2 - 1;
+      spectra_float[i] = (float)spectra[i];
+    }
+    double* reference = malloc(bins_size * sizeof(double));
+    double* bins = malloc(bins_size * sizeof(double));
+
+    for (int layout = 0; layout < 2; layout++) {
+      for (int mode = ACCUMULATE_MAGNITUDE; mode <= ACCUMULATE_POWER; mode++) {
+        double scalar_time = 0;
+        for (int isa = ACCUMULATE_SCALAR; isa <= (int)best; isa++) {
+          accumulate_set_isa(isa);
+          double elapsed = 0;
+          for (long done = 0; done < frames; done += distinct) {
+            long n = frames - done < distinct ? frames - done : distinct;
+            elapsed += layout == 0
+              ? time_double(spectra, n, stride, bins_size, mode, bins)
+              : time_float(spectra_float, n, stride, bins_size, mode, bins);
+          }
+          if (isa == ACCUMULATE_SCALAR) {
+            scalar_time = elapsed;
+            memcpy(reference, bins, bins_size * sizeof(double));
+          }
+          int identical = memcmp(reference, bins, bins_size * sizeof(double)) == 0;
+          failed |= !identical;
+          printf("%-8s %-6s %-9d %-7s %10.3f %8.2fx %s\n",
+                 layout == 0 ? "double" : "float", mode == ACCUMULATE_POWER ? "power" : "mag",
+                 blocksize, accumulate_isa_name(isa), elapsed / frames / bins_size * 1e9,
+                 scalar_time / elapsed, identical ? "yes" : "NO");
+        }
+      }
+    }
+    accumulate_set_isa(best);
+
+    free(spectra);
+    free(spectra_float);
+    free(reference);
+    free(bins);
+  }
+
+  return failed;
+}
@@ -0,0 +1,497 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "analyzer_session.h"
+#include "fftw_wisdom.h"
+#include "signal_generator.h"
+
+// Reproducible benchmark of the analyzer backends. Generates deterministic
+// test signals with the aufgabe02 generators (once; they are reused while
+// the file exists) and sweeps backend x blocksize x shift x threads. Every
+// configuration runs `warmup` untimed and `repeat` timed rounds; each round
+// times two phases separately:
+//   setup    create_analyzer_session: threads, FFT planning (with wisdom),
+//            OpenCL context and program build
+//   analyze  analyzer_session_analyze of the file: mapping, conversion,
+//            transforms and accumulation
+// Reported per phase are the median and p95 wall time and, for analyze, the
+// windows/s and MB/s of sample data at the median.
+//
+// Multithreaded FFTW and KISS rows are the pthread/OpenMP-style path (window
+// batches spread over a pool of workers); OpenCL runs on a CPU device if
+// there is one, with one host thread.
+//
+// With --baseline the analyze throughput is compared against an earlier CSV
+// of this program; the exit status is 1 if any configuration lost more than
+// --tolerance (default 0.1, i.e. 10 %) of its windows/s, if a configuration
+// of the baseline was not measured, or if nothing matched at all.
+//
+// Usage: bench_analyzers [--backends fftw,kiss,opencl] [--blocksizes 256,1024,4096]
+//                        [--shifts 64,512] [--threads 1,<cores>] [--signals am_modulation]
+//                        [--duration <s>] [--warmup <n>] [--repeat <n>]
+//                        [--corpus <dir>] [--json] [--output <file>]
+//                        [--baseline <csv> [--tolerance <fraction>]]
+//                        [--wisdom-dir <dir> | --no-wisdom]
+
+#ifndef FFT_KERNEL_PATH
+#define FFT_KERNEL_PATH "../fft_kernel.cl"
+#endif
+
+#define MAX_LIST 16
+#define MAX_REPEAT 1000
+#define DEFAULT_DURATION 30.0
+#define DEFAULT_FREQUENCY 440.0
+#define DEFAULT_TOLERANCE 0.1
+
+typedef struct {
+  int values[MAX_LIST];
+  int count;
+} Int_List;
+
+typedef struct {
+  char* values[MAX_LIST];
+  int count;
+} Name_List;
+
+typedef struct {
+  const char* signal;
+  const char* backend;
+  int blocksize;
+  int shift;
+  int threads;
+  const char* phase;
+  int repeat;
+  double median;      // seconds
+  double p95;
+  double windows_per_s;
+  double mb_per_s;
+} Bench_Row;
+
+typedef struct {
+  Bench_Row* rows;
+  int count;
+  int capacity;
+} Bench_Table;
+
+static const char* backend_names[] = {"fftw", "kiss", "opencl"};
+
+double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int parse_int_list(const char* text, Int_List* list) {
+  list->count = 0;
+  const char* p = text;
+  while (*p && list->count < MAX_LIST) {
+    char* end;
+    long value = strtol(p, &end, 10);
+    if (end == p || value <= 0) {
+      return 0;
+    }
+    list->values[list->count++] = (int)value;
+    p = *end == ',' ? end + 1 : end;
+  }
+  return *p == '\0' && list->count > 0;
+}
+
+int parse_name_list(const char* text, Name_List* list) {
+  list->count = 0;
+  char* copy = strdup(text);
+  char* saveptr = NULL;
+  for (char* name = strtok_r(copy, ",", &saveptr); name && list->count < MAX_LIST; name = strtok_r(NULL, ",", &saveptr)) {
+    list->values[list->count++] = strdup(name);
+  }
+  free(copy);
+  return list->count > 0;
+}
+
+int parse_backend(const char* name, Session_Backend* backend) {
+  for (int i = 0; i < 3; i++) {
+    if (strcmp(name, backend_names[i]) == 0) {
+      *backend = (Session_Backend)i;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int compare_doubles(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+// Nearest rank of the sorted `times`.
+double percentile(const double* times, int count, double p) {
+  int rank = (int)(p * count + 0.999999) - 1;
+  return times[rank < 0 ? 0 : rank];
+}
+
+void add_row(Bench_Table* table, const Bench_Row* row) {
+  if (table->count == table->capacity) {
+    table->capacity = table->capacity ? 2 * table->capacity : 64;
+    table->rows = realloc(table->rows, table->capacity * sizeof(Bench_Row));
+  }
+  table->rows[table->count++] = *row;
+}
+
+// Path of the generated file for `signal`, written first if missing. The
+// name carries everything the samples depend on, and a file only gets it
+// once it is complete, so an interrupted generation or an older generator
+// is never mistaken for the corpus.
+char* corpus_file(const char* corpus, const char* signal, double duration) {
+  const Signal_Type* type = find_signal(signal);
+  if (!type) {
+    fprintf(stderr, "Unknown signal: %s\n", signal);
+    return NULL;
+  }
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/%s_%gHz_%gs_%d_v%d.wav", corpus, signal, DEFAULT_FREQUENCY, duration,
+           SAMPLE_RATE, SIGNAL_GENERATOR_VERSION);
+  struct stat info;
+  if (stat(path, &info) != 0) {
+    fprintf(stderr, "Generating %s\n", path);
+    char tmp[4100];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    Wave_Spec spec = {type, duration, DEFAULT_FREQUENCY, 1, 0};
+    if (write_wave(tmp, &spec) != 0) {
+      unlink(tmp);
+      return NULL;
+    }
+    if (rename(tmp, path) != 0) {
+      perror("Error renaming corpus file");
+      unlink(tmp);
+      return NULL;
+    }
+  }
+  return strdup(path);
+}
+
+// Runs warmup + repeat rounds of one configuration and adds its rows.
+// Returns 0 if the backend could not be set up.
+int bench_config(const Session_Config* config, const char* signal, const char* path,
+                 int warmup, int repeat, Bench_Table* table) {
+  double* setup = malloc(repeat * sizeof(double));
+  double* analyze = malloc(repeat * sizeof(double));
+  long windows = 0;
+  long bytes = 0;
+
+  for (int r = -warmup; r < repeat; r++) {
+    double start = now_seconds();
+    Analyzer_Session* session = create_analyzer_session(config);
+    double created = now_seconds();
+    if (!session) {
+      free(setup);
+      free(analyze);
+      return 0;
+    }
+    Session_Result* result = analyzer_session_analyze(session, path);
+    double done = now_seconds();
+    if (result) {
+      windows = result->windows;
+      bytes = result->bytes;
+      destroy_session_result(result);
+    }
+    destroy_analyzer_session(session);
+    if (!result) {
+      free(setup);
+      free(analyze);
+      return 0;
+    }
+    if (r >= 0) {
+      setup[r] = created - start;
+      analyze[r] = done - created;
+    }
+  }
+
+  qsort(setup, repeat, sizeof(double), compare_doubles);
+  qsort(analyze, repeat, sizeof(double), compare_doubles);
+  Bench_Row row = {
+    .signal = signal,
+    .backend = backend_names[config->backend],
+    .blocksize = config->blocksize,
+    .shift = config->shift,
+    .threads = config->backend == SESSION_OPENCL ? 1 : config->threads,
+    .phase = "setup",
+    .repeat = repeat,
+    .median = percentile(setup, repeat, 0.5),
+    .p95 = percentile(setup, repeat, 0.95)
+  };
+  add_row(table, &row);
+  row.phase = "analyze";
+  row.median = percentile(analyze, repeat, 0.5);
+  row.p95 = percentile(analyze, repeat, 0.95);
+  row.windows_per_s = windows / row.median;
+  row.mb_per_s = bytes / row.median / 1e6;
+  add_row(table, &row);
+
+  fprintf(stderr, "%s %s %d/%d x%d: analyze %.4f s, %.0f windows/s\n", signal, row.backend,
+          row.blocksize, row.shift, row.threads, row.median, row.windows_per_s);
+  free(setup);
+  free(analyze);
+  return 1;
+}
+
+void write_csv(FILE* out, const Bench_Table* table) {
+  fprintf(out, "signal,backend,blocksize,shift,threads,phase,repeat,median_s,p95_s,windows_per_s,mb_per_s\n");
+  for (int i = 0; i < table->count; i++) {
+    const Bench_Row* row = &table->rows[i];
+    fprintf(out, "%s,%s,%d,%d,%d,%s,%d,%.6f,%.6f,%.1f,%.3f\n", row->signal, row->backend, row->blocksize,
+            row->shift, row->threads, row->phase, row->repeat, row->median, row->p95,
+            row->windows_per_s, row->mb_per_s);
+  }
+}
+
+void write_json(FILE* out, const Bench_Table* table, double duration, int warmup) {
+  fprintf(out, "{\n  \"duration_s\": %g,\n  \"sample_rate\": %d,\n  \"warmup\": %d,\n  \"cores\": %ld,\n  \"results\": [\n",
+          duration, SAMPLE_RATE, warmup, sysconf(_SC_NPROCESSORS_ONLN));
+  for (int i = 0; i < table->count; i++) {
+    const Bench_Row* row = &table->rows[i];
+    fprintf(out, "    {\"signal\": \"%s\", \"backend\": \"%s\", \"blocksize\": %d, \"shift\": %d, \"threads\": %d, "
+                 "\"phase\": \"%s\", \"repeat\": %d, \"median_s\": %.6f, \"p95_s\": %.6f, "
+                 "\"windows_per_s\": %.1f, \"mb_per_s\": %.3f}%s\n",
+            row->signal, row->backend, row->blocksize, row->shift, row->threads, row->phase, row->repeat,
+            row->median, row->p95, row->windows_per_s, row->mb_per_s, i + 1 < table->count ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+}
+
+// Compares the analyze rows against a CSV of an earlier run. Returns the
+// number of configurations that got slower than the tolerance allows or
+// that are in the baseline but were not measured, or -1 if the baseline
+// cannot be read or none of its configurations was measured.
+int check_baseline(const char* filename, const Bench_Table* table, double tolerance) {
+  FILE* file = fopen(filename, "r");
+  if (!file) {
+    perror("Error opening baseline");
+    return -1;
+  }
+  int regressions = 0;
+  int matched = 0;
+  int missing = 0;
+  char line[1024];
+  while (fgets(line, sizeof(line), file)) {
+    char signal[256], backend[64], phase[64];
+    int blocksize, shift, threads, repeat;
+    double median, p95, windows_per_s, mb_per_s;
+    if (sscanf(line, "%255[^,],%63[^,],%d,%d,%d,%63[^,],%d,%lf,%lf,%lf,%lf", signal, backend, &blocksize,
+               &shift, &threads, phase, &repeat, &median, &p95, &windows_per_s, &mb_per_s) != 11 ||
+        strcmp(phase, "analyze") != 0) {
+      continue;
+    }
+    int found = 0;
+    for (int i = 0; i < table->count; i++) {
+      const Bench_Row* row = &table->rows[i];
+      if (strcmp(row->phase, "analyze") != 0 || strcmp(row->signal, signal) != 0 ||
+          strcmp(row->backend, backend) != 0 || row->blocksize != blocksize ||
+          row->shift != shift || row->threads != threads) {
+        continue;
+      }
+      found = 1;
+      matched++;
+      double change = row->windows_per_s / windows_per_s - 1;
+      if (change < -tolerance) {
+        fprintf(stderr, "REGRESSION %s %s %d/%d x%d: %.0f -> %.0f windows/s (%+.1f%%)\n", signal, backend,
+                blocksize, shift, threads, windows_per_s, row->windows_per_s, 100 * change);
+        regressions++;
+      }
+    }
+    if (!found) {
+      fprintf(stderr, "MISSING %s %s %d/%d x%d: in the baseline but not measured\n", signal, backend,
+              blocksize, shift, threads);
+      missing++;
+    }
+  }
+  fclose(file);
+  fprintf(stderr, "%d configurations compared with %s, %d regressions beyond %.0f%%, %d missing\n", matched,
+          filename, regressions, 100 * tolerance, missing);
+  if (matched == 0) {
+    fprintf(stderr, "No configuration of %s was measured\n", filename);
+    return -1;
+  }
+  return regressions + missing;
+}
+
+int main(int argc, char* argv[]) {
+  static struct option options[] = {
+    {"backends", required_argument, NULL, 'b'},
+    {"blocksizes", required_argument, NULL, 'B'},
+    {"shifts", required_argument, NULL, 's'},
+    {"threads", required_argument, NULL, 't'},
+    {"signals", required_argument, NULL, 'S'},
+    {"duration", required_argument, NULL, 'd'},
+    {"warmup", required_argument, NULL, 'u'},
+    {"repeat", required_argument, NULL, 'r'},
+    {"corpus", required_argument, NULL, 'c'},
+    {"json", no_argument, NULL, 'j'},
+    {"output", required_argument, NULL, 'o'},
+    {"baseline", required_argument, NULL, 'x'},
+    {"tolerance", required_argument, NULL, 'T'},
+    {"wisdom-dir", required_argument, NULL, 'w'},
+    {"no-wisdom", no_argument, NULL, 'n'},
+    {NULL, 0, NULL, 0}
+  };
+
+  Name_List backends;
+  parse_name_list("fftw,kiss", &backends);
+  Int_List blocksizes = {{256, 1024, 4096}, 3};
+  Int_List shifts = {{64, 512}, 2};
+  Int_List threads = {{1, (int)sysconf(_SC_NPROCESSORS_ONLN)}, 2};
+  if (threads.values[1] <= 1) {
+    threads.count = 1;
+  }
+  Name_List signals;
+  parse_name_list("am_modulation", &signals);
+  double duration = DEFAULT_DURATION;
+  int warmup = 1;
+  int repeat = 5;
+  const char* corpus = "/tmp";
+  int json = 0;
+  const char* output = NULL;
+  const char* baseline = NULL;
+  double tolerance = DEFAULT_TOLERANCE;
+  const char* wisdom_dir = fftw_wisdom_default_dir();
+  int opt;
+  while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+    int ok = 1;
+    switch (opt) {
+    case 'b':
+      ok = parse_name_list(optarg, &backends);
+      for (int i = 0; ok && i < backends.count; i++) {
+        Session_Backend backend;
+        ok = parse_backend(backends.values[i], &backend);
+      }
+      break;
+    case 'B':
+      ok = parse_int_list(optarg, &blocksizes);
+      break;
+    case 's':
+      ok = parse_int_list(optarg, &shifts);
+      break;
+    case 't':
+      ok = parse_int_list(optarg, &threads);
+      break;
+    case 'S':
+      ok = parse_name_list(optarg, &signals);
+      for (int i = 0; ok && i < signals.count; i++) {
+        ok = find_signal(signals.values[i]) != NULL;
+      }
+      break;
+    case 'd':
+      duration = atof(optarg);
+      ok = duration > 0;
+      break;
+    case 'u':
+      warmup = atoi(optarg);
+      ok = warmup >= 0;
+      break;
+    case 'r':
+      repeat = atoi(optarg);
+      ok = repeat > 0 && repeat <= MAX_REPEAT;
+      break;
+    case 'c':
+      corpus = optarg;
+      break;
+    case 'j':
+      json = 1;
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 'x':
+      baseline = optarg;
+      break;
+    case 'T':
+      tolerance = atof(optarg);
+      ok = tolerance >= 0;
+      break;
+    case 'w':
+      wisdom_dir = optarg;
+      break;
+    case 'n':
+      wisdom_dir = NULL;
+      break;
+    default:
+      return 1;
+    }
+    if (!ok) {
+      fprintf(stderr, "Invalid value: %s\n", optarg);
+      return 1;
+    }
+  }
+
+  if (optind != argc) {
+    fprintf(stderr, "Usage: %s [--backends fftw,kiss,opencl] [--blocksizes <n,...>] [--shifts <n,...>] "
+                    "[--threads <n,...>] [--signals <name,...>] [--duration <s>] [--warmup <n>] [--repeat <n>] "
+                    "[--corpus <dir>] [--json] [--output <file>] [--baseline <csv> [--tolerance <fraction>]] "
+                    "[--wisdom-dir <dir> | --no-wisdom]\n", argv[0]);
+    return 1;
+  }
+
+  Bench_Table table = {NULL, 0, 0};
+  int failed = 0;
+  for (int g = 0; g < signals.count; g++) {
+    char* path = corpus_file(corpus, signals.values[g], duration);
+    if (!path) {
+      return 1;
+    }
+    for (int b = 0; b < backends.count; b++) {
+      Session_Config config = {
+        .channel = 0,
+        .precision = PRECISION_DOUBLE,
+        .wisdom_dir = wisdom_dir,
+        .kernel_path = FFT_KERNEL_PATH,
+        .device_type = CL_DEVICE_TYPE_CPU
+      };
+      parse_backend(backends.values[b], &config.backend);
+      int backend_ok = 1;
+      for (int i = 0; backend_ok && i < blocksizes.count; i++) {
+        for (int j = 0; backend_ok && j < shifts.count; j++) {
+          if (shifts.values[j] > blocksizes.values[i]) {
+            continue;
+          }
+          // One host thread drives the OpenCL device, whatever --threads says.
+          int thread_counts = config.backend == SESSION_OPENCL ? 1 : threads.count;
+          for (int t = 0; backend_ok && t < thread_counts; t++) {
+            config.blocksize = blocksizes.values[i];
+            config.shift = shifts.values[j];
+            config.threads = config.backend == SESSION_OPENCL ? 1 : threads.values[t];
+            backend_ok = bench_config(&config, signals.values[g], path, warmup, repeat, &table);
+          }
+        }
+      }
+      if (!backend_ok) {
+        fprintf(stderr, "Skipping backend %s: setup or analysis failed\n", backends.values[b]);
+        failed++;
+      }
+    }
+    free(path);
+  }
+
+  FILE* out = output ? fopen(output, "w") : stdout;
+  if (!out) {
+    perror("Error opening output");
+    return 1;
+  }
+  if (json) {
+    write_json(out, &table, duration, warmup);
+  } else {
+    write_csv(out, &table);
+  }
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  int status = failed > 0 && table.count == 0;
+  if (baseline) {
+    status = check_baseline(baseline, &table, tolerance) != 0 || status;
+  }
+  free(table.rows);
+  return status;
+}
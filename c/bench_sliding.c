@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "fftw_batch.h"
+
+// Finds the crossover between the sliding DFT and the batched FFTW engine:
+// for each blocksize, times both on the same noise for growing shifts and
+// reports the largest shift at which sliding is still faster, next to the
+// shift fftw_batch_prefers_sliding picks. Also prints the largest deviation
+// of the sliding bins from the FFT bins in dB.
+//
+// Usage: bench_sliding [samples] [blocksize ...]
+//        (default 1<<20 samples, blocksizes 256 512 1024 2048 4096)
+
+#define REPEATS 3
+#define DEFAULT_SAMPLES (1L << 20)
+
+static const int default_blocksizes[] = {256, 512, 1024, 2048, 4096};
+static const int shifts[] = {1, 2, 3, 4, 6, 8, 12, 16, 24, 32};
+
+double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Best-of-REPEATS wall time for all windows of `samples`.
+double time_engine(FFTW_Batch* engine, const double* samples, long windows, double* bins) {
+  double best = 1e30;
+  for (int r = 0; r < REPEATS; r++) {
+    memset(bins, 0, engine->blocksize / 2 * sizeof(double));
+    double start = now_seconds();
+    fftw_batch_accumulate_samples(engine, samples, windows, bins);
+    double elapsed = now_seconds() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+  return best;
+}
+
+double max_deviation_db(const double* reference, const double* bins, int bins_size) {
+  double max = 0;
+  for (int i = 0; i < bins_size; i++) {
+    double diff = fabs(20 * log10(bins[i] / reference[i]));
+    max = diff > max ? diff : max;
+  }
+  return max;
+}
+
+int main(int argc, char* argv[]) {
+  long samples = argc > 1 ? atol(argv[1]) : DEFAULT_SAMPLES;
+  int count = argc > 2 ? argc - 2 : (int)(sizeof(default_blocksizes) / sizeof(default_blocksizes[0]));
+  int* blocksizes = malloc(count * sizeof(int));
+  for (int i = 0; i < count; i++) {
+    blocksizes[i] = argc > 2 ? atoi(argv[i + 2]) : default_blocksizes[i];
+  }
+
+  double* signal = malloc(samples * sizeof(double));
+  srand(1);
+  for (long i = 0; i < samples; i++) {
+    signal[i] = 2.0 * rand() / RAND_MAX - 1;
+  }
+
+  printf("%d samples of noise, best of %d\n", (int)samples, REPEATS);
+  for (int b = 0; b < count; b++) {
+    int n = blocksizes[b];
+    int bins_size = n / 2;
+    double* fft_bins = malloc(bins_size * sizeof(double));
+    double* sliding_bins = malloc(bins_size * sizeof(double));
+    int crossover = 0;
+
+    printf("\nblocksize %d\n", n);
+    printf("shift   fft ns/window  sliding ns/window  speedup  max diff dB\n");
+    for (size_t s = 0; s < sizeof(shifts) / sizeof(shifts[0]) && shifts[s] <= n; s++) {
+      int shift = shifts[s];
+      FFTW_Batch* engine = create_fftw_batch(n, shift, FFTW_MEASURE, PRECISION_DOUBLE, NULL);
+      long windows = fftw_batch_window_count(engine, samples);
+      if (windows == 0) {
+        destroy_fftw_batch(engine);
+        break;
+      }
+
+      engine->sliding = 0;
+      double fft_time = time_engine(engine, signal, windows, fft_bins);
+      engine->sliding = 1;
+      double sliding_time = time_engine(engine, signal, windows, sliding_bins);
+      destroy_fftw_batch(engine);
+
+      printf("%5d  %13.1f  %17.1f  %7.2f  %11.2e\n", shift, fft_time / windows * 1e9,
+             sliding_time / windows * 1e9, fft_time / sliding_time,
+             max_deviation_db(fft_bins, sliding_bins, bins_size));
+      if (sliding_time < fft_time) {
+        crossover = shift;
+      }
+    }
+
+    int preferred = 0;
+    while (fftw_batch_prefers_sliding(n, preferred + 1, PRECISION_DOUBLE)) {
+      preferred++;
+    }
+    printf("sliding faster up to shift %d, chosen automatically up to shift %d\n", crossover, preferred);
+    free(fft_bins);
+    free(sliding_bins);
+  }
+
+  fftw_batch_cleanup();
+  free(signal);
+  free(blocksizes);
+  return 0;
+}
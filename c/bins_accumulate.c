@@ -0,0 +1,230 @@
+#include <math.h>
+#include <pthread.h>
+#include "bins_accumulate.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+typedef void (*Kernel)(const double* x, long frames, long stride, int n, int power, double* bins);
+typedef void (*Kernel_Float)(const float* x, long frames, long stride, int n, int power, double* bins);
+
+// Every variant walks the bins in vector-width columns and, for each column,
+// adds all frames into a register before storing once. The per-bin order of
+// additions is still frame 0, 1, 2, ... and re*re + im*im is computed in
+// double with separate multiplies and one add (no FMA) followed by a
+// correctly rounded sqrt, so all of them give the same bits as this loop.
+// `stride` is in doubles/floats, i.e. twice the complex stride.
+static void kernel_scalar(const double* x, long frames, long stride, int n, int power, double* bins) {
+  for (int i = 0; i < n; i++) {
+    double acc = bins[i];
+    for (long f = 0; f < frames; f++) {
+      double real = x[f*stride + 2*i];
+      double imag = x[f*stride + 2*i + 1];
+      double p = real*real + imag*imag;
+      acc += power ? p : sqrt(p);
+    }
+    bins[i] = acc;
+  }
+}
+
+static void kernel_scalar_float(const float* x, long frames, long stride, int n, int power, double* bins) {
+  for (int i = 0; i < n; i++) {
+    double acc = bins[i];
+    for (long f = 0; f < frames; f++) {
+      double real = x[f*stride + 2*i];
+      double imag = x[f*stride + 2*i + 1];
+      double p = real*real + imag*imag;
+      acc += power ? p : sqrt(p);
+    }
+    bins[i] = acc;
+  }
+}
+
+#ifdef HAVE_X86
+__attribute__((target("sse2")))
+static inline __m128d power_sse2(__m128d a, __m128d b) {
+  __m128d re = _mm_unpacklo_pd(a, b);
+  __m128d im = _mm_unpackhi_pd(a, b);
+  return _mm_add_pd(_mm_mul_pd(re, re), _mm_mul_pd(im, im));
+}
+
+__attribute__((target("sse2")))
+static void kernel_sse2(const double* x, long frames, long stride, int n, int power, double* bins) {
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d acc = _mm_loadu_pd(bins + i);
+    for (long f = 0; f < frames; f++) {
+      const double* p = x + f*stride + 2*i;
+      __m128d v = power_sse2(_mm_loadu_pd(p), _mm_loadu_pd(p + 2));
+      acc = _mm_add_pd(acc, power ? v : _mm_sqrt_pd(v));
+    }
+    _mm_storeu_pd(bins + i, acc);
+  }
+  kernel_scalar(x + 2*i, frames, stride, n - i, power, bins + i);
+}
+
+__attribute__((target("sse2")))
+static void kernel_sse2_float(const float* x, long frames, long stride, int n, int power, double* bins) {
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d acc = _mm_loadu_pd(bins + i);
+    for (long f = 0; f < frames; f++) {
+      __m128 c = _mm_loadu_ps(x + f*stride + 2*i);
+      __m128d v = power_sse2(_mm_cvtps_pd(c), _mm_cvtps_pd(_mm_movehl_ps(c, c)));
+      acc = _mm_add_pd(acc, power ? v : _mm_sqrt_pd(v));
+    }
+    _mm_storeu_pd(bins + i, acc);
+  }
+  kernel_scalar_float(x + 2*i, frames, stride, n - i, power, bins + i);
+}
+
+// a = [r0 i0 r1 i1], b = [r2 i2 r3 i3] -> [p0 p1 p2 p3]
+__attribute__((target("avx2")))
+static inline __m256d power_avx2(__m256d a, __m256d b) {
+  __m256d re = _mm256_unpacklo_pd(a, b); // r0 r2 r1 r3
+  __m256d im = _mm256_unpackhi_pd(a, b); // i0 i2 i1 i3
+  __m256d p = _mm256_add_pd(_mm256_mul_pd(re, re), _mm256_mul_pd(im, im));
+  return _mm256_permute4x64_pd(p, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+__attribute__((target("avx2")))
+static void kernel_avx2(const double* x, long frames, long stride, int n, int power, double* bins) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d acc = _mm256_loadu_pd(bins + i);
+    for (long f = 0; f < frames; f++) {
+      const double* p = x + f*stride + 2*i;
+      __m256d v = power_avx2(_mm256_loadu_pd(p), _mm256_loadu_pd(p + 4));
+      acc = _mm256_add_pd(acc, power ? v : _mm256_sqrt_pd(v));
+    }
+    _mm256_storeu_pd(bins + i, acc);
+  }
+  kernel_sse2(x + 2*i, frames, stride, n - i, power, bins + i);
+}
+
+__attribute__((target("avx2")))
+static void kernel_avx2_float(const float* x, long frames, long stride, int n, int power, double* bins) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d acc = _mm256_loadu_pd(bins + i);
+    for (long f = 0; f < frames; f++) {
+      const float* p = x + f*stride + 2*i;
+      __m256d v = power_avx2(_mm256_cvtps_pd(_mm_loadu_ps(p)), _mm256_cvtps_pd(_mm_loadu_ps(p + 4)));
+      acc = _mm256_add_pd(acc, power ? v : _mm256_sqrt_pd(v));
+    }
+    _mm256_storeu_pd(bins + i, acc);
+  }
+  kernel_sse2_float(x + 2*i, frames, stride, n - i, power, bins + i);
+}
+
+// a = [r0 i0 .. r3 i3], b = [r4 i4 .. r7 i7] -> [p0 .. p7]
+__attribute__((target("avx512f")))
+static inline __m512d power_avx512(__m512d a, __m512d b) {
+  const __m512i even = _mm512_set_epi64(14, 12, 10, 8, 6, 4, 2, 0);
+  const __m512i odd = _mm512_set_epi64(15, 13, 11, 9, 7, 5, 3, 1);
+  __m512d re = _mm512_permutex2var_pd(a, even, b);
+  __m512d im = _mm512_permutex2var_pd(a, odd, b);
+  return _mm512_add_pd(_mm512_mul_pd(re, re), _mm512_mul_pd(im, im));
+}
+
+__attribute__((target("avx512f")))
+static void kernel_avx512(const double* x, long frames, long stride, int n, int power, double* bins) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512d acc = _mm512_loadu_pd(bins + i);
+    for (long f = 0; f < frames; f++) {
+      const double* p = x + f*stride + 2*i;
+      __m512d v = power_avx512(_mm512_loadu_pd(p), _mm512_loadu_pd(p + 8));
+      acc = _mm512_add_pd(acc, power ? v : _mm512_sqrt_pd(v));
+    }
+    _mm512_storeu_pd(bins + i, acc);
+  }
+  kernel_avx2(x + 2*i, frames, stride, n - i, power, bins + i);
+}
+
+__attribute__((target("avx512f")))
+static void kernel_avx512_float(const float* x, long frames, long stride, int n, int power, double* bins) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512d acc = _mm512_loadu_pd(bins + i);
+    for (long f = 0; f < frames; f++) {
+      const float* p = x + f*stride + 2*i;
+      __m512d v = power_avx512(_mm512_cvtps_pd(_mm256_loadu_ps(p)), _mm512_cvtps_pd(_mm256_loadu_ps(p + 8)));
+      acc = _mm512_add_pd(acc, power ? v : _mm512_sqrt_pd(v));
+    }
+    _mm512_storeu_pd(bins + i, acc);
+  }
+  kernel_avx2_float(x + 2*i, frames, stride, n - i, power, bins + i);
+}
+#endif
+
+static const Kernel kernels[ACCUMULATE_ISA_COUNT] = {
+  kernel_scalar,
+#ifdef HAVE_X86
+  kernel_sse2, kernel_avx2, kernel_avx512
+#endif
+};
+
+static const Kernel_Float kernels_float[ACCUMULATE_ISA_COUNT] = {
+  kernel_scalar_float,
+#ifdef HAVE_X86
+  kernel_sse2_float, kernel_avx2_float, kernel_avx512_float
+#endif
+};
+
+static pthread_once_t dispatch_once = PTHREAD_ONCE_INIT;
+static Accumulate_ISA best_isa = ACCUMULATE_SCALAR;
+static Accumulate_ISA current_isa = ACCUMULATE_SCALAR;
+
+static void init_dispatch(void) {
+#ifdef HAVE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    best_isa = ACCUMULATE_AVX512;
+  } else if (__builtin_cpu_supports("avx2")) {
+    best_isa = ACCUMULATE_AVX2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    best_isa = ACCUMULATE_SSE2;
+  }
+#endif
+  current_isa = best_isa;
+}
+
+Accumulate_ISA accumulate_best_isa(void) {
+  pthread_once(&dispatch_once, init_dispatch);
+  return best_isa;
+}
+
+Accumulate_ISA accumulate_current_isa(void) {
+  pthread_once(&dispatch_once, init_dispatch);
+  return current_isa;
+}
+
+int accumulate_set_isa(Accumulate_ISA isa) {
+  pthread_once(&dispatch_once, init_dispatch);
+  if (isa > best_isa) {
+    return 0;
+  }
+  current_isa = isa;
+  return 1;
+}
+
+const char* accumulate_isa_name(Accumulate_ISA isa) {
+  switch (isa) {
+  case ACCUMULATE_SCALAR: return "scalar";
+  case ACCUMULATE_SSE2: return "sse2";
+  case ACCUMULATE_AVX2: return "avx2";
+  case ACCUMULATE_AVX512: return "avx512";
+  default: return "unknown";
+  }
+}
+
+void accumulate_bins(const double* spectra, long frames, int stride, int bins_size, Accumulate_Mode mode, double* bins) {
+  kernels[accumulate_current_isa()](spectra, frames, 2L * stride, bins_size, mode == ACCUMULATE_POWER, bins);
+}
+
+void accumulate_bins_float(const float* spectra, long frames, int stride, int bins_size, Accumulate_Mode mode, double* bins) {
+  kernels_float[accumulate_current_isa()](spectra, frames, 2L * stride, bins_size, mode == ACCUMULATE_POWER, bins);
+}
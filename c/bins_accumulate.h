@@ -0,0 +1,39 @@
+#ifndef BINS_ACCUMULATE_H
+#define BINS_ACCUMULATE_H
+
+// Vectorised per-window bin update shared by all CPU analyzers:
+//   bins[i] += |X[i]|     (ACCUMULATE_MAGNITUDE)
+//   bins[i] += |X[i]|^2   (ACCUMULATE_POWER)
+// for `frames` spectra laid out as interleaved (re, im) pairs, i.e. the
+// fftw_complex and kiss_fft_cpx layouts. The ISA is picked once at runtime
+// (AVX-512, AVX2, SSE2, scalar). All variants round exactly like the scalar
+// loop, so the choice never changes the result.
+
+typedef enum {
+  ACCUMULATE_MAGNITUDE,
+  ACCUMULATE_POWER
+} Accumulate_Mode;
+
+typedef enum {
+  ACCUMULATE_SCALAR,
+  ACCUMULATE_SSE2,
+  ACCUMULATE_AVX2,
+  ACCUMULATE_AVX512,
+  ACCUMULATE_ISA_COUNT
+} Accumulate_ISA;
+
+// `spectra` holds `frames` spectra of `stride` complex values each; the
+// first `bins_size` values of every spectrum are added to `bins`.
+void accumulate_bins(const double* spectra, long frames, int stride, int bins_size, Accumulate_Mode mode, double* bins);
+void accumulate_bins_float(const float* spectra, long frames, int stride, int bins_size, Accumulate_Mode mode, double* bins);
+
+// Best ISA the CPU supports, and the one currently in use.
+Accumulate_ISA accumulate_best_isa(void);
+Accumulate_ISA accumulate_current_isa(void);
+const char* accumulate_isa_name(Accumulate_ISA isa);
+
+// Overrides the dispatch, e.g. for benchmarks. Returns 0 if the CPU lacks
+// the ISA. Not thread safe; call before any worker starts.
+int accumulate_set_isa(Accumulate_ISA isa);
+
+#endif
@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bins_reduce.h"
+
+Bins_Reducer* create_bins_reducer(int bins_size) {
+  Bins_Reducer* reducer = calloc(1, sizeof(Bins_Reducer));
+  reducer->bins_size = bins_size;
+  return reducer;
+}
+
+void destroy_bins_reducer(Bins_Reducer* reducer) {
+  for (int i = 0; i < reducer->count; i++) {
+    free(reducer->nodes[i].sums);
+  }
+  for (int i = 0; i < reducer->spare_count; i++) {
+    free(reducer->spare[i]);
+  }
+  free(reducer->nodes);
+  free(reducer->spare);
+  free(reducer);
+}
+
+static void release(Bins_Reducer* reducer, double* sums) {
+  if (reducer->spare_count == reducer->spare_capacity) {
+    reducer->spare_capacity = reducer->spare_capacity ? 2 * reducer->spare_capacity : 8;
+    reducer->spare = realloc(reducer->spare, reducer->spare_capacity * sizeof(double*));
+  }
+  reducer->spare[reducer->spare_count++] = sums;
+}
+
+double* bins_reducer_leaf(Bins_Reducer* reducer) {
+  double* sums = reducer->spare_count > 0 ? reducer->spare[--reducer->spare_count]
+                                          : malloc(reducer->bins_size * sizeof(double));
+  memset(sums, 0, reducer->bins_size * sizeof(double));
+  return sums;
+}
+
+static void push(Bins_Reducer* reducer, Reduce_Node node) {
+  if (reducer->count == reducer->capacity) {
+    reducer->capacity = reducer->capacity ? 2 * reducer->capacity : 16;
+    reducer->nodes = realloc(reducer->nodes, reducer->capacity * sizeof(Reduce_Node));
+  }
+  reducer->nodes[reducer->count++] = node;
+
+  // Merge while the two newest nodes are the left and right child of the
+  // same parent.
+  while (reducer->count >= 2) {
+    Reduce_Node* left = &reducer->nodes[reducer->count - 2];
+    Reduce_Node* right = &reducer->nodes[reducer->count - 1];
+    if (left->level != right->level || (right->index & 1) == 0 || left->index != right->index - 1) {
+      break;
+    }
+    for (int i = 0; i < reducer->bins_size; i++) {
+      left->sums[i] += right->sums[i];
+    }
+    left->level++;
+    left->index >>= 1;
+    release(reducer, right->sums);
+    reducer->count--;
+  }
+}
+
+void bins_reducer_add(Bins_Reducer* reducer, long leaf, double* sums) {
+  Reduce_Node node = {0, leaf, sums};
+  push(reducer, node);
+}
+
+void bins_reducer_merge(Bins_Reducer* reducer, Bins_Reducer* other) {
+  for (int i = 0; i < other->count; i++) {
+    push(reducer, other->nodes[i]);
+  }
+  other->count = 0;
+}
+
+static int compare_start(const void* a, const void* b) {
+  const Reduce_Node* x = a;
+  const Reduce_Node* y = b;
+  long start_x = x->index << x->level;
+  long start_y = y->index << y->level;
+  return (start_x > start_y) - (start_x < start_y);
+}
+
+void bins_reducer_result(Bins_Reducer* reducer, double* bins) {
+  // Replayed left to right, the nodes merge into the complete subtrees of
+  // the tree over all leaves, largest first.
+  qsort(reducer->nodes, reducer->count, sizeof(Reduce_Node), compare_start);
+  int count = reducer->count;
+  reducer->count = 0;
+  for (int i = 0; i < count; i++) {
+    push(reducer, reducer->nodes[i]);
+  }
+
+  // The subtrees are added from the right, smallest into the next larger.
+  memset(bins, 0, reducer->bins_size * sizeof(double));
+  for (int n = reducer->count - 1; n >= 0; n--) {
+    const double* sums = reducer->nodes[n].sums;
+    for (int i = 0; i < reducer->bins_size; i++) {
+      bins[i] = sums[i] + bins[i];
+    }
+  }
+}
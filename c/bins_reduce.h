@@ -0,0 +1,65 @@
+#ifndef BINS_REDUCE_H
+#define BINS_REDUCE_H
+
+// Deterministic summation of the bins of many windows over several threads.
+// Adding millions of magnitudes into one double per bin in whatever order
+// the threads finish makes the last digits depend on the core count and on
+// scheduling. Here the order of every addition is fixed by the window
+// index alone:
+//
+// - The windows are cut into leaves of a fixed number of windows. A leaf is
+//   summed on its own, window after window, into a fresh vector.
+// - Leaves are combined pairwise along one fixed binary tree over the leaf
+//   indices: node (level, index) is the sum of leaves index << level ..
+//   ((index + 1) << level) - 1, always computed as left child + right child.
+//
+// Each thread keeps a small stack of finished nodes and merges two of them
+// as soon as they are siblings, so a thread working through a contiguous
+// range of leaves holds O(log leaves) vectors. bins_reducer_result combines
+// the nodes of all threads, in any order they were produced, into the same
+// tree. The total is therefore bitwise identical for any thread count and
+// any distribution of the leaves (work stealing included), and the rounding
+// error grows with the leaf size plus log2(leaves) instead of the number
+// of windows.
+//
+// For a bitwise identical result the leaves must also be computed
+// identically: the same windows per leaf whatever the thread count, and the
+// same transforms inside a leaf (e.g. a multiple of the FFTW batch, so the
+// batches of a leaf do not depend on where a thread started).
+
+typedef struct {
+  int level;
+  long index;
+  double* sums;        // bins_size values
+} Reduce_Node;
+
+typedef struct {
+  int bins_size;
+  Reduce_Node* nodes;  // stack, newest last
+  int count;
+  int capacity;
+  double** spare;      // vectors of merged nodes, reused for new leaves
+  int spare_count;
+  int spare_capacity;
+} Bins_Reducer;
+
+Bins_Reducer* create_bins_reducer(int bins_size);
+void destroy_bins_reducer(Bins_Reducer* reducer);
+
+// A zeroed vector for the next leaf. Add the leaf's windows to it in window
+// order and hand it back with bins_reducer_add.
+double* bins_reducer_leaf(Bins_Reducer* reducer);
+
+// Adds the sums of leaf `leaf` (a vector from bins_reducer_leaf, which the
+// reducer takes back). Leaves should come in increasing order per reducer;
+// other orders stay correct, they just keep more vectors until the end.
+void bins_reducer_add(Bins_Reducer* reducer, long leaf, double* sums);
+
+// Moves all nodes of `other` into `reducer`; `other` is left empty.
+void bins_reducer_merge(Bins_Reducer* reducer, Bins_Reducer* other);
+
+// Writes the total over all leaves added so far into `bins` (zeros if there
+// were none). The leaves must cover 0 .. n - 1 exactly once.
+void bins_reducer_result(Bins_Reducer* reducer, double* bins);
+
+#endif
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+#include "batch_scheduler.h"
+
+// Stress test for batch_scheduler: runs 1..16 workers over various batch
+// counts, with worker 0 slowed down so the others keep stealing from it,
+// and checks that every batch is handed out exactly once.
+//
+// Usage: check_scheduler [rounds]   (default 3 passes over all shapes)
+
+#define MAX_WORKERS 16
+#define SLOW_SPIN 200000
+
+typedef struct {
+  Batch_Scheduler* scheduler;
+  int worker;
+  int* seen;          // times each batch was handed out
+  long taken;
+} Worker_Data;
+
+void* take_batches(void* arg) {
+  Worker_Data* data = arg;
+  long batch;
+  while ((batch = batch_scheduler_next(data->scheduler, data->worker)) >= 0) {
+    __atomic_fetch_add(&data->seen[batch], 1, __ATOMIC_RELAXED);
+    data->taken++;
+    if (data->worker == 0) {
+      for (volatile int i = 0; i < SLOW_SPIN; i++);
+    }
+    sched_yield();
+  }
+  return NULL;
+}
+
+// Returns the number of batches not handed out exactly once.
+long check_shape(int workers, long batches, long* stolen) {
+  Batch_Scheduler* scheduler = create_batch_scheduler(batches, workers);
+  int* seen = calloc(batches + 1, sizeof(int));
+  pthread_t threads[MAX_WORKERS];
+  Worker_Data data[MAX_WORKERS];
+  for (int w = 0; w < workers; w++) {
+    data[w].scheduler = scheduler;
+    data[w].worker = w;
+    data[w].seen = seen;
+    data[w].taken = 0;
+    pthread_create(&threads[w], NULL, take_batches, &data[w]);
+  }
+  for (int w = 0; w < workers; w++) {
+    pthread_join(threads[w], NULL);
+  }
+
+  long wrong = 0;
+  for (long b = 0; b < batches; b++) {
+    if (seen[b] != 1) {
+      fprintf(stderr, "%d workers, %ld batches: batch %ld handed out %d times\n", workers, batches, b, seen[b]);
+      wrong++;
+    }
+  }
+  *stolen += batch_scheduler_stolen(scheduler);
+  destroy_batch_scheduler(scheduler);
+  free(seen);
+  return wrong;
+}
+
+int main(int argc, char* argv[]) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 3;
+
+  long shapes = 0;
+  long wrong = 0;
+  long stolen = 0;
+  for (int r = 0; r < rounds; r++) {
+    for (int workers = 1; workers <= MAX_WORKERS; workers += 3) {
+      for (long batches = 0; batches < 300; batches += 37) {
+        wrong += check_shape(workers, batches, &stolen);
+        shapes++;
+      }
+    }
+  }
+
+  printf("%ld shapes, %ld batches stolen, %ld wrong\n", shapes, stolen, wrong);
+  return wrong == 0 ? 0 : 1;
+}
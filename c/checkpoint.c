@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "checkpoint.h"
+
+#define CHECKPOINT_MAGIC "FFTCKPT1"
+#define CHECKPOINT_VERSION 1
+
+static void put_u32(unsigned char* p, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = v >> (8 * i);
+  }
+}
+
+static void put_u64(unsigned char* p, uint64_t v) {
+  for (int i = 0; i < 8; i++) {
+    p[i] = v >> (8 * i);
+  }
+}
+
+static void put_f64(unsigned char* p, double v) {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  put_u64(p, bits);
+}
+
+static uint32_t get_u32(const unsigned char* p) {
+  uint32_t v = 0;
+  for (int i = 0; i < 4; i++) {
+    v |= (uint32_t)p[i] << (8 * i);
+  }
+  return v;
+}
+
+static uint64_t get_u64(const unsigned char* p) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) {
+    v |= (uint64_t)p[i] << (8 * i);
+  }
+  return v;
+}
+
+static double get_f64(const unsigned char* p) {
+  uint64_t bits = get_u64(p);
+  double v;
+  memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+static uint64_t fnv1a(const unsigned char* data, long size) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (long i = 0; i < size; i++) {
+    hash = (hash ^ data[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static long file_size(int bins_size) {
+  return CHECKPOINT_HEADER_SIZE + 8L * bins_size + 8;
+}
+
+static void encode(unsigned char* buffer, const Checkpoint* checkpoint) {
+  const Checkpoint_Key* key = &checkpoint->key;
+  memcpy(buffer, CHECKPOINT_MAGIC, 8);
+  put_u32(buffer + 8, CHECKPOINT_VERSION);
+  put_u32(buffer + 12, key->blocksize);
+  put_u32(buffer + 16, key->shift);
+  put_u32(buffer + 20, key->channel);
+  put_u32(buffer + 24, key->precision);
+  put_u32(buffer + 28, key->window);
+  put_f64(buffer + 32, key->kaiser_beta);
+  put_u32(buffer + 40, key->power);
+  put_u32(buffer + 44, key->bins_size);
+  put_u64(buffer + 48, key->input_size);
+  put_u64(buffer + 56, key->input_mtime);
+  put_u64(buffer + 64, checkpoint->windows);
+  put_u64(buffer + 72, checkpoint->byte_offset);
+  for (int i = 0; i < key->bins_size; i++) {
+    put_f64(buffer + CHECKPOINT_HEADER_SIZE + 8 * i, checkpoint->bins[i]);
+  }
+  long size = file_size(key->bins_size);
+  put_u64(buffer + size - 8, fnv1a(buffer, size - 8));
+}
+
+int checkpoint_key_for_file(const char* input, Checkpoint_Key* key) {
+  struct stat st;
+  if (stat(input, &st) != 0) {
+    perror("Error reading input file");
+    return -1;
+  }
+  key->input_size = st.st_size;
+  key->input_mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  return 0;
+}
+
+static int write_all(int fd, const unsigned char* data, long size) {
+  while (size > 0) {
+    ssize_t n = write(fd, data, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    data += n;
+    size -= n;
+  }
+  return 0;
+}
+
+// Makes the rename itself durable.
+static void sync_directory(const char* path) {
+  char* copy = strdup(path);
+  int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+  free(copy);
+}
+
+int write_checkpoint(const char* path, const Checkpoint* checkpoint) {
+  long size = file_size(checkpoint->key.bins_size);
+  unsigned char* buffer = malloc(size);
+  encode(buffer, checkpoint);
+
+  char* tmp = malloc(strlen(path) + 5);
+  sprintf(tmp, "%s.tmp", path);
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  int err = fd < 0;
+  if (!err) {
+    err = write_all(fd, buffer, size) != 0 || fsync(fd) != 0;
+    err = close(fd) != 0 || err;
+    err = err || rename(tmp, path) != 0;
+  }
+  if (err) {
+    perror("Error writing checkpoint");
+    if (fd >= 0) {
+      unlink(tmp);
+    }
+  } else {
+    sync_directory(path);
+  }
+  free(tmp);
+  free(buffer);
+  return err ? -1 : 0;
+}
+
+int read_checkpoint(const char* path, Checkpoint* checkpoint) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    if (errno == ENOENT) {
+      return 0;
+    }
+    perror("Error opening checkpoint");
+    return -1;
+  }
+
+  long size = file_size(checkpoint->key.bins_size);
+  unsigned char* buffer = malloc(size + 1);
+  long read = fread(buffer, 1, size + 1, file);
+  fclose(file);
+
+  // Everything except the progress must match what this run would write.
+  Checkpoint expected = *checkpoint;
+  expected.windows = 0;
+  expected.byte_offset = 0;
+  expected.bins = calloc(checkpoint->key.bins_size, sizeof(double));
+  unsigned char* header = malloc(size);
+  encode(header, &expected);
+  free(expected.bins);
+
+  int result = -1;
+  if (read != size || memcmp(buffer, CHECKPOINT_MAGIC, 8) != 0 || get_u64(buffer + size - 8) != fnv1a(buffer, size - 8)) {
+    fprintf(stderr, "Checkpoint %s is damaged or not a checkpoint\n", path);
+  } else if (get_u32(buffer + 8) != CHECKPOINT_VERSION || memcmp(buffer + 12, header + 12, 64 - 12) != 0) {
+    fprintf(stderr, "Checkpoint %s belongs to another input or other parameters\n", path);
+  } else {
+    checkpoint->windows = get_u64(buffer + 64);
+    checkpoint->byte_offset = get_u64(buffer + 72);
+    for (int i = 0; i < checkpoint->key.bins_size; i++) {
+      checkpoint->bins[i] = get_f64(buffer + CHECKPOINT_HEADER_SIZE + 8 * i);
+    }
+    result = 1;
+  }
+  free(header);
+  free(buffer);
+  return result;
+}
@@ -0,0 +1,71 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+// Snapshots of a running analysis, so that a long run can continue after a
+// crash or preemption instead of starting over. A checkpoint holds the
+// accumulated (not yet averaged) bins, the number of windows they cover and
+// the file offset of the next window, together with everything that
+// decides what the bins mean: the analysis parameters and the size and
+// modification time of the input.
+//
+// write_checkpoint replaces the file atomically: it writes `<path>.tmp`,
+// fsyncs it, renames it over `<path>` and fsyncs the directory, so after a
+// crash the file is either the previous checkpoint or the new one, never a
+// mixture.
+//
+// File layout (little endian):
+//
+//   offset  size  field
+//        0     8  magic "FFTCKPT1"
+//        8     4  version (1)
+//       12     4  blocksize
+//       16     4  shift
+//       20     4  channel (-1 for the downmix)
+//       24     4  precision (Precision)
+//       28     4  window (Window_Type)
+//       32     8  float64 Kaiser beta
+//       40     4  power: 1 if the bins hold |X|^2, 0 for |X|
+//       44     4  bins (blocksize / 2)
+//       48     8  input size in bytes
+//       56     8  input modification time in nanoseconds
+//       64     8  windows accumulated
+//       72     8  byte offset of the next window in the input
+//       80        bins float64 values
+//    80+8*bins  8  FNV-1a hash of everything before
+
+#define CHECKPOINT_HEADER_SIZE 80
+
+typedef struct {
+  int blocksize;
+  int shift;
+  int channel;
+  int precision;
+  int window;
+  double kaiser_beta;
+  int power;
+  int bins_size;
+  long long input_size;
+  long long input_mtime;
+} Checkpoint_Key;
+
+typedef struct {
+  Checkpoint_Key key;
+  long windows;
+  long long byte_offset;
+  double* bins;          // key.bins_size values, owned by the caller
+} Checkpoint;
+
+// Fills in input_size and input_mtime from `input`. Returns -1 if it cannot
+// be stat'ed.
+int checkpoint_key_for_file(const char* input, Checkpoint_Key* key);
+
+// Returns 0, or -1 if the checkpoint could not be written; the previous one
+// is then left in place.
+int write_checkpoint(const char* path, const Checkpoint* checkpoint);
+
+// Reads `path` into `checkpoint`, whose key and bins must already be set:
+// returns 1 if it holds a checkpoint for exactly that key, 0 if there is no
+// such file, and -1 if it is unreadable, damaged or for another analysis.
+int read_checkpoint(const char* path, Checkpoint* checkpoint);
+
+#endif
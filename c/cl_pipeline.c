@@ -0,0 +1,542 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "cl_pipeline.h"
+
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+#define CHECK_CL_ERROR(err, msg) if (err != CL_SUCCESS) { fprintf(stderr, "%s failed: %d\n", msg, err); exit(EXIT_FAILURE); }
+#define PI 3.14159265358979323846
+
+// Work and spectrum buffers are frames * m complex values each; keep them
+// around 64 MB so a chunk is thousands of frames for typical sizes.
+#define CL_PIPELINE_BYTES (64L << 20)
+#define CL_PIPELINE_MAX_FRAMES 8192
+#define CL_PIPELINE_MAX_GROUP 256
+
+// Events kept before the profiler waits for them, so memory stays bounded on
+// long files.
+#define CL_PROFILE_MAX_EVENTS 4096
+
+static char* read_kernel_source(const char* filename) {
+  FILE* file = fopen(filename, "r");
+  if (!file) {
+    perror("Error opening kernel file");
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  char* source = malloc(size + 1);
+  size = fread(source, 1, size, file);
+  source[size] = '\0';
+
+  fclose(file);
+  return source;
+}
+
+// First device of type `type` on any platform.
+static int find_device(cl_device_type type, cl_device_id* device) {
+  cl_uint count = 0;
+  if (clGetPlatformIDs(0, NULL, &count) != CL_SUCCESS || count == 0) {
+    return 0;
+  }
+  cl_platform_id platforms[count];
+  clGetPlatformIDs(count, platforms, NULL);
+  for (cl_uint i = 0; i < count; i++) {
+    if (clGetDeviceIDs(platforms[i], type, 1, device, NULL) == CL_SUCCESS) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static cl_kernel create_kernel(cl_program program, const char* name) {
+  cl_int err;
+  cl_kernel kernel = clCreateKernel(program, name, &err);
+  if (err != CL_SUCCESS) {
+    fprintf(stderr, "clCreateKernel %s failed: %d\n", name, err);
+    exit(EXIT_FAILURE);
+  }
+  return kernel;
+}
+
+// Bytes of one real value on the device.
+static size_t real_size(const CL_Pipeline* pipeline) {
+  return pipeline->precision == PRECISION_SINGLE ? sizeof(cl_float) : sizeof(cl_double);
+}
+
+// Stores `count` doubles as device reals, i.e. narrowed to float in single
+// precision.
+static void to_device_reals(const CL_Pipeline* pipeline, const double* values, long count, void* out) {
+  if (pipeline->precision == PRECISION_SINGLE) {
+    float* narrow = out;
+    for (long i = 0; i < count; i++) {
+      narrow[i] = (float)values[i];
+    }
+  } else {
+    memcpy(out, values, count * sizeof(double));
+  }
+}
+
+// Read-only buffer holding `count` reals; complex tables pass 2 * values.
+static cl_mem create_real_buffer(CL_Pipeline* pipeline, const double* values, long count, const char* name) {
+  cl_int err;
+  void* data = malloc(count * real_size(pipeline));
+  to_device_reals(pipeline, values, count, data);
+  cl_mem buffer = clCreateBuffer(pipeline->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, count * real_size(pipeline), data, &err);
+  CHECK_CL_ERROR(err, name);
+  free(data);
+  return buffer;
+}
+
+static cl_int set_real_arg(const CL_Pipeline* pipeline, cl_kernel kernel, int index, double value) {
+  if (pipeline->precision == PRECISION_SINGLE) {
+    float narrow = (float)value;
+    return clSetKernelArg(kernel, index, sizeof(float), &narrow);
+  }
+  return clSetKernelArg(kernel, index, sizeof(double), &value);
+}
+
+// Where a command should store its event: a new slot of the profiling list,
+// or NULL if the pipeline is not profiled.
+static cl_event* profile_event(CL_Pipeline* pipeline, Profile_Phase phase) {
+  if (!pipeline->profiling) {
+    return NULL;
+  }
+  if (pipeline->event_count == pipeline->event_capacity) {
+    pipeline->event_capacity = pipeline->event_capacity ? 2 * pipeline->event_capacity : 256;
+    pipeline->events = realloc(pipeline->events, pipeline->event_capacity * sizeof(cl_event));
+    pipeline->event_phases = realloc(pipeline->event_phases, pipeline->event_capacity * sizeof(Profile_Phase));
+  }
+  pipeline->event_phases[pipeline->event_count] = phase;
+  return &pipeline->events[pipeline->event_count++];
+}
+
+static void report_event(CL_Pipeline* pipeline, cl_event event, Profile_Phase phase) {
+  cl_ulong start = 0;
+  cl_ulong end = 0;
+  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+  if (pipeline->clock_offset == 0) {
+    // The device clock has its own origin. The command has just been seen
+    // complete, so its end is placed at the current host time; later events
+    // keep that offset.
+    pipeline->clock_offset = profiler_now() - (long long)end;
+  }
+  profiler_record_device(phase, (long long)start + pipeline->clock_offset, (long long)end + pipeline->clock_offset);
+}
+
+// Waits for the listed commands and reports them.
+static void report_events(CL_Pipeline* pipeline) {
+  if (pipeline->event_count == 0) {
+    return;
+  }
+  clWaitForEvents(pipeline->event_count, pipeline->events);
+  for (int i = 0; i < pipeline->event_count; i++) {
+    report_event(pipeline, pipeline->events[i], pipeline->event_phases[i]);
+    clReleaseEvent(pipeline->events[i]);
+  }
+  pipeline->event_count = 0;
+}
+
+static void run_kernel(CL_Pipeline* pipeline, cl_kernel kernel, size_t size, size_t frames, const char* name) {
+  size_t global_size[2] = {size, frames};
+  cl_int err = clEnqueueNDRangeKernel(pipeline->queue, kernel, 2, NULL, global_size, NULL, 0, NULL,
+                                      profile_event(pipeline, PHASE_CL_KERNEL));
+  CHECK_CL_ERROR(err, name);
+}
+
+// Transforms `frames` frames of m values from `in` into `out`; `in` is
+// clobbered. sign = -1 forward, +1 inverse (unscaled).
+static void enqueue_fft(CL_Pipeline* pipeline, cl_mem in, cl_mem out, int frames, double sign) {
+  CL_Kernels* kernels = &pipeline->kernels;
+  cl_int err;
+
+  if (pipeline->local_fft) {
+    size_t local_bytes = pipeline->m * 2 * real_size(pipeline);
+    err = clSetKernelArg(kernels->fft_local, 0, sizeof(cl_mem), &in);
+    err |= clSetKernelArg(kernels->fft_local, 1, sizeof(cl_mem), &out);
+    err |= clSetKernelArg(kernels->fft_local, 2, sizeof(cl_mem), &pipeline->twiddles);
+    err |= clSetKernelArg(kernels->fft_local, 3, sizeof(int), &pipeline->m);
+    err |= clSetKernelArg(kernels->fft_local, 4, sizeof(int), &pipeline->log2m);
+    err |= set_real_arg(pipeline, kernels->fft_local, 5, sign);
+    err |= clSetKernelArg(kernels->fft_local, 6, local_bytes, NULL);
+    err |= clSetKernelArg(kernels->fft_local, 7, local_bytes, NULL);
+    CHECK_CL_ERROR(err, "clSetKernelArg fft_local");
+
+    size_t global_size[2] = {pipeline->group_size, frames};
+    size_t local_size[2] = {pipeline->group_size, 1};
+    err = clEnqueueNDRangeKernel(pipeline->queue, kernels->fft_local, 2, NULL, global_size, local_size, 0, NULL,
+                                 profile_event(pipeline, PHASE_CL_KERNEL));
+    CHECK_CL_ERROR(err, "clEnqueueNDRangeKernel fft_local");
+    return;
+  }
+
+  // Ping-pong between the two buffers; an even number of stages ends in `in`.
+  cl_mem src = in;
+  cl_mem dst = out;
+  for (int t = 0; t < pipeline->log2m; t++) {
+    err = clSetKernelArg(kernels->fft_global_stage, 0, sizeof(cl_mem), &src);
+    err |= clSetKernelArg(kernels->fft_global_stage, 1, sizeof(cl_mem), &dst);
+    err |= clSetKernelArg(kernels->fft_global_stage, 2, sizeof(cl_mem), &pipeline->twiddles);
+    err |= clSetKernelArg(kernels->fft_global_stage, 3, sizeof(int), &pipeline->m);
+    err |= clSetKernelArg(kernels->fft_global_stage, 4, sizeof(int), &t);
+    err |= set_real_arg(pipeline, kernels->fft_global_stage, 5, sign);
+    CHECK_CL_ERROR(err, "clSetKernelArg fft_global_stage");
+    run_kernel(pipeline, kernels->fft_global_stage, pipeline->m / 2, frames, "clEnqueueNDRangeKernel fft_global_stage");
+    cl_mem swap = src;
+    src = dst;
+    dst = swap;
+  }
+  if (src != out) {
+    err = clEnqueueCopyBuffer(pipeline->queue, src, out, 0, 0, (size_t)frames * pipeline->m * 2 * real_size(pipeline), 0, NULL,
+                              profile_event(pipeline, PHASE_CL_KERNEL));
+    CHECK_CL_ERROR(err, "clEnqueueCopyBuffer fft");
+  }
+}
+
+// Chirp exp(-i*pi*k^2/n) and the FFT of its conjugate, zero padded to m.
+// The tables are computed in double and only then narrowed.
+static void create_bluestein_tables(CL_Pipeline* pipeline) {
+  int n = pipeline->blocksize;
+  int m = pipeline->m;
+  cl_int err;
+
+  // k^2 mod 2n keeps the angle exact for large k.
+  cl_double2* chirp = malloc(n * sizeof(cl_double2));
+  cl_double2* b = calloc(m, sizeof(cl_double2));
+  for (int k = 0; k < n; k++) {
+    double angle = -PI * (double)(((long)k * k) % (2L * n)) / n;
+    chirp[k].x = cos(angle);
+    chirp[k].y = sin(angle);
+    b[k].x = chirp[k].x;
+    b[k].y = -chirp[k].y;
+    if (k > 0) {
+      b[m - k] = b[k];
+    }
+  }
+
+  pipeline->chirp = create_real_buffer(pipeline, (const double*)chirp, 2L * n, "clCreateBuffer chirp");
+  pipeline->chirp_fft = clCreateBuffer(pipeline->context, CL_MEM_READ_WRITE, m * 2 * real_size(pipeline), NULL, &err);
+  CHECK_CL_ERROR(err, "clCreateBuffer chirp_fft");
+
+  void* data = malloc(m * 2 * real_size(pipeline));
+  to_device_reals(pipeline, (const double*)b, 2L * m, data);
+  err = clEnqueueWriteBuffer(pipeline->queue, pipeline->work, CL_TRUE, 0, m * 2 * real_size(pipeline), data, 0, NULL, NULL);
+  CHECK_CL_ERROR(err, "clEnqueueWriteBuffer chirp");
+  enqueue_fft(pipeline, pipeline->work, pipeline->chirp_fft, 1, -1.0);
+  err = clFinish(pipeline->queue);
+  CHECK_CL_ERROR(err, "clFinish");
+
+  free(data);
+  free(chirp);
+  free(b);
+}
+
+CL_Pipeline* create_cl_pipeline(const char* kernel_path, cl_device_type preferred,
+                                int blocksize, int shift, const double* window, Precision precision) {
+  cl_int err;
+  CL_Pipeline* pipeline = calloc(1, sizeof(CL_Pipeline));
+  pipeline->precision = precision;
+  pipeline->blocksize = blocksize;
+  pipeline->shift = shift;
+  pipeline->bins_size = blocksize / 2;
+  pipeline->bluestein = (blocksize & (blocksize - 1)) != 0;
+  pipeline->m = 1;
+  while (pipeline->m < (pipeline->bluestein ? 2 * blocksize - 1 : blocksize)) {
+    pipeline->m *= 2;
+    pipeline->log2m++;
+  }
+
+  if (!find_device(preferred, &pipeline->device) && !find_device(CL_DEVICE_TYPE_ALL, &pipeline->device)) {
+    fprintf(stderr, "No OpenCL device found\n");
+    free(pipeline);
+    return NULL;
+  }
+  clGetDeviceInfo(pipeline->device, CL_DEVICE_NAME, sizeof(pipeline->device_name), pipeline->device_name, NULL);
+
+  char extensions[4096] = "";
+  clGetDeviceInfo(pipeline->device, CL_DEVICE_EXTENSIONS, sizeof(extensions), extensions, NULL);
+  if (precision == PRECISION_DOUBLE && !strstr(extensions, "cl_khr_fp64")) {
+    fprintf(stderr, "%s has no fp64 support; use single precision\n", pipeline->device_name);
+    free(pipeline);
+    return NULL;
+  }
+
+  pipeline->context = clCreateContext(NULL, 1, &pipeline->device, NULL, NULL, &err);
+  CHECK_CL_ERROR(err, "clCreateContext");
+
+  pipeline->profiling = profiler_active;
+  cl_queue_properties properties[] = {CL_QUEUE_PROPERTIES, pipeline->profiling ? CL_QUEUE_PROFILING_ENABLE : 0, 0};
+  pipeline->queue = clCreateCommandQueueWithProperties(pipeline->context, pipeline->device, properties, &err);
+  CHECK_CL_ERROR(err, "clCreateCommandQueueWithProperties");
+
+  // Load and compile the kernels
+  char* source = read_kernel_source(kernel_path);
+  if (!source) {
+    fprintf(stderr, "Error reading kernel source\n");
+    exit(EXIT_FAILURE);
+  }
+  pipeline->program = clCreateProgramWithSource(pipeline->context, 1, (const char**)&source, NULL, &err);
+  CHECK_CL_ERROR(err, "clCreateProgramWithSource");
+  free(source);
+
+  const char* options = precision == PRECISION_SINGLE ? "-DSINGLE" : NULL;
+  long long start = profile_begin();
+  err = clBuildProgram(pipeline->program, 1, &pipeline->device, options, NULL, NULL);
+  profile_end(PHASE_PLAN, start);
+  if (err != CL_SUCCESS) {
+    size_t log_size;
+    clGetProgramBuildInfo(pipeline->program, pipeline->device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+    char* log = malloc(log_size + 1);
+    clGetProgramBuildInfo(pipeline->program, pipeline->device, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
+    log[log_size] = '\0';
+    fprintf(stderr, "clBuildProgram failed:\n%s\n", log);
+    free(log);
+    exit(EXIT_FAILURE);
+  }
+
+  CL_Kernels* kernels = &pipeline->kernels;
+  kernels->load_frames = create_kernel(pipeline->program, "load_frames");
+  kernels->fft_local = create_kernel(pipeline->program, "fft_local");
+  kernels->fft_global_stage = create_kernel(pipeline->program, "fft_global_stage");
+  kernels->pointwise_multiply = create_kernel(pipeline->program, "pointwise_multiply");
+  kernels->chirp_postmultiply = create_kernel(pipeline->program, "chirp_postmultiply");
+  kernels->accumulate_magnitude = create_kernel(pipeline->program, "accumulate_magnitude");
+
+  // A frame and its ping-pong copy have to fit into local memory for the
+  // single-launch kernel.
+  cl_ulong local_mem = 0;
+  size_t group_size = 0;
+  clGetDeviceInfo(pipeline->device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_mem), &local_mem, NULL);
+  clGetKernelWorkGroupInfo(kernels->fft_local, pipeline->device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(group_size), &group_size, NULL);
+  long frame_bytes = (long)pipeline->m * 2 * real_size(pipeline);
+  pipeline->local_fft = 2 * frame_bytes <= (long)local_mem && group_size > 0;
+  pipeline->group_size = MIN(MIN((size_t)pipeline->m / 2, group_size), CL_PIPELINE_MAX_GROUP);
+
+  // Size the batch by the memory budget and the device's allocation limit.
+  cl_ulong max_alloc = 0;
+  clGetDeviceInfo(pipeline->device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL);
+  long budget = max_alloc ? MIN(CL_PIPELINE_BYTES, (long)max_alloc) : CL_PIPELINE_BYTES;
+  pipeline->frames = MAX(MIN(CL_PIPELINE_MAX_FRAMES, budget / frame_bytes), 1);
+  pipeline->chunk_samples = (long)(pipeline->frames - 1) * shift + blocksize;
+
+  pipeline->work = clCreateBuffer(pipeline->context, CL_MEM_READ_WRITE, pipeline->frames * frame_bytes, NULL, &err);
+  CHECK_CL_ERROR(err, "clCreateBuffer work");
+  pipeline->spectrum = clCreateBuffer(pipeline->context, CL_MEM_READ_WRITE, pipeline->frames * frame_bytes, NULL, &err);
+  CHECK_CL_ERROR(err, "clCreateBuffer spectrum");
+  // Single precision sums are (sum, compensation) float pairs.
+  size_t sum_size = precision == PRECISION_SINGLE ? sizeof(cl_float2) : sizeof(cl_double);
+  pipeline->bins = clCreateBuffer(pipeline->context, CL_MEM_READ_WRITE, pipeline->bins_size * sum_size, NULL, &err);
+  CHECK_CL_ERROR(err, "clCreateBuffer bins");
+
+  for (int slot = 0; slot < 2; slot++) {
+    size_t bytes = pipeline->chunk_samples * real_size(pipeline);
+    pipeline->samples[slot] = clCreateBuffer(pipeline->context, CL_MEM_READ_ONLY, bytes, NULL, &err);
+    CHECK_CL_ERROR(err, "clCreateBuffer samples");
+    pipeline->staging[slot] = clCreateBuffer(pipeline->context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bytes, NULL, &err);
+    CHECK_CL_ERROR(err, "clCreateBuffer staging");
+    pipeline->staging_ptr[slot] = clEnqueueMapBuffer(pipeline->queue, pipeline->staging[slot], CL_TRUE, CL_MAP_WRITE,
+                                                     0, bytes, 0, NULL, NULL, &err);
+    CHECK_CL_ERROR(err, "clEnqueueMapBuffer staging");
+  }
+  if (precision == PRECISION_SINGLE) {
+    pipeline->decoded = malloc(pipeline->chunk_samples * sizeof(double));
+  }
+
+  cl_double2* twiddles = malloc(pipeline->m / 2 * sizeof(cl_double2));
+  for (int k = 0; k < pipeline->m / 2; k++) {
+    double angle = -2 * PI * k / pipeline->m;
+    twiddles[k].x = cos(angle);
+    twiddles[k].y = sin(angle);
+  }
+  pipeline->twiddles = create_real_buffer(pipeline, (const double*)twiddles, pipeline->m, "clCreateBuffer twiddles");
+  free(twiddles);
+
+  double* coefficients = malloc(blocksize * sizeof(double));
+  for (int i = 0; i < blocksize; i++) {
+    coefficients[i] = window ? window[i] : 1.0;
+  }
+  pipeline->window = create_real_buffer(pipeline, coefficients, blocksize, "clCreateBuffer window");
+  free(coefficients);
+
+  if (pipeline->bluestein) {
+    create_bluestein_tables(pipeline);
+  } else {
+    // load_frames still takes a chirp argument; any buffer will do.
+    pipeline->chirp = pipeline->window;
+    clRetainMemObject(pipeline->chirp);
+  }
+
+  return pipeline;
+}
+
+void destroy_cl_pipeline(CL_Pipeline* pipeline) {
+  for (int slot = 0; slot < 2; slot++) {
+    clEnqueueUnmapMemObject(pipeline->queue, pipeline->staging[slot], pipeline->staging_ptr[slot], 0, NULL, NULL);
+    clReleaseMemObject(pipeline->staging[slot]);
+    clReleaseMemObject(pipeline->samples[slot]);
+  }
+  clFinish(pipeline->queue);
+  report_events(pipeline);
+  free(pipeline->events);
+  free(pipeline->event_phases);
+  clReleaseMemObject(pipeline->window);
+  clReleaseMemObject(pipeline->twiddles);
+  clReleaseMemObject(pipeline->chirp);
+  if (pipeline->bluestein) {
+    clReleaseMemObject(pipeline->chirp_fft);
+  }
+  clReleaseMemObject(pipeline->work);
+  clReleaseMemObject(pipeline->spectrum);
+  clReleaseMemObject(pipeline->bins);
+
+  CL_Kernels* kernels = &pipeline->kernels;
+  clReleaseKernel(kernels->load_frames);
+  clReleaseKernel(kernels->fft_local);
+  clReleaseKernel(kernels->fft_global_stage);
+  clReleaseKernel(kernels->pointwise_multiply);
+  clReleaseKernel(kernels->chirp_postmultiply);
+  clReleaseKernel(kernels->accumulate_magnitude);
+  clReleaseProgram(pipeline->program);
+  clReleaseCommandQueue(pipeline->queue);
+  clReleaseContext(pipeline->context);
+  free(pipeline->decoded);
+  free(pipeline);
+}
+
+// Window, transform and accumulate `frames` frames of one uploaded chunk.
+static void enqueue_chunk(CL_Pipeline* pipeline, cl_mem samples, int frames) {
+  CL_Kernels* kernels = &pipeline->kernels;
+  cl_int err;
+
+  err = clSetKernelArg(kernels->load_frames, 0, sizeof(cl_mem), &samples);
+  err |= clSetKernelArg(kernels->load_frames, 1, sizeof(cl_mem), &pipeline->window);
+  err |= clSetKernelArg(kernels->load_frames, 2, sizeof(cl_mem), &pipeline->chirp);
+  err |= clSetKernelArg(kernels->load_frames, 3, sizeof(cl_mem), &pipeline->work);
+  err |= clSetKernelArg(kernels->load_frames, 4, sizeof(int), &pipeline->blocksize);
+  err |= clSetKernelArg(kernels->load_frames, 5, sizeof(int), &pipeline->m);
+  err |= clSetKernelArg(kernels->load_frames, 6, sizeof(int), &pipeline->shift);
+  err |= clSetKernelArg(kernels->load_frames, 7, sizeof(int), &pipeline->bluestein);
+  CHECK_CL_ERROR(err, "clSetKernelArg load_frames");
+  run_kernel(pipeline, kernels->load_frames, pipeline->m, frames, "clEnqueueNDRangeKernel load_frames");
+
+  enqueue_fft(pipeline, pipeline->work, pipeline->spectrum, frames, -1.0);
+
+  if (pipeline->bluestein) {
+    err = clSetKernelArg(kernels->pointwise_multiply, 0, sizeof(cl_mem), &pipeline->spectrum);
+    err |= clSetKernelArg(kernels->pointwise_multiply, 1, sizeof(cl_mem), &pipeline->chirp_fft);
+    err |= clSetKernelArg(kernels->pointwise_multiply, 2, sizeof(int), &pipeline->m);
+    err |= set_real_arg(pipeline, kernels->pointwise_multiply, 3, 1.0 / pipeline->m);
+    CHECK_CL_ERROR(err, "clSetKernelArg pointwise_multiply");
+    run_kernel(pipeline, kernels->pointwise_multiply, pipeline->m, frames, "clEnqueueNDRangeKernel pointwise_multiply");
+
+    enqueue_fft(pipeline, pipeline->spectrum, pipeline->work, frames, 1.0);
+
+    err = clSetKernelArg(kernels->chirp_postmultiply, 0, sizeof(cl_mem), &pipeline->work);
+    err |= clSetKernelArg(kernels->chirp_postmultiply, 1, sizeof(cl_mem), &pipeline->chirp);
+    err |= clSetKernelArg(kernels->chirp_postmultiply, 2, sizeof(cl_mem), &pipeline->spectrum);
+    err |= clSetKernelArg(kernels->chirp_postmultiply, 3, sizeof(int), &pipeline->blocksize);
+    err |= clSetKernelArg(kernels->chirp_postmultiply, 4, sizeof(int), &pipeline->m);
+    CHECK_CL_ERROR(err, "clSetKernelArg chirp_postmultiply");
+    run_kernel(pipeline, kernels->chirp_postmultiply, pipeline->blocksize, frames, "clEnqueueNDRangeKernel chirp_postmultiply");
+  }
+
+  err = clSetKernelArg(kernels->accumulate_magnitude, 0, sizeof(cl_mem), &pipeline->spectrum);
+  err |= clSetKernelArg(kernels->accumulate_magnitude, 1, sizeof(cl_mem), &pipeline->bins);
+  err |= clSetKernelArg(kernels->accumulate_magnitude, 2, sizeof(int), &pipeline->bins_size);
+  err |= clSetKernelArg(kernels->accumulate_magnitude, 3, sizeof(int), &pipeline->m);
+  err |= clSetKernelArg(kernels->accumulate_magnitude, 4, sizeof(int), &frames);
+  CHECK_CL_ERROR(err, "clSetKernelArg accumulate_magnitude");
+  run_kernel(pipeline, kernels->accumulate_magnitude, pipeline->bins_size, 1, "clEnqueueNDRangeKernel accumulate_magnitude");
+}
+
+long cl_pipeline_accumulate(CL_Pipeline* pipeline, const WAV_Reader* reader, double* bins) {
+  cl_int err;
+  long windows = 0;
+  if (reader->samples >= pipeline->blocksize) {
+    windows = (reader->samples - pipeline->blocksize) / pipeline->shift + 1;
+  }
+
+  // Both sum layouts are 8 bytes per bin, all zero bits.
+  cl_double zero = 0;
+  err = clEnqueueFillBuffer(pipeline->queue, pipeline->bins, &zero, sizeof(zero), 0,
+                            pipeline->bins_size * sizeof(zero), 0, NULL, NULL);
+  CHECK_CL_ERROR(err, "clEnqueueFillBuffer bins");
+
+  // The queue is in order, so the upload into a slot never overtakes the
+  // kernels still reading it; the host only has to wait before reusing the
+  // slot's staging buffer.
+  cl_event uploaded[2] = {NULL, NULL};
+  int slot = 0;
+  for (long first = 0; first < windows; first += pipeline->frames, slot ^= 1) {
+    int frames = (int)MIN(pipeline->frames, windows - first);
+    long length = (long)(frames - 1) * pipeline->shift + pipeline->blocksize;
+
+    if (uploaded[slot]) {
+      long long start = profile_begin();
+      clWaitForEvents(1, &uploaded[slot]);
+      profile_end(PHASE_WAIT, start);
+      if (pipeline->profiling) {
+        report_event(pipeline, uploaded[slot], PHASE_CL_UPLOAD);
+      }
+      clReleaseEvent(uploaded[slot]);
+    }
+    if (pipeline->event_count >= CL_PROFILE_MAX_EVENTS) {
+      report_events(pipeline);
+    }
+    if (pipeline->precision == PRECISION_SINGLE) {
+      wav_reader_read(reader, first * pipeline->shift, length, pipeline->decoded);
+      to_device_reals(pipeline, pipeline->decoded, length, pipeline->staging_ptr[slot]);
+    } else {
+      wav_reader_read(reader, first * pipeline->shift, length, pipeline->staging_ptr[slot]);
+    }
+    err = clEnqueueWriteBuffer(pipeline->queue, pipeline->samples[slot], CL_FALSE, 0, length * real_size(pipeline),
+                               pipeline->staging_ptr[slot], 0, NULL, &uploaded[slot]);
+    CHECK_CL_ERROR(err, "clEnqueueWriteBuffer samples");
+
+    enqueue_chunk(pipeline, pipeline->samples[slot], frames);
+    clFlush(pipeline->queue);
+  }
+
+  // The blocking read below also waits for all kernels.
+  long long start = profile_begin();
+
+  if (pipeline->precision == PRECISION_SINGLE) {
+    cl_float2* sums = malloc(pipeline->bins_size * sizeof(cl_float2));
+    err = clEnqueueReadBuffer(pipeline->queue, pipeline->bins, CL_TRUE, 0, pipeline->bins_size * sizeof(cl_float2), sums, 0, NULL,
+                              profile_event(pipeline, PHASE_CL_DOWNLOAD));
+    CHECK_CL_ERROR(err, "clEnqueueReadBuffer bins");
+    profile_end(PHASE_WAIT, start);
+    for (int i = 0; i < pipeline->bins_size; i++) {
+      bins[i] += (double)sums[i].x - (double)sums[i].y;
+    }
+    free(sums);
+  } else {
+    double* sums = malloc(pipeline->bins_size * sizeof(double));
+    err = clEnqueueReadBuffer(pipeline->queue, pipeline->bins, CL_TRUE, 0, pipeline->bins_size * sizeof(double), sums, 0, NULL,
+                              profile_event(pipeline, PHASE_CL_DOWNLOAD));
+    CHECK_CL_ERROR(err, "clEnqueueReadBuffer bins");
+    profile_end(PHASE_WAIT, start);
+    for (int i = 0; i < pipeline->bins_size; i++) {
+      bins[i] += sums[i];
+    }
+    free(sums);
+  }
+
+  for (int i = 0; i < 2; i++) {
+    if (uploaded[i]) {
+      if (pipeline->profiling) {
+        report_event(pipeline, uploaded[i], PHASE_CL_UPLOAD);
+      }
+      clReleaseEvent(uploaded[i]);
+    }
+  }
+  report_events(pipeline);
+  return windows;
+}
@@ -0,0 +1,94 @@
+#ifndef CL_PIPELINE_H
+#define CL_PIPELINE_H
+
+#define CL_TARGET_OPENCL_VERSION 300
+#include "CL/cl.h"
+#include "wav_reader.h"
+#include "precision.h"
+#include "profiler.h"
+
+// Batched OpenCL analysis: the selected channel is decoded into pinned
+// staging buffers and uploaded in large chunks (double buffered, so decoding
+// the next chunk overlaps the device work on the current one). Per chunk,
+// windowing, the FFT of every frame and the magnitude accumulation run as a
+// handful of NDRange launches over all frames; only the final bins are read
+// back.
+//
+// The transforms are radix-2 Stockham FFTs with a precomputed twiddle table.
+// When a frame fits into local memory, one work-group transforms one frame
+// with all stages in a single launch; larger frames fall back to one global
+// memory launch per stage. Powers of two are transformed directly, other
+// sizes with Bluestein on the power of two m >= 2n - 1.
+//
+// PRECISION_SINGLE builds the kernels with -DSINGLE: everything on the device
+// is float (no fp64 needed, half the transfer volume) and the bins are
+// Kahan-compensated float sums that the host combines in double.
+//
+// If the profiler is running when the pipeline is created, the queue is
+// created with CL_QUEUE_PROFILING_ENABLE and every command keeps its event;
+// their device start/end times are reported as the PHASE_CL_* phases once
+// the commands have completed.
+
+typedef struct {
+  cl_kernel load_frames;
+  cl_kernel fft_local;
+  cl_kernel fft_global_stage;
+  cl_kernel pointwise_multiply;
+  cl_kernel chirp_postmultiply;
+  cl_kernel accumulate_magnitude;
+} CL_Kernels;
+
+typedef struct {
+  cl_device_id device;
+  cl_context context;
+  cl_command_queue queue;
+  cl_program program;
+  CL_Kernels kernels;
+  char device_name[256];
+  Precision precision;
+
+  int blocksize;
+  int shift;
+  int bins_size;
+  int m;              // radix-2 size (blocksize, or Bluestein padding)
+  int log2m;
+  int bluestein;
+  int local_fft;      // frames fit into local memory
+  size_t group_size;  // work-items per frame for fft_local
+  int frames;         // windows per chunk
+  long chunk_samples; // (frames - 1) * shift + blocksize
+
+  cl_mem window;      // blocksize window coefficients
+  cl_mem twiddles;    // exp(-2*pi*i*k/m), k < m/2
+  cl_mem chirp;       // Bluestein only: blocksize values
+  cl_mem chirp_fft;   // Bluestein only: FFT of the conjugate chirp, m values
+  cl_mem samples[2];  // device copies of the two chunk slots
+  cl_mem staging[2];  // pinned host buffers the slots are uploaded from
+  void* staging_ptr[2]; // doubles, or floats in single precision
+  double* decoded;    // single precision only: samples before narrowing
+  cl_mem work;        // frames * m
+  cl_mem spectrum;    // frames * m
+  cl_mem bins;        // bins_size running sums (float2 pairs in single precision)
+
+  int profiling;      // see above
+  cl_event* events;   // enqueued, not reported yet
+  Profile_Phase* event_phases;
+  int event_count;
+  int event_capacity;
+  long long clock_offset; // device clock to profiler_now, set by the first report
+} CL_Pipeline;
+
+// Picks a device of `preferred` type (e.g. CL_DEVICE_TYPE_GPU) on any
+// platform, falling back to any device at all, e.g. PoCL on the CPU.
+// `window` points to blocksize coefficients, or NULL for a rectangular window.
+// Returns NULL if no device is found, or for PRECISION_DOUBLE if the device
+// lacks cl_khr_fp64.
+CL_Pipeline* create_cl_pipeline(const char* kernel_path, cl_device_type preferred,
+                                int blocksize, int shift, const double* window, Precision precision);
+void destroy_cl_pipeline(CL_Pipeline* pipeline);
+
+// Adds |X| of the first blocksize/2 bins of every window of the reader to
+// `bins` and returns the number of windows.
+long cl_pipeline_accumulate(CL_Pipeline* pipeline, const WAV_Reader* reader, double* bins);
+
+#endif
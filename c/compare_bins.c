@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+// Compares the "<freq>Hz <dB>" lines of two analyzer outputs bin by bin,
+// e.g. aufgabe04 --no-window against aufgabe01 with a threshold low enough
+// that every bin is printed.
+//
+// Usage: compare_bins <reference> <candidate> [tolerance_db]
+//
+// Exits with 1 if a bin is missing on either side or differs by more than the
+// tolerance (default 1e-6 dB).
+
+#define DEFAULT_TOLERANCE 1e-6
+
+typedef struct {
+  int* freq;
+  double* value;
+  int count;
+} Bin_List;
+
+Bin_List* read_bins(const char* filename) {
+  FILE* file = fopen(filename, "r");
+  if (!file) {
+    perror("Error opening file");
+    return NULL;
+  }
+
+  Bin_List* list = calloc(1, sizeof(Bin_List));
+  int capacity = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    int freq;
+    double value;
+    if (sscanf(line, "%dHz %lf", &freq, &value) != 2) {
+      continue;
+    }
+    if (list->count == capacity) {
+      capacity = capacity ? 2 * capacity : 1024;
+      list->freq = realloc(list->freq, capacity * sizeof(int));
+      list->value = realloc(list->value, capacity * sizeof(double));
+    }
+    list->freq[list->count] = freq;
+    list->value[list->count] = value;
+    list->count++;
+  }
+
+  fclose(file);
+  return list;
+}
+
+void destroy_bins(Bin_List* list) {
+  free(list->freq);
+  free(list->value);
+  free(list);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 3 || argc > 4) {
+    fprintf(stderr, "Usage: %s <reference> <candidate> [tolerance_db]\n", argv[0]);
+    return 2;
+  }
+  double tolerance = argc == 4 ? atof(argv[3]) : DEFAULT_TOLERANCE;
+
+  Bin_List* reference = read_bins(argv[1]);
+  Bin_List* candidate = read_bins(argv[2]);
+  if (!reference || !candidate) {
+    return 2;
+  }
+
+  // Both lists are in ascending frequency order.
+  int missing = 0;
+  int mismatches = 0;
+  int compared = 0;
+  double max_diff = 0;
+  int max_freq = 0;
+  int i = 0;
+  int j = 0;
+  while (i < reference->count || j < candidate->count) {
+    if (j == candidate->count || (i < reference->count && reference->freq[i] < candidate->freq[j])) {
+      fprintf(stderr, "%dHz missing in %s\n", reference->freq[i], argv[2]);
+      missing++;
+      i++;
+    } else if (i == reference->count || candidate->freq[j] < reference->freq[i]) {
+      fprintf(stderr, "%dHz missing in %s\n", candidate->freq[j], argv[1]);
+      missing++;
+      j++;
+    } else {
+      double diff = fabs(reference->value[i] - candidate->value[j]);
+      if (!(diff <= tolerance)) {
+        mismatches++;
+      }
+      if (diff > max_diff || isnan(diff)) {
+        max_diff = diff;
+        max_freq = reference->freq[i];
+      }
+      compared++;
+      i++;
+      j++;
+    }
+  }
+
+  printf("Compared %d bins: max difference %g dB at %dHz, %d above %g dB, %d missing\n",
+         compared, max_diff, max_freq, mismatches, tolerance, missing);
+
+  destroy_bins(reference);
+  destroy_bins(candidate);
+  return mismatches || missing || compared == 0;
+}
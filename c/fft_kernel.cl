@@ -1,34 +1,159 @@
+// Built with -DSINGLE for the single precision mode, which needs no fp64
+// support on the device: samples, tables and spectra are float, and only the
+// bin sums keep (compensated) double accuracy.
+#ifdef SINGLE
+typedef float real;
+typedef float2 real2;
+typedef float2 bin_sum;   // Kahan sum and compensation
+#else
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+typedef double real;
+typedef double2 real2;
+typedef double bin_sum;
+#endif
+
 #define PI 3.14159265358979323846
 
-__kernel void fft(__global double2 *a, int n, int step) {
-    int gid = get_global_id(0);
-    int butterfly_size = 2 * step;
-    
-    if (gid < n / 2) {
-        int i = gid % step + (gid / step) * butterfly_size;
-        int j = i + step;
-        
-        double angle = -2.0 * PI * gid / n;
-        double2 twiddle = (double2)(cos(angle), sin(angle));
-        
-        double2 temp = a[j];
-        a[j] = a[i] - (double2)(twiddle.x * temp.x - twiddle.y * temp.y,
-                                twiddle.x * temp.y + twiddle.y * temp.x);
-        a[i] += (double2)(twiddle.x * temp.x - twiddle.y * temp.y,
-                          twiddle.x * temp.y + twiddle.y * temp.x);
+// All transform kernels work on a batch of frames at once: dimension 0
+// indexes the element inside a frame, dimension 1 the frame. Frame f of a
+// work buffer starts at f * m, where m is the power of two the radix-2
+// stages run on.
+
+real2 cmul(real2 a, real2 b) {
+    return (real2)(a.x * b.x - a.y * b.y, a.x * b.y + a.y * b.x);
+}
+
+// Cuts frame f out of the uploaded samples (hop `shift`), applies the window
+// and, for Bluestein, the chirp; zero pads to m.
+__kernel void load_frames(__global const real *samples, __global const real *window,
+                          __global const real2 *chirp, __global real2 *a,
+                          int n, int m, int shift, int bluestein) {
+    int k = get_global_id(0);
+    int f = get_global_id(1);
+    if (k >= m) {
+        return;
+    }
+    real2 v = (real2)(0, 0);
+    if (k < n) {
+        v.x = samples[(long)f * shift + k] * window[k];
+        if (bluestein) {
+            v = v.x * chirp[k];
+        }
+    }
+    a[(long)f * m + k] = v;
+}
+
+// Radix-2 Stockham (autosort) FFT: every stage reads one buffer and writes
+// the other in an order that leaves the result in natural order, so no bit
+// reversal pass is needed. Stage t (span s = 2^t) computes, for each of the
+// m/2 butterflies b = p * s + q:
+//
+//   y[q + s*2p]     = x[q + s*p] + x[q + s*(p + h)]
+//   y[q + s*(2p+1)] = (x[q + s*p] - x[q + s*(p + h)]) * w^(p*s)
+//
+// with h = m / (2s) and w^k = twiddles[k] = exp(-2*pi*i*k/m) (conjugated for
+// the inverse, sign = +1).
+void stockham_butterfly(real2 a, real2 b, real2 w, real sign,
+                        real2 *even, real2 *odd) {
+    w.y *= -sign;
+    *even = a + b;
+    *odd = cmul(a - b, w);
+}
+
+// One work-group per frame: the frame is loaded into local memory once and
+// all log2(m) stages run there, ping-ponging between two local buffers.
+// Needs 2 * m * sizeof(real2) bytes of local memory.
+__kernel void fft_local(__global const real2 *src, __global real2 *dst,
+                        __global const real2 *twiddles, int m, int log2m, real sign,
+                        __local real2 *x, __local real2 *y) {
+    int lid = get_local_id(0);
+    int size = get_local_size(0);
+    long base = (long)get_group_id(1) * m;
+
+    for (int k = lid; k < m; k += size) {
+        x[k] = src[base + k];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    int half = m / 2;
+    for (int t = 0; t < log2m; t++) {
+        int s = 1 << t;
+        int h = half >> t;
+        for (int b = lid; b < half; b += size) {
+            int p = b >> t;
+            int q = b & (s - 1);
+            real2 even, odd;
+            stockham_butterfly(x[q + s * p], x[q + s * (p + h)], twiddles[p * s], sign, &even, &odd);
+            y[q + s * 2 * p] = even;
+            y[q + s * (2 * p + 1)] = odd;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        __local real2 *swap = x;
+        x = y;
+        y = swap;
+    }
+
+    for (int k = lid; k < m; k += size) {
+        dst[base + k] = x[k];
     }
 }
 
-__kernel void compute_magnitude_squared(__global double2 *input, __global double *output, int n) {
-    int gid = get_global_id(0);
-    if (gid < n) {
-        output[gid] = input[gid].x * input[gid].x + input[gid].y * input[gid].y;
+// Fallback for frames too large for local memory: one launch per stage,
+// reading src and writing dst in global memory.
+__kernel void fft_global_stage(__global const real2 *src, __global real2 *dst,
+                               __global const real2 *twiddles, int m, int t, real sign) {
+    int b = get_global_id(0);
+    long base = (long)get_global_id(1) * m;
+    if (b < m / 2) {
+        int s = 1 << t;
+        int h = (m / 2) >> t;
+        int p = b >> t;
+        int q = b & (s - 1);
+        real2 even, odd;
+        stockham_butterfly(src[base + q + s * p], src[base + q + s * (p + h)], twiddles[p * s], sign, &even, &odd);
+        dst[base + q + s * 2 * p] = even;
+        dst[base + q + s * (2 * p + 1)] = odd;
     }
 }
 
-__kernel void compute_db(__global double *input, __global double *output, int n) {
-    int gid = get_global_id(0);
-    if (gid < n) {
-        output[gid] = 10 * log10(input[gid] + 1e-9);
+// Bluestein: a[k] *= b[k] * scale, with b shared by all frames.
+__kernel void pointwise_multiply(__global real2 *a, __global const real2 *b, int m, real scale) {
+    int k = get_global_id(0);
+    long base = (long)get_global_id(1) * m;
+    if (k < m) {
+        a[base + k] = cmul(a[base + k], b[k]) * scale;
     }
-}
\ No newline at end of file
+}
+
+// Bluestein: X[k] = chirp[k] * conv[k]
+__kernel void chirp_postmultiply(__global const real2 *conv, __global const real2 *chirp,
+                                 __global real2 *out, int n, int m) {
+    int k = get_global_id(0);
+    long base = (long)get_global_id(1) * m;
+    if (k < n) {
+        out[base + k] = cmul(conv[base + k], chirp[k]);
+    }
+}
+
+// One work-item per bin adds |X[k]| of every frame in the batch, in frame
+// order, so the sum does not depend on scheduling.
+__kernel void accumulate_magnitude(__global const real2 *spectrum, __global bin_sum *bins,
+                                   int bins_size, int m, int frames) {
+    int k = get_global_id(0);
+    if (k < bins_size) {
+        bin_sum sum = bins[k];
+        for (int f = 0; f < frames; f++) {
+            real2 v = spectrum[(long)f * m + k];
+            real magnitude = sqrt(v.x * v.x + v.y * v.y);
+#ifdef SINGLE
+            float y = magnitude - sum.y;
+            float t = sum.x + y;
+            sum.y = (t - sum.x) - y;
+            sum.x = t;
+#else
+            sum += magnitude;
+#endif
+        }
+        bins[k] = sum;
+    }
+}
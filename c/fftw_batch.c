@@ -0,0 +1,334 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "fftw_batch.h"
+#include "profiler.h"
+
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+// Keep the batch output around 1 MB so it stays cache resident between the
+// FFT and the magnitude pass.
+#define FFTW_BATCH_BYTES (1 << 20)
+#define FFTW_BATCH_MAX 512
+
+// Plans depend only on the transform shape, so they are made once per
+// (blocksize, shift, howmany, flags, precision, windowed) and shared by every engine, including
+// the per-thread engines of aufgabe03_omp. Engines run them through the
+// new-array interface on their own fftw_malloc'ed (equally aligned) buffers.
+typedef struct Plan_Entry {
+  int blocksize;
+  int shift;
+  int howmany;
+  unsigned flags;
+  Precision precision;
+  int windowed;            // rows of `frames` instead of the overlapping span
+  fftw_plan plan;          // PRECISION_DOUBLE
+  fftwf_plan plan_f;       // PRECISION_SINGLE
+  struct Plan_Entry* next;
+} Plan_Entry;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static Plan_Entry* cache = NULL;
+
+static Plan_Entry* cached_plan(FFTW_Batch* engine, int howmany, unsigned flags) {
+  pthread_mutex_lock(&cache_lock);
+  for (Plan_Entry* entry = cache; entry; entry = entry->next) {
+    if (entry->blocksize == engine->blocksize && entry->shift == engine->shift &&
+        entry->howmany == howmany && entry->flags == flags && entry->precision == engine->precision &&
+        entry->windowed == (engine->window != NULL)) {
+      pthread_mutex_unlock(&cache_lock);
+      return entry;
+    }
+  }
+
+  // Planning may clobber the input; it is refilled before use.
+  int n = engine->blocksize;
+  int windowed = engine->window != NULL;
+  int distance = windowed ? n : engine->shift;
+  Plan_Entry* entry = calloc(1, sizeof(Plan_Entry));
+  entry->blocksize = engine->blocksize;
+  entry->shift = engine->shift;
+  entry->howmany = howmany;
+  entry->flags = flags;
+  entry->precision = engine->precision;
+  entry->windowed = windowed;
+  long long start = profile_begin();
+  if (engine->precision == PRECISION_SINGLE) {
+    entry->plan_f = fftwf_plan_many_dft_r2c(1, &n, howmany,
+                                            windowed ? engine->frames_f : engine->span_f, NULL, 1, distance,
+                                            engine->fft_out_f, NULL, 1, engine->out_size,
+                                            flags);
+  } else {
+    entry->plan = fftw_plan_many_dft_r2c(1, &n, howmany,
+                                         windowed ? engine->frames : engine->span, NULL, 1, distance,
+                                         engine->fft_out, NULL, 1, engine->out_size,
+                                         flags);
+  }
+  profile_end(PHASE_PLAN, start);
+  entry->next = cache;
+  cache = entry;
+  pthread_mutex_unlock(&cache_lock);
+  return entry;
+}
+
+FFTW_Batch* create_fftw_batch(int blocksize, int shift, unsigned flags, Precision precision, const double* window) {
+  FFTW_Batch* engine = calloc(1, sizeof(FFTW_Batch));
+  engine->blocksize = blocksize;
+  engine->shift = shift;
+  engine->out_size = blocksize / 2 + 1;
+  engine->mode = ACCUMULATE_MAGNITUDE;
+  engine->precision = precision;
+  engine->batch = MAX(MIN(FFTW_BATCH_MAX, FFTW_BATCH_BYTES / (int)(engine->out_size * sizeof(fftw_complex))), 1);
+  engine->fft_out = fftw_malloc(sizeof(fftw_complex) * engine->out_size * engine->batch);
+
+  engine->span_size = (long)(engine->batch - 1) * shift + blocksize;
+  engine->span = fftw_malloc(sizeof(double) * engine->span_size);
+  if (precision == PRECISION_SINGLE) {
+    engine->fft_out_f = fftwf_malloc(sizeof(fftwf_complex) * engine->out_size * engine->batch);
+    engine->span_f = fftwf_malloc(sizeof(float) * engine->span_size);
+  }
+  if (window) {
+    engine->window = malloc(blocksize * sizeof(double));
+    memcpy(engine->window, window, blocksize * sizeof(double));
+    if (precision == PRECISION_SINGLE) {
+      engine->frames_f = fftwf_malloc(sizeof(float) * blocksize * engine->batch);
+    } else {
+      engine->frames = fftw_malloc(sizeof(double) * blocksize * engine->batch);
+    }
+  }
+
+  // The windows overlap inside the span, so the transforms must not write to
+  // their input.
+  flags |= FFTW_PRESERVE_INPUT;
+  Plan_Entry* plan = cached_plan(engine, engine->batch, flags);
+  Plan_Entry* tail_plan = cached_plan(engine, 1, flags);
+  engine->plan = plan->plan;
+  engine->plan_f = plan->plan_f;
+  engine->tail_plan = tail_plan->plan;
+  engine->tail_plan_f = tail_plan->plan_f;
+
+  int bins_size = blocksize / 2;
+  engine->sliding = !window && fftw_batch_prefers_sliding(blocksize, shift, precision);
+  engine->twiddles = malloc(2 * MAX(bins_size, 1) * sizeof(double));
+  for (int k = 0; k < bins_size; k++) {
+    engine->twiddles[2 * k] = cos(2 * M_PI * k / blocksize);
+    engine->twiddles[2 * k + 1] = sin(2 * M_PI * k / blocksize);
+  }
+  engine->deltas = malloc(shift * sizeof(double));
+  engine->anchor = fftw_malloc(sizeof(double) * blocksize);
+  return engine;
+}
+
+int fftw_batch_prefers_sliding(int blocksize, int shift, Precision precision) {
+  int log2n = 0;
+  while ((2 << log2n) <= blocksize) {
+    log2n++;
+  }
+  return precision == PRECISION_DOUBLE && 4 * shift <= log2n;
+}
+
+void destroy_fftw_batch(FFTW_Batch* engine) {
+  fftw_free(engine->fft_out);
+  fftw_free(engine->span);
+  fftw_free(engine->anchor);
+  fftw_free(engine->frames);
+  fftwf_free(engine->frames_f);
+  free(engine->window);
+  free(engine->twiddles);
+  free(engine->deltas);
+  if (engine->precision == PRECISION_SINGLE) {
+    fftwf_free(engine->fft_out_f);
+    fftwf_free(engine->span_f);
+  }
+  free(engine);
+}
+
+long fftw_batch_window_count(const FFTW_Batch* engine, long samples) {
+  if (samples < engine->blocksize) {
+    return 0;
+  }
+  return (samples - engine->blocksize) / engine->shift + 1;
+}
+
+void fftw_batch_cleanup(void) {
+  pthread_mutex_lock(&cache_lock);
+  while (cache) {
+    Plan_Entry* entry = cache;
+    cache = entry->next;
+    if (entry->precision == PRECISION_SINGLE) {
+      fftwf_destroy_plan(entry->plan_f);
+    } else {
+      fftw_destroy_plan(entry->plan);
+    }
+    free(entry);
+  }
+  pthread_mutex_unlock(&cache_lock);
+}
+
+// Adds the bins of the first `frames` spectra in fft_out (fft_out_f in
+// single precision) and passes them on to the spectrogram and the
+// statistics, if any.
+static void add_spectra(FFTW_Batch* engine, long frames, double* bins) {
+  int bins_size = engine->blocksize / 2;
+  long long start = profile_begin();
+  if (engine->precision == PRECISION_SINGLE) {
+    accumulate_bins_float((const float*)engine->fft_out_f, frames, engine->out_size, bins_size, engine->mode, bins);
+    if (engine->spectrogram) {
+      spectrogram_writer_append_float(engine->spectrogram, (const float*)engine->fft_out_f, frames, engine->out_size);
+    }
+    if (engine->stats) {
+      spectrum_stats_add_float(engine->stats, (const float*)engine->fft_out_f, frames, engine->out_size);
+    }
+  } else {
+    accumulate_bins((const double*)engine->fft_out, frames, engine->out_size, bins_size, engine->mode, bins);
+    if (engine->spectrogram) {
+      spectrogram_writer_append(engine->spectrogram, (const double*)engine->fft_out, frames, engine->out_size);
+    }
+    if (engine->stats) {
+      spectrum_stats_add(engine->stats, (const double*)engine->fft_out, frames, engine->out_size);
+    }
+  }
+  profile_end(PHASE_ACCUMULATE, start);
+}
+
+// Transforms the windows in the span (a full batch, or one window with the
+// tail plan) and adds their bins.
+static void transform_span(FFTW_Batch* engine, int tail, double* bins) {
+  int n = engine->blocksize;
+  long frames = tail ? 1 : engine->batch;
+
+  long long start = profile_begin();
+  if (engine->window) {
+    // Gather the windows into rows, weighting (and narrowing) on the way.
+    const double* window = engine->window;
+    for (long f = 0; f < frames; f++) {
+      const double* in = engine->span + f * engine->shift;
+      if (engine->precision == PRECISION_SINGLE) {
+        float* out = engine->frames_f + f * n;
+        for (int k = 0; k < n; k++) {
+          out[k] = (float)(in[k] * window[k]);
+        }
+      } else {
+        double* out = engine->frames + f * n;
+        for (int k = 0; k < n; k++) {
+          out[k] = in[k] * window[k];
+        }
+      }
+    }
+    profile_end(PHASE_WINDOW, start);
+    start = profile_begin();
+    if (engine->precision == PRECISION_SINGLE) {
+      fftwf_execute_dft_r2c(tail ? engine->tail_plan_f : engine->plan_f, engine->frames_f, engine->fft_out_f);
+    } else {
+      fftw_execute_dft_r2c(tail ? engine->tail_plan : engine->plan, engine->frames, engine->fft_out);
+    }
+  } else if (engine->precision == PRECISION_SINGLE) {
+    long length = tail ? engine->blocksize : engine->span_size;
+    for (long i = 0; i < length; i++) {
+      engine->span_f[i] = (float)engine->span[i];
+    }
+    profile_end(PHASE_WINDOW, start);
+    start = profile_begin();
+    fftwf_execute_dft_r2c(tail ? engine->tail_plan_f : engine->plan_f, engine->span_f, engine->fft_out_f);
+  } else {
+    fftw_execute_dft_r2c(tail ? engine->tail_plan : engine->plan, engine->span, engine->fft_out);
+  }
+  profile_end(PHASE_FFT, start);
+
+  add_spectra(engine, frames, bins);
+}
+
+// Sliding DFT over `windows` windows of `samples` (which starts with the
+// first of them). The state of the current window lives in the first
+// bins_size values of fft_out, where the anchoring FFT leaves it.
+static void slide_windows(FFTW_Batch* engine, const double* samples, long windows, double* bins) {
+  int n = engine->blocksize;
+  int shift = engine->shift;
+  int bins_size = n / 2;
+  long anchor_interval = MAX(SLIDING_ANCHOR_SAMPLES / shift, 1);
+  double* state = (double*)engine->fft_out;
+  const double* twiddles = engine->twiddles;
+  double* deltas = engine->deltas;
+
+  for (long w = 0; w < windows; w++) {
+    const double* window = samples + w * shift;
+    long long start = profile_begin();
+    if (w % anchor_interval == 0) {
+      memcpy(engine->anchor, window, n * sizeof(double));
+      fftw_execute_dft_r2c(engine->tail_plan, engine->anchor, engine->fft_out);
+    } else {
+      // Slide from window w - 1, one sample at a time per bin.
+      for (int j = 0; j < shift; j++) {
+        deltas[j] = window[n - shift + j] - window[j - shift];
+      }
+      for (int k = 0; k < bins_size; k++) {
+        double re = state[2 * k];
+        double im = state[2 * k + 1];
+        double c = twiddles[2 * k];
+        double s = twiddles[2 * k + 1];
+        for (int j = 0; j < shift; j++) {
+          re += deltas[j];
+          double t = re * c - im * s;
+          im = re * s + im * c;
+          re = t;
+        }
+        state[2 * k] = re;
+        state[2 * k + 1] = im;
+      }
+    }
+    profile_end(PHASE_FFT, start);
+    add_spectra(engine, 1, bins);
+  }
+}
+
+static int use_sliding(const FFTW_Batch* engine) {
+  return engine->sliding && engine->precision == PRECISION_DOUBLE && !engine->window;
+}
+
+void fftw_batch_accumulate(FFTW_Batch* engine, const WAV_Reader* reader, long first, long windows, double* bins) {
+  long done = 0;
+
+  if (use_sliding(engine)) {
+    // One span per batch, anchored at its first window.
+    while (done < windows) {
+      long count = MIN(engine->batch, windows - done);
+      wav_reader_read(reader, (first + done) * engine->shift, (count - 1) * engine->shift + engine->blocksize, engine->span);
+      slide_windows(engine, engine->span, count, bins);
+      done += count;
+    }
+    return;
+  }
+
+  while (windows - done >= engine->batch) {
+    wav_reader_read(reader, (first + done) * engine->shift, engine->span_size, engine->span);
+    transform_span(engine, 0, bins);
+    done += engine->batch;
+  }
+
+  for (; done < windows; done++) {
+    wav_reader_read(reader, (first + done) * engine->shift, engine->blocksize, engine->span);
+    transform_span(engine, 1, bins);
+  }
+}
+
+void fftw_batch_accumulate_samples(FFTW_Batch* engine, const double* samples, long windows, double* bins) {
+  long done = 0;
+
+  if (use_sliding(engine)) {
+    slide_windows(engine, samples, windows, bins);
+    return;
+  }
+
+  while (windows - done >= engine->batch) {
+    memcpy(engine->span, samples + done * engine->shift, engine->span_size * sizeof(double));
+    transform_span(engine, 0, bins);
+    done += engine->batch;
+  }
+
+  for (; done < windows; done++) {
+    memcpy(engine->span, samples + done * engine->shift, engine->blocksize * sizeof(double));
+    transform_span(engine, 1, bins);
+  }
+}
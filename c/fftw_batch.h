@@ -0,0 +1,90 @@
+#ifndef FFTW_BATCH_H
+#define FFTW_BATCH_H
+
+#include "fftw3.h"
+#include "wav_reader.h"
+#include "bins_accumulate.h"
+#include "precision.h"
+#include "spectrogram_writer.h"
+#include "spectrum_stats.h"
+
+// Batched r2c engine: one fftw_plan_many_dft_r2c covers `batch` windows whose
+// inputs overlap inside `span` with the hop as input distance. Each batch
+// converts just the samples it covers from the reader into `span`, so only
+// O(batch * blocksize) doubles are ever resident per engine.
+//
+// Any blocksize >= 2 works; FFTW picks mixed-radix codelets or its generic
+// prime-size algorithms as needed.
+//
+// With PRECISION_SINGLE the decoded samples are narrowed into `span_f` and
+// transformed with the equivalent fftwf plans; the bins are still summed in
+// double.
+//
+// With a window the overlapping layout no longer works, since every window
+// needs its own weighted copy of the samples. The plans then read `frames`
+// (one contiguous row per window) instead, and the copy from the decoded
+// span into the rows applies the window (and the narrowing to float).
+//
+// For tiny hops `sliding` replaces the per-window FFT with the sliding DFT
+// recurrence X_k <- (X_k - x_old + x_new) * exp(2*pi*i*k/blocksize), which
+// costs O(blocksize) per new sample instead of O(blocksize log blocksize)
+// per window. The state is re-anchored with a real FFT at the start of every
+// call, every batch and at least every SLIDING_ANCHOR_SAMPLES updates, so
+// rounding drift stays far below what the printed dB values show. Double
+// precision and rectangular window only.
+typedef struct {
+  int blocksize;
+  int shift;
+  int batch;               // windows per plan execution
+  int out_size;            // complex outputs per window (blocksize/2 + 1)
+  long span_size;          // (batch - 1) * shift + blocksize
+  double* span;            // converted samples of the current batch
+  fftw_complex* fft_out;   // batch * out_size
+  fftw_plan plan;          // howmany = batch, shared via the plan cache
+  fftw_plan tail_plan;     // howmany = 1, used for the last partial batch
+  Accumulate_Mode mode;    // |X| (default) or |X|^2
+  Precision precision;
+  float* span_f;           // single precision only: narrowed span
+  fftwf_complex* fft_out_f;
+  fftwf_plan plan_f;
+  fftwf_plan tail_plan_f;
+  double* window;          // blocksize coefficients, NULL for rectangular
+  double* frames;          // windowed only: batch rows of blocksize samples
+  float* frames_f;
+  int sliding;             // see above; preset by fftw_batch_prefers_sliding
+  double* twiddles;        // exp(2*pi*i*k/blocksize), k < blocksize/2, interleaved
+  double* deltas;          // x_new - x_old of the current hop
+  double* anchor;          // blocksize samples for the re-anchoring FFT
+  Spectrogram_Writer* spectrogram; // optional: receives every window's spectrum, in window order
+  Spectrum_Stats* stats;   // optional: likewise, for the per-bin statistics
+} FFTW_Batch;
+
+// Updates between two re-anchoring FFTs of the sliding DFT.
+#define SLIDING_ANCHOR_SAMPLES 4096
+
+// `window` points to blocksize coefficients (copied), or NULL for a
+// rectangular window.
+FFTW_Batch* create_fftw_batch(int blocksize, int shift, unsigned flags, Precision precision, const double* window);
+void destroy_fftw_batch(FFTW_Batch* engine);
+
+// Destroys the cached plans. No engine may be in use.
+void fftw_batch_cleanup(void);
+
+// Whether the sliding DFT is expected to beat FFTW for this shape: shift at
+// most log2(blocksize) / 4, in double precision (see bench_sliding for the
+// measured crossover on a given machine).
+int fftw_batch_prefers_sliding(int blocksize, int shift, Precision precision);
+
+// Number of full windows of `blocksize` samples that fit into `samples`.
+long fftw_batch_window_count(const FFTW_Batch* engine, long samples);
+
+// Transforms `windows` consecutive windows starting with window `first` of
+// the reader and adds the magnitude (or power, see `mode`) of the first
+// blocksize/2 bins of every window to `bins`.
+void fftw_batch_accumulate(FFTW_Batch* engine, const WAV_Reader* reader, long first, long windows, double* bins);
+
+// Same as fftw_batch_accumulate for samples that are already decoded, e.g.
+// a chunk of a WAV_Stream.
+void fftw_batch_accumulate_samples(FFTW_Batch* engine, const double* samples, long windows, double* bins);
+
+#endif
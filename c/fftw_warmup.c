@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/time.h>
+#include "fftw3.h"
+#include "fftw_batch.h"
+#include "fftw_wisdom.h"
+#include "window_function.h"
+
+// Pre-plans the batched engines aufgabe01 uses and stores the wisdom in the
+// cache, so the first real run plans as fast as every later one.
+//
+// Usage: fftw_warmup [--wisdom-dir <dir>] [--precision <double|single>] [--window <name>] [<blocksize>[:<shift>] ...]
+//
+// Without sizes every power of two from 64 to 65536 is planned with
+// shift = blocksize / 2. The plan shape depends on the shift, so pass the
+// hops you actually run with. Windowed runs use a different input layout;
+// any --window other than rectangular plans that one.
+
+#define DEFAULT_MIN 64
+#define DEFAULT_MAX 65536
+
+double now_seconds() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int warm_up(const char* dir, int blocksize, int shift, Precision precision, const Window_Spec* window_spec) {
+  // One file per blocksize: start from that size's wisdom only.
+  fftw_forget_wisdom();
+  fftwf_forget_wisdom();
+  int cached = fftw_wisdom_import(dir, blocksize);
+
+  double* window = create_window(window_spec, blocksize);
+  double start = now_seconds();
+  FFTW_Batch* engine = create_fftw_batch(blocksize, shift, FFTW_WISDOM_FLAGS, precision, window);
+  double elapsed = now_seconds() - start;
+  free(window);
+  destroy_fftw_batch(engine);
+  fftw_batch_cleanup();
+
+  if (!fftw_wisdom_export(dir, blocksize)) {
+    return 0;
+  }
+  printf("%6d:%-6d %s planned in %8.3f s%s\n", blocksize, shift, precision_name(precision), elapsed, cached ? " (from cache)" : "");
+  return 1;
+}
+
+int main(int argc, char* argv[]) {
+  static struct option options[] = {
+    {"wisdom-dir", required_argument, NULL, 'w'},
+    {"precision", required_argument, NULL, 'P'},
+    {"window", required_argument, NULL, 'W'},
+    {NULL, 0, NULL, 0}
+  };
+
+  const char* dir = fftw_wisdom_default_dir();
+  Precision precision = PRECISION_DOUBLE;
+  Window_Spec window = {WINDOW_RECTANGULAR, DEFAULT_KAISER_BETA};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+    switch (opt) {
+    case 'w':
+      dir = optarg;
+      break;
+    case 'P':
+      if (!parse_precision(optarg, &precision)) {
+        fprintf(stderr, "Unknown precision: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'W':
+      if (!parse_window(optarg, &window)) {
+        fprintf(stderr, "Unknown window: %s\n", optarg);
+        return 1;
+      }
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [--wisdom-dir <dir>] [--precision <double|single>] [--window <name>] [<blocksize>[:<shift>] ...]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (!dir) {
+    fprintf(stderr, "No wisdom directory: set FFTW_WISDOM_DIR or pass --wisdom-dir\n");
+    return 1;
+  }
+  printf("Wisdom directory: %s\n", dir);
+
+  int failed = 0;
+  if (optind == argc) {
+    for (int blocksize = DEFAULT_MIN; blocksize <= DEFAULT_MAX; blocksize *= 2) {
+      failed |= !warm_up(dir, blocksize, blocksize / 2, precision, &window);
+    }
+  }
+  for (int i = optind; i < argc; i++) {
+    int blocksize = atoi(argv[i]);
+    char* colon = strchr(argv[i], ':');
+    int shift = colon ? atoi(colon + 1) : blocksize / 2;
+    if (blocksize < 2 || shift < 1 || shift > blocksize) {
+      fprintf(stderr, "Invalid size: %s\n", argv[i]);
+      failed = 1;
+      continue;
+    }
+    failed |= !warm_up(dir, blocksize, shift, precision, &window);
+  }
+
+  return failed;
+}
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include "fftw3.h"
+#include "fftw_wisdom.h"
+
+// FFTW keeps separate wisdom per precision, with the same API prefixed
+// fftw_ and fftwf_. `known` is the wisdom as of the last import/export, to
+// skip rewriting unchanged files.
+typedef struct {
+  const char* prefix;
+  char* (*to_string)(void);
+  int (*to_filename)(const char* path);
+  int (*from_filename)(const char* path);
+  void (*release)(void* p);
+  char* known;
+} Wisdom_Kind;
+
+static Wisdom_Kind kinds[] = {
+  {"fftw", fftw_export_wisdom_to_string, fftw_export_wisdom_to_filename, fftw_import_wisdom_from_filename, fftw_free, NULL},
+  {"fftwf", fftwf_export_wisdom_to_string, fftwf_export_wisdom_to_filename, fftwf_import_wisdom_from_filename, fftwf_free, NULL},
+};
+#define KIND_COUNT (int)(sizeof(kinds) / sizeof(kinds[0]))
+
+static void remember_wisdom(Wisdom_Kind* kind) {
+  if (kind->known) {
+    kind->release(kind->known);
+  }
+  kind->known = kind->to_string();
+}
+
+// FNV-1a over the CPU model name and the FFTW version.
+static unsigned long long cpu_key(void) {
+  char model[256] = "";
+  FILE* file = fopen("/proc/cpuinfo", "r");
+  if (file) {
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+      char* colon = strchr(line, ':');
+      if (colon && strncmp(line, "model name", 10) == 0) {
+        snprintf(model, sizeof(model), "%s", colon + 1);
+        break;
+      }
+    }
+    fclose(file);
+  }
+  if (!model[0]) {
+    struct utsname name;
+    if (uname(&name) == 0) {
+      snprintf(model, sizeof(model), "%s", name.machine);
+    }
+  }
+
+  unsigned long long hash = 14695981039346656037ULL;
+  const char* parts[] = {model, "|", fftw_version};
+  for (int p = 0; p < 3; p++) {
+    for (const char* c = parts[p]; *c; c++) {
+      hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    }
+  }
+  return hash;
+}
+
+static void wisdom_path(const char* dir, const Wisdom_Kind* kind, int blocksize, char* path, size_t size) {
+  static unsigned long long key = 0;
+  if (!key) {
+    key = cpu_key();
+  }
+  snprintf(path, size, "%s/%s-%016llx-%d.wisdom", dir, kind->prefix, key, blocksize);
+}
+
+// mkdir -p
+static int make_dirs(const char* dir) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s", dir);
+  for (char* p = path + 1; ; p++) {
+    if (*p == '/' || *p == '\0') {
+      char c = *p;
+      *p = '\0';
+      if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        perror("Error creating wisdom directory");
+        return 0;
+      }
+      *p = c;
+      if (c == '\0') {
+        return 1;
+      }
+    }
+  }
+}
+
+const char* fftw_wisdom_default_dir(void) {
+  static char dir[4096];
+  const char* env = getenv("FFTW_WISDOM_DIR");
+  if (env && *env) {
+    return env;
+  }
+  env = getenv("XDG_CACHE_HOME");
+  if (env && *env) {
+    snprintf(dir, sizeof(dir), "%s/aufgaben/fftw", env);
+    return dir;
+  }
+  env = getenv("HOME");
+  if (env && *env) {
+    snprintf(dir, sizeof(dir), "%s/.cache/aufgaben/fftw", env);
+    return dir;
+  }
+  return NULL;
+}
+
+int fftw_wisdom_import(const char* dir, int blocksize) {
+  if (!dir) {
+    return 0;
+  }
+  int found = 0;
+  for (int k = 0; k < KIND_COUNT; k++) {
+    char path[4096];
+    wisdom_path(dir, &kinds[k], blocksize, path, sizeof(path));
+    if (access(path, R_OK) == 0 && kinds[k].from_filename(path)) {
+      found = 1;
+    }
+    remember_wisdom(&kinds[k]);
+  }
+  return found;
+}
+
+static int export_kind(const char* dir, Wisdom_Kind* kind, int blocksize) {
+  char* wisdom = kind->to_string();
+  int unchanged = wisdom && kind->known && strcmp(wisdom, kind->known) == 0;
+  kind->release(wisdom);
+  if (unchanged) {
+    return 1;
+  }
+  if (!make_dirs(dir)) {
+    return 0;
+  }
+
+  // Write next to the target and rename, so readers see the old or the new
+  // file but never a partial one.
+  char path[4096];
+  char tmp[4200];
+  wisdom_path(dir, kind, blocksize, path, sizeof(path));
+  snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+  if (!kind->to_filename(tmp)) {
+    fprintf(stderr, "Error writing wisdom file %s\n", tmp);
+    return 0;
+  }
+  if (rename(tmp, path) != 0) {
+    perror("Error renaming wisdom file");
+    unlink(tmp);
+    return 0;
+  }
+  remember_wisdom(kind);
+  return 1;
+}
+
+int fftw_wisdom_export(const char* dir, int blocksize) {
+  if (!dir) {
+    return 0;
+  }
+  int ok = 1;
+  for (int k = 0; k < KIND_COUNT; k++) {
+    ok &= export_kind(dir, &kinds[k], blocksize);
+  }
+  return ok;
+}
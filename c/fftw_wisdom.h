@@ -0,0 +1,32 @@
+#ifndef FFTW_WISDOM_H
+#define FFTW_WISDOM_H
+
+// On-disk FFTW wisdom cache, so FFTW_PATIENT planning is paid once per
+// machine instead of on every run. There is one file per CPU model and
+// blocksize and precision:
+//
+//   <dir>/fftw-<cpu key>-<blocksize>.wisdom    (double)
+//   <dir>/fftwf-<cpu key>-<blocksize>.wisdom   (single)
+//
+// where the key is a hash of the CPU model name and the FFTW version; wisdom
+// from another machine or library build is never picked up. The directory is
+// $FFTW_WISDOM_DIR, else $XDG_CACHE_HOME/aufgaben/fftw, else
+// ~/.cache/aufgaben/fftw.
+
+// Planner flags the cached wisdom is made for (aufgabe01 and fftw_warmup).
+#define FFTW_WISDOM_FLAGS FFTW_PATIENT
+
+// Default cache directory, or NULL if none can be derived. The string is
+// static.
+const char* fftw_wisdom_default_dir(void);
+
+// Imports the wisdom of both precisions for `blocksize` from `dir`. Returns 1
+// if a cache file was read, 0 otherwise (including dir == NULL).
+int fftw_wisdom_import(const char* dir, int blocksize);
+
+// Writes the accumulated wisdom for `blocksize` to `dir` if planning added
+// anything since the last import. The file is replaced atomically, so
+// concurrent runs never see a partial file. Returns 0 on failure.
+int fftw_wisdom_export(const char* dir, int blocksize);
+
+#endif
@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "kiss_plan.h"
+
+#define PI 3.14159265358979323846
+
+typedef struct Plan_Entry {
+  Kiss_Plan plan;
+  struct Plan_Entry* next;
+} Plan_Entry;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static Plan_Entry* cache = NULL;
+
+// Rough butterfly cost of kiss_fft for size n: every stage of radix p
+// touches all n values p times.
+static double kiss_cost(int n) {
+  double cost = 0;
+  int radix[] = {4, 2, 3, 5};
+  for (int r = 0; r < 4; r++) {
+    while (n % radix[r] == 0) {
+      cost += radix[r];
+      n /= radix[r];
+    }
+  }
+  for (int p = 7; (long)p * p <= n; p += 2) {
+    while (n % p == 0) {
+      cost += p;
+      n /= p;
+    }
+  }
+  if (n > 1) {
+    cost += n;
+  }
+  return cost;
+}
+
+static kiss_fft_cpx cmul(kiss_fft_cpx a, kiss_fft_cpx b) {
+  kiss_fft_cpx c = { a.r * b.r - a.i * b.i, a.r * b.i + a.i * b.r };
+  return c;
+}
+
+static void build_bluestein(Kiss_Plan* plan) {
+  int n = plan->nfft;
+  int m = plan->m;
+  plan->forward = kiss_fft_alloc(m, 0, NULL, NULL);
+  plan->inverse = kiss_fft_alloc(m, 1, NULL, NULL);
+  plan->chirp = malloc(sizeof(kiss_fft_cpx) * n);
+  plan->kernel = malloc(sizeof(kiss_fft_cpx) * m);
+
+  // k^2 mod 2n keeps the angle exact for large k.
+  for (int k = 0; k < n; k++) {
+    double angle = -PI * (double)(((long)k * k) % (2L * n)) / n;
+    plan->chirp[k].r = cos(angle);
+    plan->chirp[k].i = sin(angle);
+  }
+
+  kiss_fft_cpx* b = calloc(m, sizeof(kiss_fft_cpx));
+  for (int k = 0; k < n; k++) {
+    kiss_fft_cpx conj = { plan->chirp[k].r, -plan->chirp[k].i };
+    b[k] = conj;
+    if (k > 0) {
+      b[m - k] = conj;
+    }
+  }
+  kiss_fft(plan->forward, b, plan->kernel);
+  for (int k = 0; k < m; k++) {
+    plan->kernel[k].r /= m;
+    plan->kernel[k].i /= m;
+  }
+  free(b);
+}
+
+const Kiss_Plan* get_kiss_plan(int nfft) {
+  pthread_mutex_lock(&cache_lock);
+  for (Plan_Entry* entry = cache; entry; entry = entry->next) {
+    if (entry->plan.nfft == nfft) {
+      pthread_mutex_unlock(&cache_lock);
+      return &entry->plan;
+    }
+  }
+
+  Plan_Entry* entry = calloc(1, sizeof(Plan_Entry));
+  Kiss_Plan* plan = &entry->plan;
+  plan->nfft = nfft;
+
+  // Bluestein costs two FFTs of size m plus three O(m) passes; only worth it
+  // when kiss_fft would hit a large prime factor.
+  int m = kiss_fft_next_fast_size(2 * nfft - 1);
+  double direct = (double)nfft * kiss_cost(nfft);
+  double bluestein = 2.0 * m * kiss_cost(m) + 3.0 * m;
+  if (nfft > 5 && bluestein < direct) {
+    plan->bluestein = 1;
+    plan->m = m;
+    build_bluestein(plan);
+  } else {
+    plan->forward = kiss_fft_alloc(nfft, 0, NULL, NULL);
+  }
+
+  entry->next = cache;
+  cache = entry;
+  pthread_mutex_unlock(&cache_lock);
+  return plan;
+}
+
+long kiss_plan_scratch_size(const Kiss_Plan* plan) {
+  return plan->bluestein ? 2L * plan->m : 0;
+}
+
+void kiss_plan_execute(const Kiss_Plan* plan, const kiss_fft_cpx* in, kiss_fft_cpx* out, kiss_fft_cpx* scratch) {
+  if (!plan->bluestein) {
+    kiss_fft(plan->forward, in, out);
+    return;
+  }
+
+  int n = plan->nfft;
+  int m = plan->m;
+  kiss_fft_cpx* a = scratch;
+  kiss_fft_cpx* spectrum = scratch + m;
+
+  for (int k = 0; k < n; k++) {
+    a[k] = cmul(in[k], plan->chirp[k]);
+  }
+  memset(a + n, 0, sizeof(kiss_fft_cpx) * (m - n));
+
+  kiss_fft(plan->forward, a, spectrum);
+  for (int k = 0; k < m; k++) {
+    spectrum[k] = cmul(spectrum[k], plan->kernel[k]);
+  }
+  kiss_fft(plan->inverse, spectrum, a);
+
+  for (int k = 0; k < n; k++) {
+    out[k] = cmul(a[k], plan->chirp[k]);
+  }
+}
+
+void kiss_plan_cleanup(void) {
+  pthread_mutex_lock(&cache_lock);
+  while (cache) {
+    Plan_Entry* entry = cache;
+    cache = entry->next;
+    kiss_fft_free(entry->plan.forward);
+    if (entry->plan.bluestein) {
+      kiss_fft_free(entry->plan.inverse);
+      free(entry->plan.chirp);
+      free(entry->plan.kernel);
+    }
+    free(entry);
+  }
+  pthread_mutex_unlock(&cache_lock);
+}
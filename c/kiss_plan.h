@@ -0,0 +1,37 @@
+#ifndef KISS_PLAN_H
+#define KISS_PLAN_H
+
+#include "kissfft/kiss_fft.h"
+
+// Complex KISS FFT of any size. kiss_fft itself only has fast butterflies for
+// 2, 3, 4 and 5 and falls back to an O(p^2) loop per stage for any other
+// prime factor p, so a 65537-point frame costs as much as a plain DFT. For
+// such sizes the plan uses Bluestein's algorithm instead: the transform is
+// rewritten as a convolution with a chirp and evaluated with two FFTs of a
+// fast size m >= 2n - 1.
+//
+// Plans are immutable once built and cached per size for the lifetime of
+// the process, so threads share them; each caller passes its own scratch.
+typedef struct {
+  int nfft;
+  int bluestein;          // 0: kiss_fft of size nfft directly
+  int m;                  // padded convolution size (Bluestein only)
+  kiss_fft_cfg forward;   // size nfft, or m for Bluestein
+  kiss_fft_cfg inverse;   // size m (Bluestein only)
+  kiss_fft_cpx* chirp;    // exp(-i*pi*k^2/nfft), k < nfft
+  kiss_fft_cpx* kernel;   // FFT of the conjugate chirp, scaled by 1/m
+} Kiss_Plan;
+
+// Returns the cached plan for `nfft`, building it on first use. Thread safe.
+const Kiss_Plan* get_kiss_plan(int nfft);
+
+// Complex values of scratch kiss_plan_execute needs (0 for direct plans).
+long kiss_plan_scratch_size(const Kiss_Plan* plan);
+
+// Forward transform of `nfft` values; `in` and `out` must not alias.
+void kiss_plan_execute(const Kiss_Plan* plan, const kiss_fft_cpx* in, kiss_fft_cpx* out, kiss_fft_cpx* scratch);
+
+// Frees every cached plan. No plan may be in use.
+void kiss_plan_cleanup(void);
+
+#endif
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "pcm_stream.h"
+
+static unsigned long read_u32(const unsigned char* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+// Reads up to `size` bytes, the probed header bytes first. Returns fewer only
+// at the end of the input, or -1 on an error.
+static long read_bytes(PCM_Stream* stream, unsigned char* out, long size) {
+  long done = 0;
+  if (stream->pending_size > 0) {
+    long n = size < stream->pending_size ? size : stream->pending_size;
+    memcpy(out, stream->pending, n);
+    memmove(stream->pending, stream->pending + n, stream->pending_size - n);
+    stream->pending_size -= n;
+    done = n;
+  }
+  while (done < size) {
+    ssize_t n = read(stream->fd, out + done, size - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      perror("Error reading input");
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    done += n;
+  }
+  return done;
+}
+
+// Reads and drops `size` bytes of a chunk that is not needed.
+static int skip_bytes(PCM_Stream* stream, long size) {
+  unsigned char buffer[4096];
+  while (size > 0) {
+    long n = size < (long)sizeof(buffer) ? size : (long)sizeof(buffer);
+    if (read_bytes(stream, buffer, n) != n) {
+      return -1;
+    }
+    size -= n;
+  }
+  return 0;
+}
+
+// Reads chunk headers up to "data". Returns 1 if the input has no RIFF/WAVE
+// header (the probed bytes stay pending as samples), -1 on errors, 0 on
+// success.
+static int parse_header(PCM_Stream* stream) {
+  long n = read_bytes(stream, stream->pending, 12);
+  if (n < 0) {
+    return -1;
+  }
+  if (n < 12 || memcmp(stream->pending, "RIFF", 4) != 0 || memcmp(stream->pending + 8, "WAVE", 4) != 0) {
+    stream->pending_size = n;
+    return 1;
+  }
+
+  int have_fmt = 0;
+  for (;;) {
+    unsigned char chunk[8];
+    if (read_bytes(stream, chunk, 8) != 8) {
+      fprintf(stderr, "Malformed WAV input: missing fmt or data chunk\n");
+      return -1;
+    }
+    long chunk_size = read_u32(chunk + 4);
+
+    if (memcmp(chunk, "data", 4) == 0) {
+      if (!have_fmt) {
+        fprintf(stderr, "Malformed WAV input: data before fmt chunk\n");
+        return -1;
+      }
+      // Placeholder sizes of streaming writers mean "until the end".
+      stream->remaining = (chunk_size == 0 || chunk_size == 0xFFFFFFFFL) ? -1 : chunk_size;
+      return 0;
+    }
+
+    long padded = chunk_size + (chunk_size & 1); // chunks are padded to even sizes
+    if (memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16 && chunk_size <= 1024) {
+      unsigned char fmt[1024];
+      if (read_bytes(stream, fmt, padded) != padded || wav_parse_fmt(&stream->layout, fmt, chunk_size) != 0) {
+        return -1;
+      }
+      have_fmt = 1;
+    } else if (skip_bytes(stream, padded) != 0) {
+      fprintf(stderr, "Malformed WAV input: truncated chunk\n");
+      return -1;
+    }
+  }
+}
+
+static PCM_Stream* finish_open(PCM_Stream* stream, int channel) {
+  WAV_Reader* layout = &stream->layout;
+  if (channel != WAV_DOWNMIX && (channel < 0 || channel >= layout->channels)) {
+    fprintf(stderr, "Channel %d out of range, input has %d channels\n", channel, layout->channels);
+    close_pcm_stream(stream);
+    return NULL;
+  }
+  // Downmixing a single channel is just that channel.
+  layout->channel = (channel == WAV_DOWNMIX && layout->channels == 1) ? 0 : channel;
+  layout->decode = wav_select_decode(layout->format, layout->channels, layout->channel);
+  return stream;
+}
+
+static PCM_Stream* create_pcm_stream(int fd) {
+  PCM_Stream* stream = calloc(1, sizeof(PCM_Stream));
+  stream->fd = fd;
+  stream->layout.fd = -1;
+  stream->remaining = -1;
+  return stream;
+}
+
+static int format_bits(WAV_Format format) {
+  switch (format) {
+  case WAV_PCM_U8: return 8;
+  case WAV_PCM_S16: return 16;
+  case WAV_PCM_S24: return 24;
+  case WAV_PCM_S32: return 32;
+  case WAV_FLOAT32: return 32;
+  case WAV_FLOAT64: return 64;
+  }
+  return 0;
+}
+
+static void set_layout(WAV_Reader* layout, WAV_Format format, int sample_rate, int channels) {
+  layout->format = format;
+  layout->channels = channels;
+  layout->sample_rate = sample_rate;
+  layout->bits_per_sample = format_bits(format);
+  layout->block_align = channels * layout->bits_per_sample / 8;
+}
+
+PCM_Stream* open_pcm_stream(int fd, int channel) {
+  PCM_Stream* stream = create_pcm_stream(fd);
+  int status = parse_header(stream);
+  if (status < 0) {
+    close_pcm_stream(stream);
+    return NULL;
+  }
+  if (status > 0) {
+    // Headerless input: interleaved stereo int16.
+    set_layout(&stream->layout, WAV_PCM_S16, 44100, 2);
+  }
+  return finish_open(stream, channel);
+}
+
+PCM_Stream* open_raw_pcm_stream(int fd, WAV_Format format, int sample_rate, int channels, int channel) {
+  PCM_Stream* stream = create_pcm_stream(fd);
+  set_layout(&stream->layout, format, sample_rate, channels);
+  return finish_open(stream, channel);
+}
+
+int parse_pcm_layout(const char* text, WAV_Format* format, int* sample_rate, int* channels) {
+  static const struct {
+    const char* name;
+    WAV_Format format;
+  } names[] = {
+    {"u8", WAV_PCM_U8}, {"s16", WAV_PCM_S16}, {"s24", WAV_PCM_S24},
+    {"s32", WAV_PCM_S32}, {"f32", WAV_FLOAT32}, {"f64", WAV_FLOAT64}
+  };
+
+  char name[8];
+  if (sscanf(text, "%7[^:]:%d:%d", name, sample_rate, channels) != 3 || *sample_rate <= 0 || *channels <= 0) {
+    return 0;
+  }
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strcmp(name, names[i].name) == 0) {
+      *format = names[i].format;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void close_pcm_stream(PCM_Stream* stream) {
+  free(stream->raw);
+  free(stream);
+}
+
+long pcm_stream_read(PCM_Stream* stream, long count, double* out) {
+  const WAV_Reader* layout = &stream->layout;
+  long size = count * layout->block_align;
+  if (stream->remaining >= 0 && size > stream->remaining) {
+    size = stream->remaining - stream->remaining % layout->block_align;
+  }
+  if (size > stream->raw_capacity) {
+    stream->raw = realloc(stream->raw, size);
+    stream->raw_capacity = size;
+  }
+
+  long n = read_bytes(stream, stream->raw, size);
+  if (n < 0) {
+    return -1;
+  }
+  if (stream->remaining >= 0) {
+    stream->remaining -= n;
+  }
+  long frames = n / layout->block_align; // a trailing partial frame is dropped
+  layout->decode(stream->raw, frames, layout->channels, layout->channel, out);
+  return frames;
+}
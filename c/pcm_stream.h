@@ -0,0 +1,41 @@
+#ifndef PCM_STREAM_H
+#define PCM_STREAM_H
+
+#include "wav_reader.h"
+
+// Sequential PCM input from a file descriptor that cannot be mapped or
+// seeked, e.g. stdin or a FIFO. A RIFF/WAVE header is parsed as it arrives
+// (chunks before "data" are read and dropped); input without one is taken
+// as raw interleaved stereo int16 at 44100 Hz like in open_wav_reader,
+// unless the layout is given explicitly. The data size of a streamed WAV
+// header is usually a placeholder (0 or 0xffffffff) and is then ignored.
+
+typedef struct {
+  int fd;
+  WAV_Reader layout;     // format fields and decode loop only, nothing mapped
+  long remaining;        // data bytes left, or -1 until end of input
+  unsigned char* raw;    // undecoded bytes of the current read
+  long raw_capacity;
+  unsigned char pending[12]; // bytes read while probing for a header
+  int pending_size;
+} PCM_Stream;
+
+// Parses the header from `fd`. Returns NULL on a read error or an unsupported
+// layout.
+PCM_Stream* open_pcm_stream(int fd, int channel);
+
+// Raw input of a known layout; nothing is read up front.
+PCM_Stream* open_raw_pcm_stream(int fd, WAV_Format format, int sample_rate, int channels, int channel);
+
+// Parses "<format>:<rate>:<channels>", e.g. "s16:48000:2", with format one
+// of u8, s16, s24, s32, f32, f64. Returns 0 if malformed.
+int parse_pcm_layout(const char* text, WAV_Format* format, int* sample_rate, int* channels);
+
+void close_pcm_stream(PCM_Stream* stream);
+
+// Blocks until `count` frames of the selected channel are decoded into `out`
+// or the input ends. Returns the number of frames decoded (short only at the
+// end of the input), or -1 on a read error.
+long pcm_stream_read(PCM_Stream* stream, long count, double* out);
+
+#endif
@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "precision.h"
+
+int parse_precision(const char* name, Precision* precision) {
+  if (strcmp(name, "double") == 0 || strcmp(name, "float64") == 0) {
+    *precision = PRECISION_DOUBLE;
+    return 1;
+  }
+  if (strcmp(name, "single") == 0 || strcmp(name, "float32") == 0) {
+    *precision = PRECISION_SINGLE;
+    return 1;
+  }
+  return 0;
+}
+
+const char* precision_name(Precision precision) {
+  return precision == PRECISION_SINGLE ? "single" : "double";
+}
+
+void report_precision_deviation(const double* reference, const double* bins, int bins_size,
+                                int sample_rate, int blocksize) {
+  double max_diff = 0;
+  double sum_squares = 0;
+  int max_bin = 0;
+  for (int i = 0; i < bins_size; i++) {
+    double diff = fabs(bins[i] - reference[i]);
+    // -inf - -inf is an exact match (silent bins), not a NaN.
+    if (bins[i] == reference[i]) {
+      diff = 0;
+    }
+    if (diff > max_diff || isnan(diff)) {
+      max_diff = diff;
+      max_bin = i;
+    }
+    sum_squares += diff * diff;
+  }
+  printf("Deviation from double precision: max %.3g dB at %dHz, rms %.3g dB\n",
+         max_diff, (int)((long)max_bin * sample_rate / blocksize), sqrt(sum_squares / bins_size));
+}
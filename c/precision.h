@@ -0,0 +1,23 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+// Arithmetic the transforms run in. The bins are always summed in double:
+// PRECISION_SINGLE only narrows the FFT input/output (fftwf plans, float
+// OpenCL kernels, the float accumulate kernels), which halves the memory
+// traffic and doubles the SIMD width, at roughly 1e-7 relative error per
+// spectrum value instead of 1e-16.
+typedef enum {
+  PRECISION_DOUBLE,
+  PRECISION_SINGLE
+} Precision;
+
+// "double" or "single" (also "float64"/"float32"); returns 0 if unknown.
+int parse_precision(const char* name, Precision* precision);
+const char* precision_name(Precision precision);
+
+// Prints how far `bins` (dB values of a reduced precision run) are from the
+// double precision `reference`: the largest and the RMS difference in dB.
+void report_precision_deviation(const double* reference, const double* bins, int bins_size,
+                                int sample_rate, int blocksize);
+
+#endif
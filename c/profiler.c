@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "profiler.h"
+
+// Trace events kept per thread; later ones are counted as dropped.
+#define MAX_THREAD_EVENTS (1L << 20)
+
+typedef struct {
+  long long start;
+  long long end;
+  Profile_Phase phase;
+} Profile_Event;
+
+typedef struct Profile_Thread {
+  int id;
+  long long total[PHASE_COUNT];
+  long calls[PHASE_COUNT];
+  Profile_Event* events;
+  long event_count;
+  long event_capacity;
+  long dropped;
+  struct Profile_Thread* next;
+} Profile_Thread;
+
+int profiler_active = 0;
+
+static const char* phase_names[PHASE_COUNT] = {
+  "read", "convert", "window", "plan", "fft", "accumulate", "reduce", "wait",
+  "cl_upload", "cl_kernel", "cl_download"
+};
+
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static Profile_Thread* threads = NULL;  // newest first
+static int thread_count = 0;
+static Profile_Thread* device = NULL;
+static int tracing = 0;
+static long long started = 0;
+static unsigned generation = 0;         // bumped by every profiler_start
+
+static __thread Profile_Thread* current = NULL;
+static __thread unsigned current_generation = 0;
+
+long long profiler_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+const char* profile_phase_name(Profile_Phase phase) {
+  return phase_names[phase];
+}
+
+static Profile_Thread* register_thread(int id) {
+  Profile_Thread* thread = calloc(1, sizeof(Profile_Thread));
+  pthread_mutex_lock(&threads_lock);
+  thread->id = id >= 0 ? id : thread_count;
+  thread_count++;
+  thread->next = threads;
+  threads = thread;
+  pthread_mutex_unlock(&threads_lock);
+  return thread;
+}
+
+static Profile_Thread* this_thread(void) {
+  if (!current || current_generation != generation) {
+    current = register_thread(-1);
+    current_generation = generation;
+  }
+  return current;
+}
+
+static void add_interval(Profile_Thread* thread, Profile_Phase phase, long long start, long long end) {
+  thread->total[phase] += end - start;
+  thread->calls[phase]++;
+  if (!tracing) {
+    return;
+  }
+  if (thread->event_count == thread->event_capacity) {
+    if (thread->event_capacity == MAX_THREAD_EVENTS) {
+      thread->dropped++;
+      return;
+    }
+    thread->event_capacity = thread->event_capacity ? 2 * thread->event_capacity : 4096;
+    thread->events = realloc(thread->events, thread->event_capacity * sizeof(Profile_Event));
+  }
+  Profile_Event* event = &thread->events[thread->event_count++];
+  event->start = start;
+  event->end = end;
+  event->phase = phase;
+}
+
+void profiler_record(Profile_Phase phase, long long start, long long end) {
+  add_interval(this_thread(), phase, start, end);
+}
+
+void profiler_record_device(Profile_Phase phase, long long start, long long end) {
+  if (!profiler_active) {
+    return;
+  }
+  // The device track is shared by all pipelines of the process.
+  pthread_mutex_lock(&threads_lock);
+  add_interval(device, phase, start, end);
+  pthread_mutex_unlock(&threads_lock);
+}
+
+static void free_thread(Profile_Thread* thread) {
+  if (thread) {
+    free(thread->events);
+    free(thread);
+  }
+}
+
+void profiler_stop(void) {
+  profiler_active = 0;
+  pthread_mutex_lock(&threads_lock);
+  while (threads) {
+    Profile_Thread* next = threads->next;
+    free_thread(threads);
+    threads = next;
+  }
+  free_thread(device);
+  device = NULL;
+  thread_count = 0;
+  pthread_mutex_unlock(&threads_lock);
+}
+
+void profiler_start(int trace) {
+  profiler_stop();
+  generation++;
+  tracing = trace;
+  device = calloc(1, sizeof(Profile_Thread));
+  device->id = -1;
+  current = register_thread(0);
+  current_generation = generation;
+  started = profiler_now();
+  profiler_active = 1;
+}
+
+static long long busy_time(const Profile_Thread* thread) {
+  long long busy = 0;
+  for (int p = 0; p < PHASE_COUNT; p++) {
+    busy += p == PHASE_WAIT ? 0 : thread->total[p];
+  }
+  return busy;
+}
+
+void profiler_report(FILE* out) {
+  double wall = (profiler_now() - started) / 1e6;
+  fprintf(out, "# phase calls total_ms mean_us max_thread_ms percent_of_wall\n");
+  for (int p = 0; p < PHASE_COUNT; p++) {
+    long long total = 0;
+    long long max = 0;
+    long calls = 0;
+    for (const Profile_Thread* thread = threads; thread; thread = thread->next) {
+      total += thread->total[p];
+      calls += thread->calls[p];
+      max = thread->total[p] > max ? thread->total[p] : max;
+    }
+    if (device) {
+      total += device->total[p];
+      calls += device->calls[p];
+      max = device->total[p] > max ? device->total[p] : max;
+    }
+    if (calls == 0) {
+      continue;
+    }
+    fprintf(out, "%s %ld %.3f %.3f %.3f %.1f\n", phase_names[p], calls, total / 1e6,
+            total / 1e3 / calls, max / 1e6, 100 * total / 1e6 / wall);
+  }
+
+  fprintf(out, "# thread busy_ms wait_ms\n");
+  for (int id = 0; id < thread_count; id++) {
+    for (const Profile_Thread* thread = threads; thread; thread = thread->next) {
+      if (thread->id == id) {
+        fprintf(out, "%d %.3f %.3f\n", id, busy_time(thread) / 1e6, thread->total[PHASE_WAIT] / 1e6);
+      }
+    }
+  }
+  if (device && busy_time(device) > 0) {
+    fprintf(out, "device %.3f 0.000\n", busy_time(device) / 1e6);
+  }
+  fprintf(out, "# wall_ms %.3f\n", wall);
+}
+
+static void write_events(FILE* file, const Profile_Thread* thread, int tid, int* first) {
+  for (long i = 0; i < thread->event_count; i++) {
+    const Profile_Event* event = &thread->events[i];
+    fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+            *first ? "" : ",", phase_names[event->phase], tid,
+            (event->start - started) / 1e3, (event->end - event->start) / 1e3);
+    *first = 0;
+  }
+}
+
+int profiler_write_trace(const char* filename) {
+  FILE* file = fopen(filename, "w");
+  if (!file) {
+    perror("Error opening trace file");
+    return -1;
+  }
+
+  long dropped = 0;
+  int first = 1;
+  fprintf(file, "{\"traceEvents\":[");
+  for (const Profile_Thread* thread = threads; thread; thread = thread->next) {
+    fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+            first ? "" : ",", thread->id, thread->id == 0 ? "main" : "thread", thread->id);
+    first = 0;
+    write_events(file, thread, thread->id, &first);
+    dropped += thread->dropped;
+  }
+  if (device && device->event_count > 0) {
+    fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"OpenCL device\"}}",
+            thread_count);
+    write_events(file, device, thread_count, &first);
+    dropped += device->dropped;
+  }
+  fprintf(file, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":%ld}}\n", dropped);
+
+  if (fclose(file) != 0) {
+    perror("Error writing trace file");
+    return -1;
+  }
+  return 0;
+}
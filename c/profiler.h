@@ -0,0 +1,81 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+
+// Per-phase timing of the hot paths. A phase is timed with a begin/end pair
+// around the code in question:
+//
+//   long long start = profile_begin();
+//   ...
+//   profile_end(PHASE_FFT, start);
+//
+// While the profiler is not started, profile_begin is a load and a branch
+// and profile_end a branch, so the calls stay in place for normal runs
+// (-DPROFILER_DISABLED removes them entirely). Once started, every thread
+// adds to its own counters (CLOCK_MONOTONIC nanoseconds and call counts per
+// phase), so timing needs no locking, and with tracing every interval is
+// also kept as an event for profiler_write_trace.
+//
+// The OpenCL pipeline reports the device side from its command events as
+// the PHASE_CL_* phases on a separate "device" track.
+
+typedef enum {
+  PHASE_READ,         // file I/O (pread of the streaming reader)
+  PHASE_CONVERT,      // sample decoding into doubles (and page faults of the mapping)
+  PHASE_WINDOW,       // windowing / narrowing into the transform input
+  PHASE_PLAN,         // FFT plans, kernel builds
+  PHASE_FFT,          // transforms, sliding DFT updates
+  PHASE_ACCUMULATE,   // magnitudes into the bins, spectrogram and statistics
+  PHASE_REDUCE,       // combining the partial bins of several threads
+  PHASE_WAIT,         // waiting for other threads or the device
+  PHASE_CL_UPLOAD,    // device: sample uploads
+  PHASE_CL_KERNEL,    // device: kernels
+  PHASE_CL_DOWNLOAD,  // device: reading the bins back
+  PHASE_COUNT
+} Profile_Phase;
+
+extern int profiler_active;
+
+long long profiler_now(void);
+void profiler_record(Profile_Phase phase, long long start, long long end);
+
+// Adds an interval measured elsewhere (e.g. by the device) to the device
+// track; `start` and `end` must already be on the profiler_now clock.
+void profiler_record_device(Profile_Phase phase, long long start, long long end);
+
+#ifdef PROFILER_DISABLED
+static inline long long profile_begin(void) { return 0; }
+static inline void profile_end(Profile_Phase phase, long long start) { (void)phase; (void)start; }
+#else
+static inline long long profile_begin(void) {
+  return profiler_active ? profiler_now() : 0;
+}
+
+static inline void profile_end(Profile_Phase phase, long long start) {
+  if (start) {
+    profiler_record(phase, start, profiler_now());
+  }
+}
+#endif
+
+// Starts collecting; with `trace` every interval is kept for the trace file.
+// The calling thread becomes the "main" track.
+void profiler_start(int trace);
+
+// Prints the breakdown collected so far: one line per phase with the call
+// count, the total over all threads, the mean per call, the largest share
+// of a single thread and the total as a percentage of the wall time since
+// profiler_start; then the busy time of each thread.
+void profiler_report(FILE* out);
+
+// Chrome trace event format (chrome://tracing, Perfetto). Returns -1 if the
+// file cannot be written.
+int profiler_write_trace(const char* filename);
+
+// Stops collecting and frees everything.
+void profiler_stop(void);
+
+const char* profile_phase_name(Profile_Phase phase);
+
+#endif
@@ -0,0 +1,430 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "signal_generator.h"
+
+#define HEADER_BYTES 44
+#define CHUNK_FRAMES (1L << 20)
+#define NOISE_SEED 0x5eed5eed5eed5eedULL
+
+#define LANES GENERATOR_LANES
+
+static void put_u16(unsigned char* p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put_u32(unsigned char* p, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = v >> (8 * i);
+  }
+}
+
+static void generate_wav_header(unsigned char* header, long frames, int channels) {
+  uint32_t data_size = (uint32_t)(frames * channels * BYTES_PER_SAMPLE);
+
+  // RIFF chunk
+  memcpy(header, "RIFF", 4);
+  put_u32(header + 4, data_size + HEADER_BYTES - 8);
+  memcpy(header + 8, "WAVE", 4);
+
+  // fmt subchunk
+  memcpy(header + 12, "fmt ", 4);
+  put_u32(header + 16, 16);
+  put_u16(header + 20, 1); // PCM
+  put_u16(header + 22, channels);
+  put_u32(header + 24, SAMPLE_RATE);
+  put_u32(header + 28, SAMPLE_RATE * channels * BYTES_PER_SAMPLE);
+  put_u16(header + 32, channels * BYTES_PER_SAMPLE);
+  put_u16(header + 34, BITS_PER_SAMPLE);
+
+  // data subchunk
+  memcpy(header + 36, "data", 4);
+  put_u32(header + 40, data_size);
+}
+
+// SplitMix64 of the sample index: uniform in [-1, 1).
+static double noise_sample(long index) {
+  uint64_t z = NOISE_SEED + (uint64_t)index * 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z ^= z >> 31;
+  return (double)(z >> 11) * (2.0 / 9007199254740992.0) - 1;
+}
+
+double sine_wave(double t, double frequency) {
+  return sin(2 * M_PI * frequency * t);
+}
+
+double sawtooth_wave(double t, double frequency) {
+  return 2 * (t * frequency - floor(0.5 + t * frequency));
+}
+
+double square_wave(double t, double frequency) {
+  return sin(2 * M_PI * frequency * t) >= 0 ? 1 : -1;
+}
+
+double triangle_wave(double t, double frequency) {
+  return 2 * fabs(2 * (t * frequency - floor(0.5 + t * frequency))) - 1;
+}
+
+double chirp(double t, double frequency) {
+  double f0 = 20, f1 = 20000;
+  return sin(2 * M_PI * (f0 * t + (f1 - f0) / (2 * t) * t * t));
+}
+
+double am_modulation(double t, double frequency) {
+  double carrier = sin(2 * M_PI * frequency * t);
+  double modulator = 0.5 * (1 + sin(2 * M_PI * 100 * t));
+  return carrier * modulator;
+}
+
+double fm_modulation(double t, double frequency) {
+  double modulation_index = 5;
+  double modulation_freq = 100;
+  return sin(2 * M_PI * frequency * t + modulation_index * sin(2 * M_PI * modulation_freq * t));
+}
+
+double white_noise(double t, double frequency) {
+  return noise_sample(lround(t * SAMPLE_RATE));
+}
+
+double harmonics(double t, double frequency) {
+  return sin(2 * M_PI * frequency * t) +
+         0.5 * sin(2 * M_PI * 2 * frequency * t) +
+         0.3 * sin(2 * M_PI * 3 * frequency * t) +
+         0.2 * sin(2 * M_PI * 4 * frequency * t);
+}
+
+double exponential_decay(double t, double frequency) {
+  double decay_rate = 5;
+  return sin(2 * M_PI * frequency * t) * exp(-decay_rate * t);
+}
+
+double pulse_train(double t, double frequency) {
+  double duty_cycle = 0.1;
+  return ((t * frequency) - floor(t * frequency)) < duty_cycle ? 1 : 0;
+}
+
+double sinc_function(double t, double frequency) {
+  double x = M_PI * frequency * (t - 0.5);
+  return sin(x) / x; // sinc function
+}
+
+// exp(2*pi*i * (cycles * n + offset)) for LANES consecutive samples n, and
+// the step that advances all lanes by LANES samples.
+typedef struct {
+  double re[LANES];
+  double im[LANES];
+  double step_re;
+  double step_im;
+} Rotor;
+
+static void start_rotor(Rotor* rotor, double cycles, double offset, long first) {
+  for (int l = 0; l < LANES; l++) {
+    double phase = cycles * (first + l) + offset;
+    phase = 2 * M_PI * (phase - floor(phase));
+    rotor->re[l] = cos(phase);
+    rotor->im[l] = sin(phase);
+  }
+  rotor->step_re = cos(2 * M_PI * cycles * LANES);
+  rotor->step_im = sin(2 * M_PI * cycles * LANES);
+}
+
+static inline void advance_rotor(Rotor* rotor) {
+  for (int l = 0; l < LANES; l++) {
+    double re = rotor->re[l] * rotor->step_re - rotor->im[l] * rotor->step_im;
+    rotor->im[l] = rotor->re[l] * rotor->step_im + rotor->im[l] * rotor->step_re;
+    rotor->re[l] = re;
+  }
+}
+
+static void sine_block(double frequency, long first, double* out) {
+  Rotor r;
+  start_rotor(&r, frequency / SAMPLE_RATE, 0, first);
+  for (int i = 0; i < GENERATOR_BLOCK; i += LANES) {
+    for (int l = 0; l < LANES; l++) {
+      out[i + l] = r.im[l];
+    }
+    advance_rotor(&r);
+  }
+}
+
+// The phase signals use the reference expressions; they are cheap already.
+static void sawtooth_block(double frequency, long first, double* out) {
+  for (int i = 0; i < GENERATOR_BLOCK; i++) {
+    out[i] = sawtooth_wave((double)(first + i) / SAMPLE_RATE, frequency);
+  }
+}
+
+static void square_block(double frequency, long first, double* out) {
+  for (int i = 0; i < GENERATOR_BLOCK; i++) {
+    double p = (double)(first + i) / SAMPLE_RATE * frequency;
+    out[i] = p - floor(p) <= 0.5 ? 1 : -1;
+  }
+}
+
+static void triangle_block(double frequency, long first, double* out) {
+  for (int i = 0; i < GENERATOR_BLOCK; i++) {
+    out[i] = triangle_wave((double)(first + i) / SAMPLE_RATE, frequency);
+  }
+}
+
+// The reference phase f0*t + (f1 - f0)/(2t) * t^2 is linear in t, i.e. a
+// sine at f0 + (f1 - f0)/2.
+static void chirp_block(double frequency, long first, double* out) {
+  double f0 = 20, f1 = 20000;
+  sine_block(f0 + (f1 - f0) / 2, first, out);
+}
+
+static void am_block(double frequency, long first, double* out) {
+  Rotor carrier, modulator;
+  start_rotor(&carrier, frequency / SAMPLE_RATE, 0, first);
+  start_rotor(&modulator, 100.0 / SAMPLE_RATE, 0, first);
+  for (int i = 0; i < GENERATOR_BLOCK; i += LANES) {
+    for (int l = 0; l < LANES; l++) {
+      out[i + l] = carrier.im[l] * 0.5 * (1 + modulator.im[l]);
+    }
+    advance_rotor(&carrier);
+    advance_rotor(&modulator);
+  }
+}
+
+// sin(c + 5 sin m): the carrier and modulator come from rotors, only the
+// modulation term needs a sin/cos per sample.
+static void fm_block(double frequency, long first, double* out) {
+  double modulation_index = 5;
+  Rotor carrier, modulator;
+  start_rotor(&carrier, frequency / SAMPLE_RATE, 0, first);
+  start_rotor(&modulator, 100.0 / SAMPLE_RATE, 0, first);
+  for (int i = 0; i < GENERATOR_BLOCK; i += LANES) {
+    for (int l = 0; l < LANES; l++) {
+      double b = modulation_index * modulator.im[l];
+      out[i + l] = carrier.im[l] * cos(b) + carrier.re[l] * sin(b);
+    }
+    advance_rotor(&carrier);
+    advance_rotor(&modulator);
+  }
+}
+
+static void noise_block(double frequency, long first, double* out) {
+  for (int i = 0; i < GENERATOR_BLOCK; i++) {
+    out[i] = noise_sample(first + i);
+  }
+}
+
+// sin(k x) = Im(z^k) for the rotor z = exp(i x).
+static void harmonics_block(double frequency, long first, double* out) {
+  Rotor r;
+  start_rotor(&r, frequency / SAMPLE_RATE, 0, first);
+  for (int i = 0; i < GENERATOR_BLOCK; i += LANES) {
+    for (int l = 0; l < LANES; l++) {
+      double re = r.re[l], im = r.im[l];
+      double re2 = re * re - im * im, im2 = 2 * re * im;
+      double im3 = re2 * im + im2 * re;
+      double im4 = 2 * re2 * im2;
+      out[i + l] = im + 0.5 * im2 + 0.3 * im3 + 0.2 * im4;
+    }
+    advance_rotor(&r);
+  }
+}
+
+static void decay_block(double frequency, long first, double* out) {
+  double decay_rate = 5;
+  Rotor r;
+  start_rotor(&r, frequency / SAMPLE_RATE, 0, first);
+  double envelope[LANES];
+  for (int l = 0; l < LANES; l++) {
+    envelope[l] = exp(-decay_rate * (first + l) / SAMPLE_RATE);
+  }
+  double step = exp(-decay_rate * LANES / SAMPLE_RATE);
+  for (int i = 0; i < GENERATOR_BLOCK; i += LANES) {
+    for (int l = 0; l < LANES; l++) {
+      out[i + l] = r.im[l] * envelope[l];
+      envelope[l] *= step;
+    }
+    advance_rotor(&r);
+  }
+}
+
+static void pulse_block(double frequency, long first, double* out) {
+  for (int i = 0; i < GENERATOR_BLOCK; i++) {
+    out[i] = pulse_train((double)(first + i) / SAMPLE_RATE, frequency);
+  }
+}
+
+// sin(x) / x with x = pi*f*(t - 0.5), i.e. sin(x) is a sine of f/2 Hz
+// starting at phase -f/4 cycles.
+static void sinc_block(double frequency, long first, double* out) {
+  Rotor r;
+  start_rotor(&r, frequency / 2 / SAMPLE_RATE, -frequency / 4, first);
+  for (int i = 0; i < GENERATOR_BLOCK; i += LANES) {
+    for (int l = 0; l < LANES; l++) {
+      double x = M_PI * frequency * ((double)(first + i + l) / SAMPLE_RATE - 0.5);
+      out[i + l] = x == 0 ? 1 : r.im[l] / x;
+    }
+    advance_rotor(&r);
+  }
+}
+
+static const Signal_Type signal_list[] = {
+  {"sine_wave", sine_wave, sine_block},
+  {"sawtooth_wave", sawtooth_wave, sawtooth_block},
+  {"square_wave", square_wave, square_block},
+  {"triangle_wave", triangle_wave, triangle_block},
+  {"chirp", chirp, chirp_block},
+  {"am_modulation", am_modulation, am_block},
+  {"fm_modulation", fm_modulation, fm_block},
+  {"white_noise", white_noise, noise_block},
+  {"harmonics", harmonics, harmonics_block},
+  {"exponential_decay", exponential_decay, decay_block},
+  {"pulse_train", pulse_train, pulse_block},
+  {"sinc_function", sinc_function, sinc_block},
+  {NULL, NULL, NULL}
+};
+
+const Signal_Type* signal_types(void) {
+  return signal_list;
+}
+
+const Signal_Type* find_signal(const char* name) {
+  for (const Signal_Type* type = signal_list; type->name; type++) {
+    if (strcmp(type->name, name) == 0) {
+      return type;
+    }
+  }
+  return NULL;
+}
+
+typedef struct {
+  const Wave_Spec* spec;
+  int fd;
+  long frames;
+  int index;
+  int threads;
+  atomic_int* failed;   // shared: the first write error stops every writer
+} Wave_Writer;
+
+// Generates chunks index, index + threads, ... and writes each at its place.
+static void* write_chunks(void* arg) {
+  Wave_Writer* writer = arg;
+  const Wave_Spec* spec = writer->spec;
+  int channels = spec->channels;
+  double* block = malloc(GENERATOR_BLOCK * sizeof(double));
+  int16_t* chunk = malloc(CHUNK_FRAMES * channels * sizeof(int16_t));
+
+  for (long first = (long)writer->index * CHUNK_FRAMES; first < writer->frames && !atomic_load(writer->failed);
+       first += (long)writer->threads * CHUNK_FRAMES) {
+    long frames = writer->frames - first < CHUNK_FRAMES ? writer->frames - first : CHUNK_FRAMES;
+    for (long done = 0; done < frames; done += GENERATOR_BLOCK) {
+      spec->signal->block(spec->frequency, first + done, block);
+      long count = frames - done < GENERATOR_BLOCK ? frames - done : GENERATOR_BLOCK;
+      int16_t* out = chunk + done * channels;
+      for (long i = 0; i < count; i++) {
+        double scaled = block[i] * 32767; // Convert to 16-bit PCM
+        scaled = scaled > 32767 ? 32767 : scaled < -32768 ? -32768 : scaled;
+        int16_t sample = (int16_t)scaled;
+        for (int c = 0; c < channels; c++) {
+          out[i * channels + c] = sample;
+        }
+      }
+    }
+
+    // Little endian on disk, like the hosts this runs on.
+    size_t size = frames * channels * sizeof(int16_t);
+    off_t position = HEADER_BYTES + first * channels * (off_t)sizeof(int16_t);
+    for (size_t written = 0; written < size;) {
+      ssize_t n = pwrite(writer->fd, (char*)chunk + written, size - written, position + written);
+      if (n <= 0) {
+        // Only the first error is reported; the other writers stop quietly.
+        if (!atomic_exchange(writer->failed, 1)) {
+          perror("Error writing file");
+        }
+        break;
+      }
+      written += n;
+    }
+  }
+
+  free(block);
+  free(chunk);
+  return NULL;
+}
+
+int write_wave(const char* filename, const Wave_Spec* spec) {
+  long frames = (long)(spec->duration * SAMPLE_RATE);
+  int channels = spec->channels;
+  if ((double)frames * channels * BYTES_PER_SAMPLE > 0xFFFFFFFFL - HEADER_BYTES) {
+    fprintf(stderr, "%s would exceed the 4 GB WAV limit\n", filename);
+    return -1;
+  }
+
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("Error opening file");
+    return -1;
+  }
+  unsigned char header[HEADER_BYTES];
+  generate_wav_header(header, frames, channels);
+  atomic_int failed = pwrite(fd, header, HEADER_BYTES, 0) != HEADER_BYTES ||
+                      ftruncate(fd, HEADER_BYTES + (off_t)frames * channels * BYTES_PER_SAMPLE) != 0;
+  if (failed) {
+    perror("Error writing file");
+  }
+
+  long chunks = (frames + CHUNK_FRAMES - 1) / CHUNK_FRAMES;
+  int threads = spec->threads > 0 ? spec->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  threads = threads < chunks ? threads : (int)(chunks > 0 ? chunks : 1);
+  Wave_Writer* writers = calloc(threads, sizeof(Wave_Writer));
+  pthread_t* ids = malloc(threads * sizeof(pthread_t));
+  // Every writer that was started is joined before `failed`, the writers
+  // or the file go away, whatever happened in the meantime.
+  int created = 0;
+  for (int t = 0; t < threads && !failed; t++) {
+    writers[t] = (Wave_Writer){spec, fd, frames, t, threads, &failed};
+    if (pthread_create(&ids[t], NULL, write_chunks, &writers[t]) != 0) {
+      // Its chunks would be missing; the others stop at their next chunk.
+      fprintf(stderr, "Error starting writer thread\n");
+      atomic_store(&failed, 1);
+      break;
+    }
+    created++;
+  }
+  for (int t = 0; t < created; t++) {
+    pthread_join(ids[t], NULL);
+  }
+  free(writers);
+  free(ids);
+
+  if (close(fd) != 0) {
+    perror("Error writing file");
+    return -1;
+  }
+  return failed ? -1 : 0;
+}
+
+double signal_block_deviation(const Signal_Type* signal, double frequency, long samples, long* mismatches) {
+  double* block = malloc(GENERATOR_BLOCK * sizeof(double));
+  double max = 0;
+  *mismatches = 0;
+  for (long first = 0; first < samples; first += GENERATOR_BLOCK) {
+    signal->block(frequency, first, block);
+    for (long i = 0; i < GENERATOR_BLOCK && first + i < samples; i++) {
+      double reference = signal->func((double)(first + i) / SAMPLE_RATE, frequency);
+      if (!isfinite(reference)) {
+        continue;
+      }
+      double deviation = fabs(block[i] - reference);
+      max = deviation > max ? deviation : max;
+      *mismatches += deviation > 1.0 / 32767;
+    }
+  }
+  free(block);
+  return max;
+}
@@ -0,0 +1,78 @@
+#ifndef SIGNAL_GENERATOR_H
+#define SIGNAL_GENERATOR_H
+
+// The test signals of aufgabe02, shared with the benchmark harness. Every
+// signal is a function of the time in seconds and a base frequency in Hz,
+// returning values in [-1, 1] (harmonics reaches about 1.7 and is clipped
+// when written).
+//
+// The per-sample functions are the reference definitions. write_wave uses
+// the block versions instead, which produce GENERATOR_BLOCK samples at a
+// time without a sin() per sample: sines come from complex rotors
+// (GENERATOR_LANES interleaved ones, multiplied by a fixed step, so the
+// loop vectorises), re-anchored with one exact sin/cos per lane and block;
+// sawtooth, square, triangle and pulse are evaluated from the phase
+// directly. White noise is a counter-based hash of the sample index, so the
+// output is identical whatever the number of threads.
+
+#define SAMPLE_RATE 44100
+#define BITS_PER_SAMPLE 16
+#define BYTES_PER_SAMPLE (BITS_PER_SAMPLE / 8)
+
+#define GENERATOR_BLOCK 4096
+#define GENERATOR_LANES 8
+
+// Bumped whenever the samples of any signal change, so that cached files of
+// an older generator can be told apart.
+#define SIGNAL_GENERATOR_VERSION 2
+
+typedef double (*Signal_Func)(double t, double frequency);
+
+// Samples first .. first + GENERATOR_BLOCK - 1 into `out`.
+typedef void (*Signal_Block)(double frequency, long first, double* out);
+
+typedef struct {
+  const char* name;
+  Signal_Func func;
+  Signal_Block block;
+} Signal_Type;
+
+typedef struct {
+  const Signal_Type* signal;
+  double duration;          // seconds
+  double frequency;         // Hz
+  int channels;             // 1, or 2 with the signal on both
+  int threads;              // <= 0 for one per core
+} Wave_Spec;
+
+double sine_wave(double t, double frequency);
+double sawtooth_wave(double t, double frequency);
+double square_wave(double t, double frequency);
+double triangle_wave(double t, double frequency);
+double chirp(double t, double frequency);
+double am_modulation(double t, double frequency);
+double fm_modulation(double t, double frequency);
+double white_noise(double t, double frequency);
+double harmonics(double t, double frequency);
+double exponential_decay(double t, double frequency);
+double pulse_train(double t, double frequency);
+double sinc_function(double t, double frequency);
+
+// Looks a signal up by the name of its function, e.g. "am_modulation";
+// NULL if unknown.
+const Signal_Type* find_signal(const char* name);
+
+// NULL-terminated list of all signals.
+const Signal_Type* signal_types(void);
+
+// Writes the signal as 16-bit PCM WAV: threads generate 1M-frame chunks
+// and pwrite them at their offsets. Returns 0, or -1 if the file cannot be
+// written or would exceed the 4 GB RIFF limit.
+int write_wave(const char* filename, const Wave_Spec* spec);
+
+// Largest difference between the block version and the reference function
+// over the first `samples` samples (where the reference is finite), and the
+// number of samples that differ by more than one 16-bit step.
+double signal_block_deviation(const Signal_Type* signal, double frequency, long samples, long* mismatches);
+
+#endif
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "spectrogram_writer.h"
+
+// About 4 MB per write: large enough for full disk bandwidth, small enough
+// that the first chunk goes out early.
+#define CHUNK_BYTES (4L << 20)
+
+static void put_u32(unsigned char* p, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = v >> (8 * i);
+  }
+}
+
+static void put_u64(unsigned char* p, uint64_t v) {
+  for (int i = 0; i < 8; i++) {
+    p[i] = v >> (8 * i);
+  }
+}
+
+static void put_f32(unsigned char* p, float v) {
+  uint32_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  put_u32(p, bits);
+}
+
+// IEEE binary16, round to nearest even; overflow gives infinity.
+static uint16_t float_to_half(float value) {
+  uint32_t x;
+  memcpy(&x, &value, sizeof(x));
+  uint32_t sign = (x >> 16) & 0x8000;
+  int biased = (x >> 23) & 0xff;
+  uint32_t mantissa = x & 0x7fffff;
+  if (biased == 0xff) {
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  }
+  int exponent = biased - 127 + 15;
+  if (exponent >= 31) {
+    return sign | 0x7c00;
+  }
+  if (exponent <= 0) {
+    // Subnormal half, or zero.
+    if (exponent < -10) {
+      return sign;
+    }
+    mantissa |= 0x800000;
+    int shift = 14 - exponent;
+    uint32_t half = mantissa >> shift;
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1))) {
+      half++;
+    }
+    return sign | half;
+  }
+  uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+  uint32_t rest = mantissa & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+    half++; // a carry into the exponent is the correct rounding
+  }
+  return half;
+}
+
+static int write_all(int fd, const unsigned char* data, long size) {
+  while (size > 0) {
+    ssize_t n = write(fd, data, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      perror("Error writing spectrogram");
+      return -1;
+    }
+    data += n;
+    size -= n;
+  }
+  return 0;
+}
+
+static void* write_chunks(void* arg) {
+  Spectrogram_Writer* writer = arg;
+  pthread_mutex_lock(&writer->lock);
+  for (;;) {
+    while (writer->pending == 0 && !writer->stop) {
+      pthread_cond_wait(&writer->changed, &writer->lock);
+    }
+    if (writer->pending == 0) {
+      break;
+    }
+    const unsigned char* data = writer->buffer[1 - writer->current];
+    long size = writer->pending;
+    pthread_mutex_unlock(&writer->lock);
+
+    int err = writer->failed ? 0 : write_all(writer->fd, data, size);
+
+    pthread_mutex_lock(&writer->lock);
+    if (err) {
+      writer->failed = 1;
+    }
+    writer->pending = 0;
+    pthread_cond_broadcast(&writer->changed);
+  }
+  pthread_mutex_unlock(&writer->lock);
+  return NULL;
+}
+
+// Hands the current buffer to the writer thread once the previous one is
+// written, and continues in the other buffer.
+static void hand_off(Spectrogram_Writer* writer) {
+  pthread_mutex_lock(&writer->lock);
+  while (writer->pending > 0) {
+    pthread_cond_wait(&writer->changed, &writer->lock);
+  }
+  writer->pending = writer->filled * writer->bins * writer->value_size;
+  writer->current = 1 - writer->current;
+  writer->filled = 0;
+  pthread_cond_broadcast(&writer->changed);
+  pthread_mutex_unlock(&writer->lock);
+}
+
+int parse_spectrogram_format(const char* name, Spectrogram_Format* format) {
+  if (strcmp(name, "f32") == 0) {
+    *format = SPECTROGRAM_F32;
+  } else if (strcmp(name, "f16") == 0) {
+    *format = SPECTROGRAM_F16;
+  } else if (strcmp(name, "u8") == 0) {
+    *format = SPECTROGRAM_U8_DB;
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+static void encode_header(const Spectrogram_Writer* writer, uint64_t frames, unsigned char* out) {
+  const Spectrogram_Header* header = &writer->header;
+  memset(out, 0, SPECTROGRAM_HEADER_SIZE);
+  memcpy(out, "STFTSPEC", 8);
+  put_u32(out + 8, 1);
+  put_u32(out + 12, header->format);
+  put_u32(out + 16, header->blocksize);
+  put_u32(out + 20, header->shift);
+  put_u32(out + 24, header->sample_rate);
+  put_u32(out + 28, writer->bins);
+  put_u32(out + 32, header->window);
+  put_f32(out + 36, header->kaiser_beta);
+  put_f32(out + 40, header->db_min);
+  put_f32(out + 44, header->db_max);
+  put_u64(out + 48, frames);
+}
+
+Spectrogram_Writer* create_spectrogram_writer(const char* path, const Spectrogram_Header* header) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("Error opening spectrogram file");
+    return NULL;
+  }
+
+  Spectrogram_Writer* writer = calloc(1, sizeof(Spectrogram_Writer));
+  writer->fd = fd;
+  writer->header = *header;
+  writer->bins = header->blocksize / 2;
+  writer->value_size = header->format == SPECTROGRAM_F32 ? 4 : header->format == SPECTROGRAM_F16 ? 2 : 1;
+  long frame_bytes = (long)writer->bins * writer->value_size;
+  writer->chunk_frames = CHUNK_BYTES / frame_bytes > 0 ? CHUNK_BYTES / frame_bytes : 1;
+  for (int i = 0; i < 2; i++) {
+    writer->buffer[i] = malloc(writer->chunk_frames * frame_bytes);
+  }
+  writer->magnitude = malloc(writer->bins * sizeof(double));
+
+  unsigned char encoded[SPECTROGRAM_HEADER_SIZE];
+  encode_header(writer, 0, encoded);
+  writer->failed = write_all(fd, encoded, SPECTROGRAM_HEADER_SIZE) != 0;
+
+  pthread_mutex_init(&writer->lock, NULL);
+  pthread_cond_init(&writer->changed, NULL);
+  pthread_create(&writer->thread, NULL, write_chunks, writer);
+  return writer;
+}
+
+// Encodes one frame of magnitudes into the current buffer.
+static void encode_frame(Spectrogram_Writer* writer, const double* magnitude) {
+  long index = writer->filled * writer->bins;
+  int bins = writer->bins;
+  if (writer->header.format == SPECTROGRAM_F32) {
+    float* out = (float*)writer->buffer[writer->current] + index;
+    for (int i = 0; i < bins; i++) {
+      out[i] = (float)magnitude[i];
+    }
+  } else if (writer->header.format == SPECTROGRAM_F16) {
+    uint16_t* out = (uint16_t*)writer->buffer[writer->current] + index;
+    for (int i = 0; i < bins; i++) {
+      out[i] = float_to_half((float)magnitude[i]);
+    }
+  } else {
+    unsigned char* out = writer->buffer[writer->current] + index;
+    double scale = 255 / (writer->header.db_max - writer->header.db_min);
+    for (int i = 0; i < bins; i++) {
+      double level = (20 * log10(magnitude[i]) - writer->header.db_min) * scale;
+      out[i] = level <= 0 ? 0 : level >= 255 ? 255 : (unsigned char)lrint(level);
+    }
+  }
+
+  writer->frames++;
+  if (++writer->filled == writer->chunk_frames) {
+    hand_off(writer);
+  }
+}
+
+void spectrogram_writer_append(Spectrogram_Writer* writer, const double* spectra, long frames, int stride) {
+  double* magnitude = writer->magnitude;
+  for (long f = 0; f < frames; f++) {
+    const double* x = spectra + 2 * f * stride;
+    for (int i = 0; i < writer->bins; i++) {
+      magnitude[i] = sqrt(x[2 * i] * x[2 * i] + x[2 * i + 1] * x[2 * i + 1]);
+    }
+    encode_frame(writer, magnitude);
+  }
+}
+
+void spectrogram_writer_append_float(Spectrogram_Writer* writer, const float* spectra, long frames, int stride) {
+  double* magnitude = writer->magnitude;
+  for (long f = 0; f < frames; f++) {
+    const float* x = spectra + 2 * f * stride;
+    for (int i = 0; i < writer->bins; i++) {
+      magnitude[i] = sqrt((double)x[2 * i] * x[2 * i] + (double)x[2 * i + 1] * x[2 * i + 1]);
+    }
+    encode_frame(writer, magnitude);
+  }
+}
+
+int close_spectrogram_writer(Spectrogram_Writer* writer) {
+  hand_off(writer);
+  pthread_mutex_lock(&writer->lock);
+  writer->stop = 1;
+  pthread_cond_broadcast(&writer->changed);
+  pthread_mutex_unlock(&writer->lock);
+  pthread_join(writer->thread, NULL);
+
+  // Seekable outputs get the real frame count; pipes keep 0.
+  int failed = writer->failed;
+  if (!failed && lseek(writer->fd, 0, SEEK_CUR) >= 0) {
+    unsigned char encoded[SPECTROGRAM_HEADER_SIZE];
+    encode_header(writer, writer->frames, encoded);
+    if (pwrite(writer->fd, encoded, SPECTROGRAM_HEADER_SIZE, 0) != SPECTROGRAM_HEADER_SIZE) {
+      perror("Error writing spectrogram header");
+      failed = 1;
+    }
+  }
+  if (close(writer->fd) != 0) {
+    perror("Error closing spectrogram file");
+    failed = 1;
+  }
+
+  pthread_cond_destroy(&writer->changed);
+  pthread_mutex_destroy(&writer->lock);
+  free(writer->buffer[0]);
+  free(writer->buffer[1]);
+  free(writer->magnitude);
+  free(writer);
+  return failed ? -1 : 0;
+}
@@ -0,0 +1,90 @@
+#ifndef SPECTROGRAM_WRITER_H
+#define SPECTROGRAM_WRITER_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+// Streams the full STFT magnitude matrix (frames x bins) to a file while the
+// transforms run. Frames are encoded straight from the FFT output into one of
+// two chunk buffers; a writer thread writes the full one with large
+// sequential write() calls while the caller fills the other, so the disk and
+// the FFT overlap and memory stays at two chunks however long the input is.
+//
+// File layout (little endian):
+//
+//   offset  size  field
+//        0     8  magic "STFTSPEC"
+//        8     4  version (1)
+//       12     4  format: 0 float32 |X|, 1 float16 |X|, 2 uint8 dB
+//       16     4  blocksize
+//       20     4  shift
+//       24     4  sample rate
+//       28     4  bins per frame (blocksize / 2)
+//       32     4  window (Window_Type)
+//       36     4  float32 Kaiser beta
+//       40     4  float32 dB of uint8 value 0
+//       44     4  float32 dB of uint8 value 255
+//       48     8  frames, 0 if unknown (output was a FIFO)
+//       56     8  reserved
+//       64        frames * bins values, frame after frame
+//
+// |X| is unnormalised like the bins (a full-scale sine reads blocksize / 2).
+// uint8 values are 20*log10|X| mapped linearly onto [db_min, db_max] and
+// clamped.
+
+#define SPECTROGRAM_HEADER_SIZE 64
+
+typedef enum {
+  SPECTROGRAM_F32,
+  SPECTROGRAM_F16,
+  SPECTROGRAM_U8_DB
+} Spectrogram_Format;
+
+typedef struct {
+  Spectrogram_Format format;
+  int blocksize;
+  int shift;
+  int sample_rate;
+  int window;            // Window_Type
+  double kaiser_beta;
+  double db_min;         // SPECTROGRAM_U8_DB only
+  double db_max;
+} Spectrogram_Header;
+
+typedef struct {
+  int fd;
+  Spectrogram_Header header;
+  int bins;
+  int value_size;
+  long chunk_frames;
+  unsigned char* buffer[2];
+  int current;           // buffer the caller fills
+  long filled;           // frames in the current buffer
+  long frames;           // frames appended in total
+  double* magnitude;     // one frame before encoding
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  long pending;          // bytes of buffer[1 - current] still to be written, 0 if idle
+  int stop;
+  int failed;            // a write failed; later frames are dropped
+} Spectrogram_Writer;
+
+// "f32", "f16" or "u8"; returns 0 if unknown.
+int parse_spectrogram_format(const char* name, Spectrogram_Format* format);
+
+// Creates (truncates) `path`, which may also be a FIFO. Returns NULL if it
+// cannot be opened.
+Spectrogram_Writer* create_spectrogram_writer(const char* path, const Spectrogram_Header* header);
+
+// Appends `frames` spectra of `stride` interleaved complex values each; the
+// first blocksize / 2 values of every spectrum are one frame.
+void spectrogram_writer_append(Spectrogram_Writer* writer, const double* spectra, long frames, int stride);
+void spectrogram_writer_append_float(Spectrogram_Writer* writer, const float* spectra, long frames, int stride);
+
+// Writes what is left, fills in the frame count and closes the file.
+// Returns -1 if any write failed.
+int close_spectrogram_writer(Spectrogram_Writer* writer);
+
+#endif
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "spectrum_stats.h"
+
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+int parse_stats_request(const char* list, Stats_Request* request) {
+  memset(request, 0, sizeof(Stats_Request));
+  char* copy = strdup(list);
+  char* saveptr = NULL;
+  int ok = 1;
+  for (char* name = strtok_r(copy, ",", &saveptr); name && ok; name = strtok_r(NULL, ",", &saveptr)) {
+    double percentile;
+    char end;
+    if (strcmp(name, "max") == 0) {
+      request->stats |= STAT_MAX;
+    } else if (strcmp(name, "min") == 0) {
+      request->stats |= STAT_MIN;
+    } else if (strcmp(name, "var") == 0) {
+      request->stats |= STAT_VARIANCE;
+    } else if (strcmp(name, "psd") == 0) {
+      request->stats |= STAT_PSD;
+    } else if (strcmp(name, "median") == 0 ||
+               (name[0] == 'p' && sscanf(name + 1, "%lf%c", &percentile, &end) == 1)) {
+      if (name[0] == 'm') {
+        percentile = 50;
+      }
+      ok = percentile > 0 && percentile < 100 && request->percentiles < MAX_PERCENTILES;
+      if (ok) {
+        request->stats |= STAT_PERCENTILE;
+        request->probability[request->percentiles++] = percentile / 100;
+      }
+    } else {
+      ok = 0;
+    }
+  }
+  free(copy);
+  return ok;
+}
+
+Spectrum_Stats* create_spectrum_stats(const Stats_Request* request, int blocksize, const double* window) {
+  Spectrum_Stats* stats = calloc(1, sizeof(Spectrum_Stats));
+  stats->request = *request;
+  stats->blocksize = blocksize;
+  stats->bins_size = blocksize / 2;
+  int bins_size = stats->bins_size;
+
+  stats->window_power = window ? 0 : blocksize;
+  for (int i = 0; window && i < blocksize; i++) {
+    stats->window_power += window[i] * window[i];
+  }
+
+  stats->sum = calloc(bins_size, sizeof(double));
+  stats->sum_squares = calloc(bins_size, sizeof(double));
+  stats->magnitude = malloc(bins_size * sizeof(double));
+  if (request->stats & STAT_MAX) {
+    stats->max = malloc(bins_size * sizeof(double));
+  }
+  if (request->stats & STAT_MIN) {
+    stats->min = malloc(bins_size * sizeof(double));
+  }
+  if (request->stats & STAT_PERCENTILE) {
+    stats->sketches = malloc((size_t)request->percentiles * bins_size * sizeof(P2_Sketch));
+  }
+  return stats;
+}
+
+void destroy_spectrum_stats(Spectrum_Stats* stats) {
+  free(stats->sum);
+  free(stats->sum_squares);
+  free(stats->max);
+  free(stats->min);
+  free(stats->sketches);
+  free(stats->magnitude);
+  free(stats);
+}
+
+static int compare_doubles(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+// The first five observations are simply collected in `height`; the sixth
+// sorts them into the initial markers.
+static void p2_start(P2_Sketch* sketch, double p) {
+  qsort(sketch->height, 5, sizeof(double), compare_doubles);
+  for (int i = 0; i < 5; i++) {
+    sketch->position[i] = i;
+  }
+  sketch->desired[0] = 0;
+  sketch->desired[1] = 2 * p;
+  sketch->desired[2] = 4 * p;
+  sketch->desired[3] = 2 + 2 * p;
+  sketch->desired[4] = 4;
+}
+
+static void p2_add(P2_Sketch* sketch, double p, double x) {
+  double* q = sketch->height;
+  int* n = sketch->position;
+
+  int k;
+  if (x < q[0]) {
+    q[0] = x;
+    k = 0;
+  } else if (x >= q[4]) {
+    q[4] = x;
+    k = 3;
+  } else {
+    for (k = 0; x >= q[k + 1]; k++) {
+    }
+  }
+  for (int i = k + 1; i < 5; i++) {
+    n[i]++;
+  }
+  const double increment[5] = {0, p / 2, p, (1 + p) / 2, 1};
+  for (int i = 0; i < 5; i++) {
+    sketch->desired[i] += increment[i];
+  }
+
+  // Move the middle markers towards their desired positions, by one step
+  // at most, along the parabola through the neighbours if it stays between
+  // them and linearly otherwise.
+  for (int i = 1; i < 4; i++) {
+    double d = sketch->desired[i] - n[i];
+    if ((d >= 1 && n[i + 1] - n[i] > 1) || (d <= -1 && n[i - 1] - n[i] < -1)) {
+      int s = d > 0 ? 1 : -1;
+      double parabolic = q[i] + (double)s / (n[i + 1] - n[i - 1]) *
+        ((n[i] - n[i - 1] + s) * (q[i + 1] - q[i]) / (n[i + 1] - n[i]) +
+         (n[i + 1] - n[i] - s) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+      if (q[i - 1] < parabolic && parabolic < q[i + 1]) {
+        q[i] = parabolic;
+      } else {
+        q[i] += s * (q[i + s] - q[i]) / (n[i + s] - n[i]);
+      }
+      n[i] += s;
+    }
+  }
+}
+
+static double p2_value(const P2_Sketch* sketch, double p, long count) {
+  if (count > 5) {
+    return sketch->height[2];
+  }
+  double sorted[5];
+  memcpy(sorted, sketch->height, count * sizeof(double));
+  qsort(sorted, count, sizeof(double), compare_doubles);
+  return sorted[MIN((long)(p * count), count - 1)];
+}
+
+// Folds the magnitudes of one window into every statistic.
+static void add_window(Spectrum_Stats* stats) {
+  int bins_size = stats->bins_size;
+  const double* magnitude = stats->magnitude;
+  long index = stats->windows;
+
+  for (int i = 0; i < bins_size; i++) {
+    stats->sum[i] += magnitude[i];
+    stats->sum_squares[i] += magnitude[i] * magnitude[i];
+  }
+  if (stats->max) {
+    for (int i = 0; i < bins_size; i++) {
+      stats->max[i] = index == 0 ? magnitude[i] : MAX(stats->max[i], magnitude[i]);
+    }
+  }
+  if (stats->min) {
+    for (int i = 0; i < bins_size; i++) {
+      stats->min[i] = index == 0 ? magnitude[i] : MIN(stats->min[i], magnitude[i]);
+    }
+  }
+  for (int j = 0; stats->sketches && j < stats->request.percentiles; j++) {
+    double p = stats->request.probability[j];
+    P2_Sketch* sketches = stats->sketches + (size_t)j * bins_size;
+    for (int i = 0; i < bins_size; i++) {
+      if (index < 5) {
+        sketches[i].height[index] = magnitude[i];
+        continue;
+      }
+      if (index == 5) {
+        p2_start(&sketches[i], p);
+      }
+      p2_add(&sketches[i], p, magnitude[i]);
+    }
+  }
+  stats->windows++;
+}
+
+void spectrum_stats_add(Spectrum_Stats* stats, const double* spectra, long frames, int stride) {
+  for (long f = 0; f < frames; f++) {
+    const double* spectrum = spectra + 2 * f * stride;
+    for (int i = 0; i < stats->bins_size; i++) {
+      stats->magnitude[i] = sqrt(spectrum[2 * i] * spectrum[2 * i] + spectrum[2 * i + 1] * spectrum[2 * i + 1]);
+    }
+    add_window(stats);
+  }
+}
+
+void spectrum_stats_add_float(Spectrum_Stats* stats, const float* spectra, long frames, int stride) {
+  for (long f = 0; f < frames; f++) {
+    const float* spectrum = spectra + 2 * f * stride;
+    for (int i = 0; i < stats->bins_size; i++) {
+      double re = spectrum[2 * i];
+      double im = spectrum[2 * i + 1];
+      stats->magnitude[i] = sqrt(re * re + im * im);
+    }
+    add_window(stats);
+  }
+}
+
+void print_spectrum_stats(const Spectrum_Stats* stats, int sample_rate, int threshold) {
+  const Stats_Request* request = &stats->request;
+  long count = stats->windows;
+  if (count == 0) {
+    return;
+  }
+
+  printf("# freq mean");
+  if (stats->max) {
+    printf(" max");
+  }
+  if (stats->min) {
+    printf(" min");
+  }
+  if (request->stats & STAT_VARIANCE) {
+    printf(" var");
+  }
+  for (int j = 0; stats->sketches && j < request->percentiles; j++) {
+    printf(" p%g", request->probability[j] * 100);
+  }
+  if (request->stats & STAT_PSD) {
+    printf(" psd");
+  }
+  printf("\n");
+
+  for (int i = 0; i < stats->bins_size; i++) {
+    double mean = stats->sum[i] / count;
+    if (20 * log10(mean) <= threshold) {
+      continue;
+    }
+    printf("%dHz %f", (int)((long)i * sample_rate / stats->blocksize), 20 * log10(mean));
+    if (stats->max) {
+      printf(" %f", 20 * log10(stats->max[i]));
+    }
+    if (stats->min) {
+      printf(" %f", 20 * log10(stats->min[i]));
+    }
+    if (request->stats & STAT_VARIANCE) {
+      // Sample variance; sums of |X| and |X|^2 rather than Welford, since
+      // the spread of a magnitude spectrum is never tiny against its mean.
+      double variance = count > 1 ? MAX(stats->sum_squares[i] - mean * stats->sum[i], 0) / (count - 1) : 0;
+      printf(" %f", 10 * log10(variance));
+    }
+    for (int j = 0; stats->sketches && j < request->percentiles; j++) {
+      const P2_Sketch* sketch = stats->sketches + (size_t)j * stats->bins_size + i;
+      printf(" %f", 20 * log10(p2_value(sketch, request->probability[j], count)));
+    }
+    if (request->stats & STAT_PSD) {
+      // Both halves of the spectrum except for DC (and Nyquist, which is
+      // not among the printed bins).
+      double psd = stats->sum_squares[i] / count / (sample_rate * stats->window_power);
+      printf(" %f", 10 * log10(i == 0 ? psd : 2 * psd));
+    }
+    printf("\n");
+  }
+  printf("\n");
+}
@@ -0,0 +1,75 @@
+#ifndef SPECTRUM_STATS_H
+#define SPECTRUM_STATS_H
+
+// Per-bin statistics over all windows, gathered in the same pass as the mean
+// (the FFTW engine hands every batch of spectra to spectrum_stats_add):
+//
+//   max, min     max-/min-hold of |X|
+//   var          variance of |X| over the windows
+//   p<q>/median  q-th percentile of |X|, from a P^2 sketch per bin (Jain and
+//                Chlamtac), so memory is O(bins) however many windows there are
+//   psd          Welch power spectral density: the windows are the Welch
+//                segments (overlap blocksize - shift, with the analysis window),
+//                scaled to |X|^2 / (fs * sum w^2), one-sided
+//
+// Percentile sketches cannot be merged, so one Spectrum_Stats must see the
+// windows of a file in order from a single thread.
+
+#define MAX_PERCENTILES 8
+
+typedef enum {
+  STAT_MAX = 1 << 0,
+  STAT_MIN = 1 << 1,
+  STAT_VARIANCE = 1 << 2,
+  STAT_PERCENTILE = 1 << 3,
+  STAT_PSD = 1 << 4
+} Spectrum_Stat;
+
+// Five markers of the P^2 estimate of one quantile of one bin.
+typedef struct {
+  double height[5];
+  double desired[5];
+  int position[5];
+} P2_Sketch;
+
+typedef struct {
+  unsigned stats;          // Spectrum_Stat bits
+  int percentiles;
+  double probability[MAX_PERCENTILES];
+} Stats_Request;
+
+typedef struct {
+  Stats_Request request;
+  int blocksize;
+  int bins_size;
+  double window_power;     // sum of the squared window coefficients
+  long windows;
+
+  double* sum;             // |X|
+  double* sum_squares;     // |X|^2
+  double* max;
+  double* min;
+  P2_Sketch* sketches;     // percentiles * bins_size, percentile major
+  double* magnitude;       // the current window
+} Spectrum_Stats;
+
+// Comma separated list of max, min, var, median, p<q> (0 < q < 100) and psd,
+// e.g. "max,min,p10,median,p90,psd". Returns 0 if malformed.
+int parse_stats_request(const char* list, Stats_Request* request);
+
+// `window` points to the blocksize coefficients the spectra were computed
+// with, or NULL for a rectangular window.
+Spectrum_Stats* create_spectrum_stats(const Stats_Request* request, int blocksize, const double* window);
+void destroy_spectrum_stats(Spectrum_Stats* stats);
+
+// Adds `frames` spectra of `stride` interleaved complex values each.
+void spectrum_stats_add(Spectrum_Stats* stats, const double* spectra, long frames, int stride);
+void spectrum_stats_add_float(Spectrum_Stats* stats, const float* spectra, long frames, int stride);
+
+// Prints a "#" line naming the columns, then "<freq>Hz <mean> <stat> ..." for
+// every bin whose mean is above `threshold`. Magnitude statistics are in dB
+// (20*log10), the variance as 10*log10(var) and the PSD in dB/Hz relative to
+// full scale.
+void print_spectrum_stats(const Spectrum_Stats* stats, int sample_rate, int threshold);
+
+#endif
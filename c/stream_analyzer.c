@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "fftw_batch.h"
+#include "fftw_wisdom.h"
+#include "pcm_stream.h"
+#include "precision.h"
+#include "window_function.h"
+
+// Live variant of aufgabe01: reads PCM (WAV or raw) from stdin or a FIFO and
+// transforms one window per hop as soon as its `shift` new samples have
+// arrived. The bins are kept as a running mean over all windows so far and,
+// with --ema, as an exponential moving average that follows changes.
+//
+// Usage: stream_analyzer [--raw <fmt>:<rate>:<channels>] [--channel <n|mix>]
+//                        [--ema <alpha>] [--interval <ms>]
+//                        [--precision <double|single>] [--window <name>]
+//                        [--wisdom-dir <dir> | --no-wisdom]
+//                        <blocksize> <shift> <threshold> [<input>|-]
+//
+// Every `interval` ms of stream time (default 1000, 0 for none) a report is
+// printed and flushed: a "#" line with the stream time, the window count and
+// the processing time per hop against the hop's real-time budget, then the
+// bins above the threshold as "<freq>Hz <mean dB> [<ema dB>]" and a blank
+// line. A result is therefore at most one hop plus its processing time old.
+// At the end of the input the final mean is printed like aufgabe01 prints
+// it, so it can be checked against a file run with compare_bins.
+
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+#define DEFAULT_INTERVAL_MS 1000
+
+typedef struct {
+  long hops;
+  double total;  // seconds
+  double max;
+} Hop_Times;
+
+typedef struct {
+  int blocksize;
+  int shift;
+  int threshold;
+  int sample_rate;
+  int bins_size;
+  double ema_alpha;      // 0: no moving average
+  FFTW_Batch* engine;
+
+  double* frame;         // the last blocksize samples
+  double* window_bins;   // |X| of the newest window
+  double* sum;           // running sums for the mean
+  double* ema;
+  long windows;
+
+  Hop_Times interval;    // since the last report
+  Hop_Times overall;
+  double max_latency;    // of the reports, in seconds
+} Stream_Analyzer;
+
+double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void add_hop_time(Hop_Times* times, double elapsed) {
+  times->hops++;
+  times->total += elapsed;
+  times->max = MAX(times->max, elapsed);
+}
+
+Stream_Analyzer* create_stream_analyzer(int blocksize, int shift, int threshold, Precision precision,
+                                        const Window_Spec* window_spec, const char* wisdom_dir) {
+  Stream_Analyzer* analyzer = calloc(1, sizeof(Stream_Analyzer));
+  analyzer->blocksize = MAX(blocksize, 2);
+  analyzer->shift = MAX(MIN(analyzer->blocksize, shift), 1);
+  analyzer->threshold = threshold;
+  analyzer->bins_size = analyzer->blocksize / 2;
+
+  // Plan before the first sample arrives, so it does not count as latency.
+  fftw_wisdom_import(wisdom_dir, analyzer->blocksize);
+  double* window = create_window(window_spec, analyzer->blocksize);
+  analyzer->engine = create_fftw_batch(analyzer->blocksize, analyzer->shift, FFTW_WISDOM_FLAGS, precision, window);
+  // Every hop is a call of its own, and the sliding DFT re-anchors with a
+  // full FFT at the start of each call, so it would only add its updates.
+  analyzer->engine->sliding = 0;
+  free(window);
+  fftw_wisdom_export(wisdom_dir, analyzer->blocksize);
+
+  analyzer->frame = malloc(analyzer->blocksize * sizeof(double));
+  analyzer->window_bins = malloc(analyzer->bins_size * sizeof(double));
+  analyzer->sum = calloc(analyzer->bins_size, sizeof(double));
+  analyzer->ema = calloc(analyzer->bins_size, sizeof(double));
+  return analyzer;
+}
+
+void destroy_stream_analyzer(Stream_Analyzer* analyzer) {
+  destroy_fftw_batch(analyzer->engine);
+  fftw_batch_cleanup();
+  free(analyzer->frame);
+  free(analyzer->window_bins);
+  free(analyzer->sum);
+  free(analyzer->ema);
+  free(analyzer);
+}
+
+// Transforms the current frame and folds it into the mean and the average.
+void analyze_frame(Stream_Analyzer* analyzer) {
+  memset(analyzer->window_bins, 0, analyzer->bins_size * sizeof(double));
+  fftw_batch_accumulate_samples(analyzer->engine, analyzer->frame, 1, analyzer->window_bins);
+
+  double alpha = analyzer->windows == 0 ? 1 : analyzer->ema_alpha;
+  for (int i = 0; i < analyzer->bins_size; i++) {
+    analyzer->sum[i] += analyzer->window_bins[i];
+    analyzer->ema[i] += alpha * (analyzer->window_bins[i] - analyzer->ema[i]);
+  }
+  analyzer->windows++;
+}
+
+void print_bins(const Stream_Analyzer* analyzer, int with_ema) {
+  for (int i = 0; i < analyzer->bins_size; i++) {
+    double mean = 20 * log10(analyzer->sum[i] / analyzer->windows);
+    double ema = 20 * log10(analyzer->ema[i]);
+    if (mean > analyzer->threshold || (with_ema && ema > analyzer->threshold)) {
+      int freq = (int)((long)i * analyzer->sample_rate / analyzer->blocksize);
+      if (with_ema) {
+        printf("%dHz %f %f\n", freq, mean, ema);
+      } else {
+        printf("%dHz %f\n", freq, mean);
+      }
+    }
+  }
+  printf("\n");
+}
+
+void print_hop_times(const Stream_Analyzer* analyzer, const Hop_Times* times) {
+  double budget = (double)analyzer->shift / analyzer->sample_rate;
+  double mean = times->hops ? times->total / times->hops : 0;
+  printf("hop %.3f ms, processing mean %.3f ms, max %.3f ms (%.1f%% of real time)",
+         budget * 1e3, mean * 1e3, times->max * 1e3, 100 * mean / budget);
+}
+
+void print_report(Stream_Analyzer* analyzer, double received) {
+  double stream_time = ((double)(analyzer->windows - 1) * analyzer->shift + analyzer->blocksize) / analyzer->sample_rate;
+  printf("# %.3f s, %ld windows, ", stream_time, analyzer->windows);
+  print_hop_times(analyzer, &analyzer->interval);
+  printf("\n");
+  print_bins(analyzer, analyzer->ema_alpha > 0);
+  fflush(stdout);
+  memset(&analyzer->interval, 0, sizeof(Hop_Times));
+
+  // From the arrival of the newest hop until its report is out.
+  analyzer->max_latency = MAX(analyzer->max_latency, now_seconds() - received);
+}
+
+// Runs until the input ends. Returns -1 on a read error.
+int run_stream(Stream_Analyzer* analyzer, PCM_Stream* input, int interval_ms) {
+  analyzer->sample_rate = input->layout.sample_rate;
+  long report_windows = MAX((long)interval_ms * analyzer->sample_rate / 1000 / analyzer->shift, 1);
+
+  // The first window needs a full frame, every later one `shift` new samples.
+  long n = pcm_stream_read(input, analyzer->blocksize, analyzer->frame);
+  if (n < analyzer->blocksize) {
+    return n < 0 ? -1 : 0;
+  }
+  int keep = analyzer->blocksize - analyzer->shift;
+  for (;;) {
+    double received = now_seconds();
+    analyze_frame(analyzer);
+    double elapsed = now_seconds() - received;
+    add_hop_time(&analyzer->interval, elapsed);
+    add_hop_time(&analyzer->overall, elapsed);
+
+    if (interval_ms > 0 && analyzer->windows % report_windows == 0) {
+      print_report(analyzer, received);
+    }
+
+    memmove(analyzer->frame, analyzer->frame + analyzer->shift, keep * sizeof(double));
+    n = pcm_stream_read(input, analyzer->shift, analyzer->frame + keep);
+    if (n < analyzer->shift) {
+      return n < 0 ? -1 : 0;
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  static struct option options[] = {
+    {"raw", required_argument, NULL, 'r'},
+    {"channel", required_argument, NULL, 'c'},
+    {"ema", required_argument, NULL, 'e'},
+    {"interval", required_argument, NULL, 'i'},
+    {"precision", required_argument, NULL, 'P'},
+    {"window", required_argument, NULL, 'W'},
+    {"wisdom-dir", required_argument, NULL, 'w'},
+    {"no-wisdom", no_argument, NULL, 'n'},
+    {NULL, 0, NULL, 0}
+  };
+
+  int raw = 0;
+  WAV_Format format = WAV_PCM_S16;
+  int sample_rate = 44100;
+  int channels = 2;
+  int channel = 0;
+  double ema_alpha = 0;
+  int interval_ms = DEFAULT_INTERVAL_MS;
+  Precision precision = PRECISION_DOUBLE;
+  Window_Spec window = {WINDOW_RECTANGULAR, DEFAULT_KAISER_BETA};
+  const char* wisdom_dir = fftw_wisdom_default_dir();
+  int opt;
+  while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+    switch (opt) {
+    case 'r':
+      if (!parse_pcm_layout(optarg, &format, &sample_rate, &channels)) {
+        fprintf(stderr, "Invalid raw layout: %s (expected e.g. s16:48000:2)\n", optarg);
+        return 1;
+      }
+      raw = 1;
+      break;
+    case 'c':
+      channel = strcmp(optarg, "mix") == 0 ? WAV_DOWNMIX : atoi(optarg);
+      break;
+    case 'e':
+      ema_alpha = atof(optarg);
+      if (!(ema_alpha > 0 && ema_alpha <= 1)) {
+        fprintf(stderr, "EMA alpha must be in (0, 1]\n");
+        return 1;
+      }
+      break;
+    case 'i':
+      interval_ms = atoi(optarg);
+      break;
+    case 'P':
+      if (!parse_precision(optarg, &precision)) {
+        fprintf(stderr, "Unknown precision: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'W':
+      if (!parse_window(optarg, &window)) {
+        fprintf(stderr, "Unknown window: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'w':
+      wisdom_dir = optarg;
+      break;
+    case 'n':
+      wisdom_dir = NULL;
+      break;
+    default:
+      return 1;
+    }
+  }
+
+  int positional = argc - optind;
+  if (positional != 3 && positional != 4) {
+    fprintf(stderr, "Usage: %s [--raw <fmt>:<rate>:<channels>] [--channel <n|mix>] [--ema <alpha>] [--interval <ms>] [--precision <double|single>] [--window <name>] [--wisdom-dir <dir> | --no-wisdom] <blocksize> <shift> <threshold> [<input>|-]\n", argv[0]);
+    return 1;
+  }
+  char** args = argv + optind;
+
+  int fd = STDIN_FILENO;
+  if (positional == 4 && strcmp(args[3], "-") != 0) {
+    fd = open(args[3], O_RDONLY);
+    if (fd < 0) {
+      perror("Error opening input");
+      return 1;
+    }
+  }
+
+  Stream_Analyzer* analyzer = create_stream_analyzer(atoi(args[0]), atoi(args[1]), atoi(args[2]), precision, &window, wisdom_dir);
+  analyzer->ema_alpha = ema_alpha;
+
+  double start = now_seconds();
+  PCM_Stream* input = raw ? open_raw_pcm_stream(fd, format, sample_rate, channels, channel)
+                          : open_pcm_stream(fd, channel);
+  if (!input) {
+    destroy_stream_analyzer(analyzer);
+    return 1;
+  }
+
+  int status = run_stream(analyzer, input, interval_ms);
+  double elapsed = now_seconds() - start;
+
+  if (analyzer->windows > 0) {
+    print_bins(analyzer, 0);
+    printf("%ld windows, ", analyzer->windows);
+    print_hop_times(analyzer, &analyzer->overall);
+    if (interval_ms > 0) {
+      printf(", report latency max %.3f ms", analyzer->max_latency * 1e3);
+    }
+    printf("\n");
+  }
+  printf("Execution time: %f seconds\n", elapsed);
+
+  close_pcm_stream(input);
+  if (fd != STDIN_FILENO) {
+    close(fd);
+  }
+  destroy_stream_analyzer(analyzer);
+  return status < 0;
+}
@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include "thread_pool.h"
+
+typedef struct {
+  Thread_Pool* pool;
+  int index;
+} Worker_Start;
+
+static void* run_worker(void* arg) {
+  Worker_Start* start = arg;
+  Thread_Pool* pool = start->pool;
+  int index = start->index;
+  free(start);
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->head && !pool->stop) {
+      pthread_cond_wait(&pool->work_ready, &pool->lock);
+    }
+    if (!pool->head) {
+      break;
+    }
+    Pool_Job* job = pool->head;
+    pool->head = job->next;
+    if (!pool->head) {
+      pool->tail = NULL;
+    }
+    pool->running++;
+    pthread_mutex_unlock(&pool->lock);
+
+    job->task(job->arg, index);
+    free(job);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->running--;
+    if (!pool->head && pool->running == 0) {
+      pthread_cond_broadcast(&pool->idle);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+Thread_Pool* create_thread_pool(int threads) {
+  Thread_Pool* pool = calloc(1, sizeof(Thread_Pool));
+  pool->threads = threads > 0 ? threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (pool->threads < 1) {
+    pool->threads = 1;
+  }
+  pool->workers = malloc(pool->threads * sizeof(pthread_t));
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_ready, NULL);
+  pthread_cond_init(&pool->idle, NULL);
+
+  for (int i = 0; i < pool->threads; i++) {
+    Worker_Start* start = malloc(sizeof(Worker_Start));
+    start->pool = pool;
+    start->index = i;
+    pthread_create(&pool->workers[i], NULL, run_worker, start);
+  }
+  return pool;
+}
+
+void destroy_thread_pool(Thread_Pool* pool) {
+  thread_pool_wait(pool);
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->work_ready);
+  pthread_mutex_unlock(&pool->lock);
+  for (int i = 0; i < pool->threads; i++) {
+    pthread_join(pool->workers[i], NULL);
+  }
+
+  pthread_cond_destroy(&pool->idle);
+  pthread_cond_destroy(&pool->work_ready);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->workers);
+  free(pool);
+}
+
+void thread_pool_submit(Thread_Pool* pool, Pool_Task task, void* arg) {
+  Pool_Job* job = malloc(sizeof(Pool_Job));
+  job->task = task;
+  job->arg = arg;
+  job->next = NULL;
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->tail) {
+    pool->tail->next = job;
+  } else {
+    pool->head = job;
+  }
+  pool->tail = job;
+  pthread_cond_signal(&pool->work_ready);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_wait(Thread_Pool* pool) {
+  pthread_mutex_lock(&pool->lock);
+  while (pool->head || pool->running > 0) {
+    pthread_cond_wait(&pool->idle, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,43 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+
+// Fixed set of worker threads that live as long as the pool, so repeated
+// work (one call per file) does not pay pthread_create/join every time.
+// Tasks get the index of the worker running them, which lets callers keep
+// per-worker state such as FFT engines and partial bins.
+typedef void (*Pool_Task)(void* arg, int worker);
+
+typedef struct Pool_Job {
+  Pool_Task task;
+  void* arg;
+  struct Pool_Job* next;
+} Pool_Job;
+
+typedef struct {
+  int threads;
+  pthread_t* workers;
+
+  pthread_mutex_t lock;
+  pthread_cond_t work_ready;   // a job was queued, or the pool stops
+  pthread_cond_t idle;         // the last running job finished
+  Pool_Job* head;
+  Pool_Job* tail;
+  int running;                 // jobs taken and not finished yet
+  int stop;
+} Thread_Pool;
+
+// threads <= 0 uses one worker per online CPU.
+Thread_Pool* create_thread_pool(int threads);
+
+// Waits for the queued jobs, then stops and joins the workers.
+void destroy_thread_pool(Thread_Pool* pool);
+
+// Queues `task(arg, worker)`; jobs start in submission order.
+void thread_pool_submit(Thread_Pool* pool, Pool_Task task, void* arg);
+
+// Blocks until no job is queued or running.
+void thread_pool_wait(Thread_Pool* pool);
+
+#endif
@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "wav_reader.h"
+
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+static unsigned read_u16(const unsigned char* p) {
+  return p[0] | (p[1] << 8);
+}
+
+static unsigned long read_u32(const unsigned char* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+// Single-sample loaders, shared by the generic and downmix loops.
+static inline double load_u8(const unsigned char* p) {
+  return (p[0] - 128) / 128.0;
+}
+
+static inline double load_s16(const unsigned char* p) {
+  short v;
+  memcpy(&v, p, sizeof(v));
+  return v / 32768.0;
+}
+
+static inline double load_s24(const unsigned char* p) {
+  int v = p[0] | (p[1] << 8) | ((signed char)p[2] * 65536);
+  return v / 8388608.0;
+}
+
+static inline double load_s32(const unsigned char* p) {
+  int v;
+  memcpy(&v, p, sizeof(v));
+  return v / 2147483648.0;
+}
+
+static inline double load_f32(const unsigned char* p) {
+  float v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline double load_f64(const unsigned char* p) {
+  double v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// One loop pair per format: picking a channel and averaging all of them.
+// The branch on the format is taken once per file when the function pointer
+// is chosen, never per sample.
+#define DEFINE_DECODE(name, size, load)                                                         \
+  static void decode_##name(const unsigned char* frames, long count, int channels, int channel, double* out) { \
+    const unsigned char* p = frames + channel * size;                                             \
+    long step = (long)channels * size;                                                           \
+    for (long i = 0; i < count; i++) {                                                            \
+      out[i] = load(p + i * step);                                                                \
+    }                                                                                             \
+  }                                                                                               \
+  static void decode_##name##_downmix(const unsigned char* frames, long count, int channels, int channel, double* out) { \
+    long step = (long)channels * size;                                                           \
+    double scale = 1.0 / channels;                                                                \
+    for (long i = 0; i < count; i++) {                                                            \
+      double sum = 0;                                                                             \
+      for (int c = 0; c < channels; c++) {                                                        \
+        sum += load(frames + i * step + c * size);                                                \
+      }                                                                                           \
+      out[i] = sum * scale;                                                                       \
+    }                                                                                             \
+  }
+
+DEFINE_DECODE(u8, 1, load_u8)
+DEFINE_DECODE(s16, 2, load_s16)
+DEFINE_DECODE(s24, 3, load_s24)
+DEFINE_DECODE(s32, 4, load_s32)
+DEFINE_DECODE(f32, 4, load_f32)
+DEFINE_DECODE(f64, 8, load_f64)
+
+#ifdef __SSE2__
+// Stores four int32 lanes as doubles scaled by `scale`.
+static inline void store_epi32_pd(double* out, __m128i v, __m128d scale) {
+  _mm_storeu_pd(out, _mm_mul_pd(_mm_cvtepi32_pd(v), scale));
+  _mm_storeu_pd(out + 2, _mm_mul_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2))), scale));
+}
+
+// Scaling by a power of two is exact, so these match the scalar loops bit
+// for bit.
+static void decode_s16_mono_sse2(const unsigned char* frames, long count, int channels, int channel, double* out) {
+  const __m128d scale = _mm_set1_pd(1.0 / 32768.0);
+  long i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(frames + i * 2));
+    store_epi32_pd(out + i, _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16), scale);
+    store_epi32_pd(out + i + 4, _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16), scale);
+  }
+  decode_s16(frames + i * 2, count - i, 1, 0, out + i);
+}
+
+static void decode_s16_stereo_sse2(const unsigned char* frames, long count, int channels, int channel, double* out) {
+  const __m128d scale = _mm_set1_pd(1.0 / 32768.0);
+  long i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(frames + i * 4));
+    // Each 32-bit lane holds one frame: left in the low, right in the high half.
+    __m128i s = channel == 0 ? _mm_srai_epi32(_mm_slli_epi32(v, 16), 16) : _mm_srai_epi32(v, 16);
+    store_epi32_pd(out + i, s, scale);
+  }
+  decode_s16(frames + i * 4, count - i, 2, channel, out + i);
+}
+
+static void decode_s16_stereo_downmix_sse2(const unsigned char* frames, long count, int channels, int channel, double* out) {
+  const __m128d scale = _mm_set1_pd(0.5 / 32768.0);
+  const __m128i ones = _mm_set1_epi16(1);
+  long i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(frames + i * 4));
+    store_epi32_pd(out + i, _mm_madd_epi16(v, ones), scale); // left + right per frame
+  }
+  decode_s16_downmix(frames + i * 4, count - i, 2, channel, out + i);
+}
+
+static void decode_f32_mono_sse2(const unsigned char* frames, long count, int channels, int channel, double* out) {
+  long i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 v = _mm_loadu_ps((const float*)(frames + i * 4));
+    _mm_storeu_pd(out + i, _mm_cvtps_pd(v));
+    _mm_storeu_pd(out + i + 2, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+  }
+  decode_f32(frames + i * 4, count - i, 1, 0, out + i);
+}
+#endif
+
+WAV_Decode wav_select_decode(WAV_Format format, int channels, int channel) {
+  int downmix = channel == WAV_DOWNMIX && channels > 1;
+  switch (format) {
+  case WAV_PCM_U8:
+    return downmix ? decode_u8_downmix : decode_u8;
+  case WAV_PCM_S16:
+#ifdef __SSE2__
+    if (channels == 1) {
+      return decode_s16_mono_sse2;
+    }
+    if (channels == 2) {
+      return downmix ? decode_s16_stereo_downmix_sse2 : decode_s16_stereo_sse2;
+    }
+#endif
+    return downmix ? decode_s16_downmix : decode_s16;
+  case WAV_PCM_S24:
+    return downmix ? decode_s24_downmix : decode_s24;
+  case WAV_PCM_S32:
+    return downmix ? decode_s32_downmix : decode_s32;
+  case WAV_FLOAT32:
+#ifdef __SSE2__
+    if (channels == 1) {
+      return decode_f32_mono_sse2;
+    }
+#endif
+    return downmix ? decode_f32_downmix : decode_f32;
+  case WAV_FLOAT64:
+    return downmix ? decode_f64_downmix : decode_f64;
+  }
+  return NULL;
+}
+
+const char* wav_format_name(WAV_Format format) {
+  switch (format) {
+  case WAV_PCM_U8: return "PCM u8";
+  case WAV_PCM_S16: return "PCM s16";
+  case WAV_PCM_S24: return "PCM s24";
+  case WAV_PCM_S32: return "PCM s32";
+  case WAV_FLOAT32: return "float32";
+  case WAV_FLOAT64: return "float64";
+  }
+  return "unknown";
+}
+
+int wav_parse_fmt(WAV_Reader* reader, const unsigned char* fmt, long fmt_size) {
+  unsigned tag = read_u16(fmt);
+  reader->channels = read_u16(fmt + 2);
+  reader->sample_rate = read_u32(fmt + 4);
+  reader->block_align = read_u16(fmt + 12);
+  reader->bits_per_sample = read_u16(fmt + 14);
+  if (tag == WAVE_FORMAT_EXTENSIBLE && fmt_size >= 40) {
+    tag = read_u16(fmt + 24); // first two bytes of the SubFormat GUID
+  }
+
+  int bits = reader->bits_per_sample;
+  if (tag == WAVE_FORMAT_PCM && bits == 8) {
+    reader->format = WAV_PCM_U8;
+  } else if (tag == WAVE_FORMAT_PCM && bits == 16) {
+    reader->format = WAV_PCM_S16;
+  } else if (tag == WAVE_FORMAT_PCM && bits == 24) {
+    reader->format = WAV_PCM_S24;
+  } else if (tag == WAVE_FORMAT_PCM && bits == 32) {
+    reader->format = WAV_PCM_S32;
+  } else if (tag == WAVE_FORMAT_IEEE_FLOAT && bits == 32) {
+    reader->format = WAV_FLOAT32;
+  } else if (tag == WAVE_FORMAT_IEEE_FLOAT && bits == 64) {
+    reader->format = WAV_FLOAT64;
+  } else {
+    fprintf(stderr, "Unsupported WAV format: tag 0x%04x, %d bits\n", tag, bits);
+    return -1;
+  }
+
+  // The decode loops step channels * bits / 8 bytes per frame; padded
+  // frames would be read misaligned.
+  if (reader->channels < 1 || reader->block_align != reader->channels * bits / 8) {
+    fprintf(stderr, "Malformed WAV file: %d channels, block align %d\n", reader->channels, reader->block_align);
+    return -1;
+  }
+  return 0;
+}
+
+// Walks the RIFF chunk list. Returns 1 if the file has no RIFF/WAVE header,
+// -1 if it has one that cannot be used, 0 on success.
+static int parse_riff(WAV_Reader* reader) {
+  const unsigned char* file = reader->map;
+  long size = reader->map_size;
+  if (size < 12 || memcmp(file, "RIFF", 4) != 0 || memcmp(file + 8, "WAVE", 4) != 0) {
+    return 1;
+  }
+
+  const unsigned char* fmt = NULL;
+  long fmt_size = 0;
+  long position = 12;
+  while (position + 8 <= size) {
+    const unsigned char* chunk = file + position;
+    long chunk_size = read_u32(chunk + 4);
+
+    if (memcmp(chunk, "fmt ", 4) == 0) {
+      fmt = chunk + 8;
+      fmt_size = chunk_size;
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      reader->data_offset = position + 8;
+      // Writers that stream their output often leave the size unpatched.
+      if (chunk_size > size - reader->data_offset) {
+        chunk_size = size - reader->data_offset;
+      }
+      break;
+    }
+    position += 8 + chunk_size + (chunk_size & 1); // chunks are padded to even sizes
+  }
+
+  if (!fmt || fmt_size < 16 || fmt + fmt_size > file + size || reader->data_offset == 0) {
+    fprintf(stderr, "Malformed WAV file: missing fmt or data chunk\n");
+    return -1;
+  }
+
+  if (wav_parse_fmt(reader, fmt, fmt_size) != 0) {
+    return -1;
+  }
+
+  long data_size = read_u32(file + reader->data_offset - 4);
+  if (data_size > size - reader->data_offset) {
+    data_size = size - reader->data_offset;
+  }
+  reader->samples = data_size / reader->block_align;
+  return 0;
+}
+
+WAV_Reader* open_wav_reader(const char* filename, int channel) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    perror("Error opening file");
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    perror("Error reading file size");
+    close(fd);
+    return NULL;
+  }
+
+  WAV_Reader* reader = calloc(1, sizeof(WAV_Reader));
+  reader->fd = fd;
+  reader->map_size = st.st_size;
+
+  if (reader->map_size > 0) {
+    reader->map = mmap(NULL, reader->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (reader->map == MAP_FAILED) {
+      perror("Error mapping file");
+      close(fd);
+      free(reader);
+      return NULL;
+    }
+    // Windows are walked front to back; let the kernel read ahead and drop
+    // pages behind us.
+    madvise(reader->map, reader->map_size, MADV_SEQUENTIAL);
+  }
+
+  int status = parse_riff(reader);
+  if (status < 0) {
+    close_wav_reader(reader);
+    return NULL;
+  }
+  if (status > 0) {
+    // Headerless input: interleaved stereo int16.
+    reader->format = WAV_PCM_S16;
+    reader->channels = 2;
+    reader->sample_rate = 44100;
+    reader->bits_per_sample = 16;
+    reader->block_align = 4;
+    reader->data_offset = 0;
+    reader->samples = reader->map_size / 4;
+  }
+
+  if (channel != WAV_DOWNMIX && (channel < 0 || channel >= reader->channels)) {
+    fprintf(stderr, "Channel %d out of range, file has %d channels\n", channel, reader->channels);
+    close_wav_reader(reader);
+    return NULL;
+  }
+  // Downmixing a single channel is just that channel.
+  reader->channel = (channel == WAV_DOWNMIX && reader->channels == 1) ? 0 : channel;
+  reader->data = (const unsigned char*)reader->map + reader->data_offset;
+  reader->decode = wav_select_decode(reader->format, reader->channels, reader->channel);
+
+  return reader;
+}
+
+void close_wav_reader(WAV_Reader* reader) {
+  if (reader->map) {
+    munmap(reader->map, reader->map_size);
+  }
+  close(reader->fd);
+  free(reader);
+}
+
+void wav_reader_prefetch(const WAV_Reader* reader) {
+  if (!reader->map) {
+    return;
+  }
+  posix_fadvise(reader->fd, reader->data_offset, reader->samples * reader->block_align, POSIX_FADV_WILLNEED);
+  madvise(reader->map, reader->map_size, MADV_WILLNEED);
+}
@@ -0,0 +1,72 @@
+#ifndef WAV_READER_H
+#define WAV_READER_H
+
+#include "profiler.h"
+
+// Read-only, memory-mapped view of a RIFF/WAVE file. The chunk list is walked
+// to find "fmt " and "data"; nothing is copied or converted up front. One
+// channel (or the downmix of all of them) is converted to doubles window by
+// window with a decode loop specialised for the sample format, so the
+// resident set is bounded by the pages the FFT loop is currently touching.
+//
+// Files without a RIFF header are read as raw interleaved stereo int16 at
+// 44100 Hz, the layout the analyzers assumed before.
+
+#define WAV_DOWNMIX -1
+
+typedef enum {
+  WAV_PCM_U8,
+  WAV_PCM_S16,
+  WAV_PCM_S24,
+  WAV_PCM_S32,
+  WAV_FLOAT32,
+  WAV_FLOAT64
+} WAV_Format;
+
+// Converts `count` frames starting at `frames` to doubles in [-1, 1).
+typedef void (*WAV_Decode)(const unsigned char* frames, long count, int channels, int channel, double* out);
+
+typedef struct {
+  int fd;
+  void* map;
+  long map_size;
+
+  WAV_Format format;
+  int channels;
+  int channel;          // selected channel, or WAV_DOWNMIX
+  int sample_rate;
+  int bits_per_sample;
+  int block_align;      // bytes per frame
+
+  long data_offset;     // file offset of the first frame
+  const unsigned char* data;
+  long samples;         // number of frames
+  WAV_Decode decode;    // chosen once per file for format/channels/channel
+} WAV_Reader;
+
+WAV_Reader* open_wav_reader(const char* filename, int channel);
+void close_wav_reader(WAV_Reader* reader);
+
+const char* wav_format_name(WAV_Format format);
+
+// Asks the kernel to start reading the sample data into the page cache and
+// returns immediately, e.g. for the next files of a batch while the current
+// ones are being analyzed.
+void wav_reader_prefetch(const WAV_Reader* reader);
+
+// Fills format, channels, sample_rate, block_align and bits_per_sample from
+// the body of a "fmt " chunk. Returns -1 (with a message) if the layout is
+// not supported.
+int wav_parse_fmt(WAV_Reader* reader, const unsigned char* fmt, long fmt_size);
+
+// Picks the decode loop for a sample layout.
+WAV_Decode wav_select_decode(WAV_Format format, int channels, int channel);
+
+// Converts `count` frames of the selected channel starting at frame `offset`.
+static inline void wav_reader_read(const WAV_Reader* reader, long offset, long count, double* out) {
+  long long start = profile_begin();
+  reader->decode(reader->data + offset * reader->block_align, count, reader->channels, reader->channel, out);
+  profile_end(PHASE_CONVERT, start);
+}
+
+#endif
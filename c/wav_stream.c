@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "wav_stream.h"
+#include "profiler.h"
+
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+// Reads and decodes `count` frames starting at frame `index`.
+static int read_samples(WAV_Stream* stream, long index, long count, double* out) {
+  const WAV_Reader* reader = stream->reader;
+  if (count <= 0) {
+    return 0;
+  }
+
+  long size = count * reader->block_align;
+  long position = reader->data_offset + index * reader->block_align;
+  long done = 0;
+  long long start = profile_begin();
+  while (done < size) {
+    ssize_t n = pread(reader->fd, stream->raw + done, size - done, position + done);
+    if (n <= 0) {
+      perror("Error reading file");
+      return -1;
+    }
+    done += n;
+  }
+  profile_end(PHASE_READ, start);
+
+  start = profile_begin();
+  reader->decode(stream->raw, count, reader->channels, reader->channel, out);
+  profile_end(PHASE_CONVERT, start);
+  return 0;
+}
+
+static void* read_chunks(void* arg) {
+  WAV_Stream* stream = arg;
+  const WAV_Chunk* previous = NULL;
+  long next_window = stream->first_window;
+
+  while (next_window < stream->total_windows) {
+    pthread_mutex_lock(&stream->lock);
+    while (stream->filled == stream->slots && !stream->stop) {
+      pthread_cond_wait(&stream->changed, &stream->lock);
+    }
+    if (stream->stop) {
+      pthread_mutex_unlock(&stream->lock);
+      break;
+    }
+    WAV_Chunk* chunk = &stream->ring[(stream->head + stream->filled) % stream->slots];
+    pthread_mutex_unlock(&stream->lock);
+
+    chunk->first_window = next_window;
+    chunk->windows = MIN(stream->chunk_windows, stream->total_windows - next_window);
+    chunk->length = (chunk->windows - 1) * stream->shift + stream->blocksize;
+
+    // The head of this chunk is the tail of the previous one. That slot is
+    // not reused before the ring wraps around, so copy it instead of
+    // reading it again.
+    long start = next_window * stream->shift;
+    long overlap = 0;
+    if (previous) {
+      long previous_start = previous->first_window * stream->shift;
+      overlap = previous_start + previous->length - start;
+      memcpy(chunk->data, previous->data + previous->length - overlap, overlap * sizeof(double));
+    }
+    int err = read_samples(stream, start + overlap, chunk->length - overlap, chunk->data + overlap);
+
+    pthread_mutex_lock(&stream->lock);
+    if (err) {
+      stream->failed = 1;
+      pthread_mutex_unlock(&stream->lock);
+      break;
+    }
+    stream->filled++;
+    pthread_cond_broadcast(&stream->changed);
+    pthread_mutex_unlock(&stream->lock);
+
+    previous = chunk;
+    next_window += chunk->windows;
+  }
+
+  pthread_mutex_lock(&stream->lock);
+  stream->finished = 1;
+  pthread_cond_broadcast(&stream->changed);
+  pthread_mutex_unlock(&stream->lock);
+  return NULL;
+}
+
+WAV_Stream* open_wav_stream(const WAV_Reader* reader, int blocksize, int shift, long first_window, long chunk_windows, int slots) {
+  WAV_Stream* stream = calloc(1, sizeof(WAV_Stream));
+  stream->reader = reader;
+  stream->blocksize = blocksize;
+  stream->shift = shift;
+  stream->first_window = first_window;
+  stream->total_windows = reader->samples >= blocksize ? (reader->samples - blocksize) / shift + 1 : 0;
+  stream->chunk_windows = chunk_windows;
+  stream->chunk_samples = (chunk_windows - 1) * shift + blocksize;
+  stream->slots = slots < 2 ? 2 : slots; // the reader copies the overlap out of the previous slot
+
+  stream->ring = calloc(stream->slots, sizeof(WAV_Chunk));
+  for (int i = 0; i < stream->slots; i++) {
+    stream->ring[i].data = malloc(stream->chunk_samples * sizeof(double));
+  }
+  stream->raw = malloc(stream->chunk_samples * reader->block_align);
+
+  pthread_mutex_init(&stream->lock, NULL);
+  pthread_cond_init(&stream->changed, NULL);
+  pthread_create(&stream->thread, NULL, read_chunks, stream);
+  return stream;
+}
+
+void close_wav_stream(WAV_Stream* stream) {
+  pthread_mutex_lock(&stream->lock);
+  stream->stop = 1;
+  pthread_cond_broadcast(&stream->changed);
+  pthread_mutex_unlock(&stream->lock);
+  pthread_join(stream->thread, NULL);
+
+  pthread_cond_destroy(&stream->changed);
+  pthread_mutex_destroy(&stream->lock);
+  for (int i = 0; i < stream->slots; i++) {
+    free(stream->ring[i].data);
+  }
+  free(stream->ring);
+  free(stream->raw);
+  free(stream);
+}
+
+WAV_Chunk* wav_stream_next(WAV_Stream* stream) {
+  long long start = profile_begin();
+  pthread_mutex_lock(&stream->lock);
+  while (stream->filled == 0 && !stream->finished) {
+    pthread_cond_wait(&stream->changed, &stream->lock);
+  }
+  profile_end(PHASE_WAIT, start);
+  WAV_Chunk* chunk = stream->filled > 0 ? &stream->ring[stream->head] : NULL;
+  pthread_mutex_unlock(&stream->lock);
+  return chunk;
+}
+
+void wav_stream_release(WAV_Stream* stream, WAV_Chunk* chunk) {
+  pthread_mutex_lock(&stream->lock);
+  stream->head = (stream->head + 1) % stream->slots;
+  stream->filled--;
+  pthread_cond_broadcast(&stream->changed);
+  pthread_mutex_unlock(&stream->lock);
+}
@@ -0,0 +1,54 @@
+#ifndef WAV_STREAM_H
+#define WAV_STREAM_H
+
+#include <pthread.h>
+#include "wav_reader.h"
+
+// Two-stage pipeline for inputs larger than RAM: a reader thread preads the
+// selected channel into a ring of fixed-size chunks while the caller transforms
+// the previous ones. Consecutive chunks overlap by blocksize - shift samples,
+// so every window lies completely inside exactly one chunk and the windows
+// of all chunks together are exactly the windows of the whole file.
+typedef struct {
+  long first_window;  // index of the chunk's first window in the file
+  long windows;       // windows that start in this chunk
+  long length;        // valid samples in data
+  double* data;
+} WAV_Chunk;
+
+typedef struct {
+  const WAV_Reader* reader;
+  int blocksize;
+  int shift;
+  long first_window;    // window the stream starts with
+  long total_windows;
+  long chunk_windows;   // windows per full chunk
+  long chunk_samples;   // (chunk_windows - 1) * shift + blocksize
+
+  int slots;
+  WAV_Chunk* ring;
+  unsigned char* raw;   // pread buffer of the reader thread
+  int head;             // next slot the consumer takes
+  int filled;           // slots produced and not yet released
+  int finished;         // reader thread produced the last chunk
+  int failed;           // a read error ended the stream early
+  int stop;             // consumer is closing the stream
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+} WAV_Stream;
+
+// Streams the windows from `first_window` on (0 for the whole file, later to
+// resume an interrupted analysis). chunk_windows should be a multiple of the
+// consumer's batch size; slots bounds the memory to slots * chunk_samples
+// doubles.
+WAV_Stream* open_wav_stream(const WAV_Reader* reader, int blocksize, int shift, long first_window, long chunk_windows, int slots);
+void close_wav_stream(WAV_Stream* stream);
+
+// Blocks until the next chunk is available. Returns NULL after the last
+// chunk. The chunk stays valid until wav_stream_release.
+WAV_Chunk* wav_stream_next(WAV_Stream* stream);
+void wav_stream_release(WAV_Stream* stream, WAV_Chunk* chunk);
+
+#endif
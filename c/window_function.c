@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "window_function.h"
+
+#define PI 3.14159265358979323846
+
+int parse_window(const char* name, Window_Spec* spec) {
+  static const struct {
+    const char* name;
+    Window_Type type;
+  } names[] = {
+    {"rectangular", WINDOW_RECTANGULAR}, {"none", WINDOW_RECTANGULAR},
+    {"hann", WINDOW_HANN}, {"hamming", WINDOW_HAMMING},
+    {"blackman-harris", WINDOW_BLACKMAN_HARRIS}, {"kaiser", WINDOW_KAISER},
+    {"flat-top", WINDOW_FLAT_TOP}
+  };
+
+  spec->kaiser_beta = DEFAULT_KAISER_BETA;
+  if (strncmp(name, "kaiser:", 7) == 0) {
+    char* end;
+    spec->kaiser_beta = strtod(name + 7, &end);
+    spec->type = WINDOW_KAISER;
+    return *end == '\0' && spec->kaiser_beta >= 0;
+  }
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strcmp(name, names[i].name) == 0) {
+      spec->type = names[i].type;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+const char* window_name(Window_Type type) {
+  switch (type) {
+  case WINDOW_RECTANGULAR: return "rectangular";
+  case WINDOW_HANN: return "hann";
+  case WINDOW_HAMMING: return "hamming";
+  case WINDOW_BLACKMAN_HARRIS: return "blackman-harris";
+  case WINDOW_KAISER: return "kaiser";
+  case WINDOW_FLAT_TOP: return "flat-top";
+  }
+  return "unknown";
+}
+
+// sum_j (-1)^j a[j] cos(j x)
+static double cosine_sum(const double* a, int terms, double x) {
+  double value = 0;
+  for (int j = 0; j < terms; j++) {
+    value += (j % 2 ? -a[j] : a[j]) * cos(j * x);
+  }
+  return value;
+}
+
+// Modified Bessel function of the first kind, order 0 (power series).
+static double bessel_i0(double x) {
+  double term = 1;
+  double sum = 1;
+  for (int k = 1; term > 1e-17 * sum; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+double* create_window(const Window_Spec* spec, int size) {
+  static const double hann[] = {0.5, 0.5};
+  static const double hamming[] = {0.54, 0.46};
+  static const double blackman_harris[] = {0.35875, 0.48829, 0.14128, 0.01168};
+  static const double flat_top[] = {0.21557895, 0.41663158, 0.277263158, 0.083578947, 0.006947368};
+
+  if (spec->type == WINDOW_RECTANGULAR) {
+    return NULL;
+  }
+
+  double* window = malloc(size * sizeof(double));
+  double sum = 0;
+  for (int i = 0; i < size; i++) {
+    double x = 2 * PI * i / size;
+    switch (spec->type) {
+    case WINDOW_HANN:
+      window[i] = cosine_sum(hann, 2, x);
+      break;
+    case WINDOW_HAMMING:
+      window[i] = cosine_sum(hamming, 2, x);
+      break;
+    case WINDOW_BLACKMAN_HARRIS:
+      window[i] = cosine_sum(blackman_harris, 4, x);
+      break;
+    case WINDOW_FLAT_TOP:
+      window[i] = cosine_sum(flat_top, 5, x);
+      break;
+    case WINDOW_KAISER: {
+      double r = 2.0 * i / size - 1;
+      window[i] = bessel_i0(spec->kaiser_beta * sqrt(1 - r * r)) / bessel_i0(spec->kaiser_beta);
+      break;
+    }
+    case WINDOW_RECTANGULAR:
+      window[i] = 1;
+      break;
+    }
+    sum += window[i];
+  }
+
+  // Coherent gain correction.
+  double scale = size / sum;
+  for (int i = 0; i < size; i++) {
+    window[i] *= scale;
+  }
+  return window;
+}
@@ -0,0 +1,41 @@
+#ifndef WINDOW_FUNCTION_H
+#define WINDOW_FUNCTION_H
+
+// Window functions for the FFT input. A table is computed once per
+// blocksize and multiplied in where the samples are copied anyway: the FFTW
+// engine weights them while gathering each window into its row, and
+// aufgabe03_kiss while converting to kiss_fft_scalar. aufgabe03 decodes
+// straight into the FFT input and weights it in a second pass over the
+// block, which is still in L1 at that point.
+//
+// The tables are periodic (DFT-even, period blocksize) and normalised to a
+// coherent gain of 1, i.e. they sum to blocksize like the rectangular
+// window: a sine on a bin centre gives the same |X| and dB value whatever
+// the window, and only the leakage into the other bins differs.
+
+typedef enum {
+  WINDOW_RECTANGULAR,
+  WINDOW_HANN,
+  WINDOW_HAMMING,
+  WINDOW_BLACKMAN_HARRIS, // 4-term, -92 dB side lobes
+  WINDOW_KAISER,
+  WINDOW_FLAT_TOP         // 5-term, flat to 0.01 dB for amplitude readings
+} Window_Type;
+
+#define DEFAULT_KAISER_BETA 8.6
+
+typedef struct {
+  Window_Type type;
+  double kaiser_beta;
+} Window_Spec;
+
+// "rectangular" (or "none"), "hann", "hamming", "blackman-harris", "kaiser",
+// "kaiser:<beta>" or "flat-top"; returns 0 if unknown.
+int parse_window(const char* name, Window_Spec* spec);
+const char* window_name(Window_Type type);
+
+// Normalised coefficients for `size` samples, or NULL for the rectangular
+// window, which the transforms then skip entirely.
+double* create_window(const Window_Spec* spec, int size);
+
+#endif